@@ -0,0 +1,295 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Benchmarks of the FFI layer over several TableGen corpora.
+//!
+//! A synthetic corpus is always benchmarked. Real-world corpora are added
+//! when they can be found:
+//!
+//! - `X86`: the X86 target description, if `TBLGEN_BENCH_LLVM_SRC` points
+//!   to the `llvm` directory of an LLVM source checkout.
+//! - `MLIR`: a set of MLIR dialects, if the `TABLEGEN_<version>_PREFIX`
+//!   variable used by the doc tests points to an LLVM installation with MLIR.
+//!
+//! Throughput is reported per operation (parsed def, visited record, field
+//! lookup, ...). Before each group, the number of Rust heap allocations per
+//! operation is printed; allocations made by LLVM are not included.
+
+use std::{
+    alloc::{GlobalAlloc, Layout, System},
+    env,
+    hint::black_box,
+    path::Path,
+    sync::atomic::{AtomicUsize, Ordering},
+};
+
+use criterion::{
+    criterion_group, criterion_main, measurement::WallTime, BenchmarkGroup, Criterion, Throughput,
+};
+use tblgen_alt::{
+    init::{BitsInit, DagInit, TypedInit},
+    Record, RecordKeeper, TableGenParser,
+};
+
+struct CountingAllocator;
+
+static ALLOCATIONS: AtomicUsize = AtomicUsize::new(0);
+
+unsafe impl GlobalAlloc for CountingAllocator {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        System.realloc(ptr, layout, new_size)
+    }
+}
+
+#[global_allocator]
+static GLOBAL: CountingAllocator = CountingAllocator;
+
+#[cfg(feature = "llvm16-0")]
+const PREFIX_VARIABLE: &str = "TABLEGEN_160_PREFIX";
+#[cfg(feature = "llvm17-0")]
+const PREFIX_VARIABLE: &str = "TABLEGEN_170_PREFIX";
+#[cfg(feature = "llvm18-0")]
+const PREFIX_VARIABLE: &str = "TABLEGEN_180_PREFIX";
+
+/// A TableGen input and the class and fields that are queried on it.
+struct Corpus {
+    name: &'static str,
+    source: String,
+    include_dirs: Vec<String>,
+    class: &'static str,
+    bits_field: Option<&'static str>,
+    string_field: &'static str,
+    dag_field: &'static str,
+}
+
+impl Corpus {
+    fn parse(&self) -> Option<RecordKeeper<'static>> {
+        let mut parser = TableGenParser::new().add_source(&self.source).ok()?;
+        for dir in &self.include_dirs {
+            parser = parser.add_include_path(dir);
+        }
+        parser.parse().ok()
+    }
+}
+
+fn synthetic() -> Corpus {
+    let mut source = String::from(
+        r#"
+        def ins;
+        def reg;
+        def imm;
+        class Inst<bits<8> op, string asm, dag operands> {
+            bits<8> Opcode = op;
+            bits<32> Encoding = { op, op, op, op };
+            string AsmString = asm;
+            dag InOperandList = operands;
+        }
+        "#,
+    );
+    for i in 0..20_000 {
+        source.push_str(&format!(
+            "def I{i} : Inst<{}, \"inst{i} $dst, $src\", (ins (reg $a), (imm $b), reg:$c)>;\n",
+            i % 256
+        ));
+    }
+    Corpus {
+        name: "synthetic",
+        source,
+        include_dirs: Vec::new(),
+        class: "Inst",
+        bits_field: Some("Encoding"),
+        string_field: "AsmString",
+        dag_field: "InOperandList",
+    }
+}
+
+fn x86() -> Option<Corpus> {
+    let root = env::var("TBLGEN_BENCH_LLVM_SRC").ok()?;
+    let target = Path::new(&root).join("lib/Target/X86");
+    target.join("X86.td").exists().then(|| Corpus {
+        name: "X86",
+        source: "include \"X86.td\"".into(),
+        include_dirs: vec![
+            format!("{root}/include"),
+            target.to_string_lossy().into_owned(),
+        ],
+        class: "Instruction",
+        bits_field: Some("TSFlags"),
+        string_field: "AsmString",
+        dag_field: "InOperandList",
+    })
+}
+
+fn mlir() -> Option<Corpus> {
+    let include = format!("{}/include", env::var(PREFIX_VARIABLE).ok()?);
+    let dialects = [
+        "mlir/Dialect/Arith/IR/ArithOps.td",
+        "mlir/Dialect/Func/IR/FuncOps.td",
+        "mlir/Dialect/LLVMIR/LLVMOps.td",
+        "mlir/Dialect/MemRef/IR/MemRefOps.td",
+        "mlir/Dialect/SCF/IR/SCFOps.td",
+    ];
+    let source: String = dialects
+        .iter()
+        .filter(|dialect| Path::new(&include).join(dialect).exists())
+        .map(|dialect| format!("include \"{dialect}\"\n"))
+        .collect();
+    (!source.is_empty()).then(|| Corpus {
+        name: "MLIR",
+        source,
+        include_dirs: vec![include],
+        class: "Op",
+        bits_field: None,
+        string_field: "summary",
+        dag_field: "arguments",
+    })
+}
+
+/// Prints the Rust heap allocations per operation of one run of `f`.
+fn report_allocations(group: &str, bench: &str, ops: usize, f: impl FnOnce()) {
+    let before = ALLOCATIONS.load(Ordering::Relaxed);
+    f();
+    let allocations = ALLOCATIONS.load(Ordering::Relaxed) - before;
+    eprintln!(
+        "{group}/{bench}: {:.2} allocations/op",
+        allocations as f64 / ops.max(1) as f64
+    );
+}
+
+fn bench_elements(
+    group: &mut BenchmarkGroup<WallTime>,
+    name: &str,
+    bench: &str,
+    ops: usize,
+    mut f: impl FnMut(),
+) {
+    report_allocations(name, bench, ops, &mut f);
+    group.throughput(Throughput::Elements(ops as u64));
+    group.bench_function(bench, |b| b.iter(&mut f));
+}
+
+fn walk_dag(dag: DagInit) -> usize {
+    dag.args()
+        .map(|(_, arg)| match arg {
+            TypedInit::Dag(dag) => 1 + walk_dag(dag),
+            _ => 1,
+        })
+        .sum()
+}
+
+fn bench_corpus(c: &mut Criterion, corpus: &Corpus) {
+    let Some(keeper) = corpus.parse() else {
+        eprintln!("{}: failed to parse, skipping", corpus.name);
+        return;
+    };
+    let name = corpus.name;
+    let num_defs = keeper.defs().len();
+    let derived: Vec<Record> = keeper.all_derived_definitions(corpus.class).collect();
+
+    let mut group = c.benchmark_group(name);
+
+    group.sample_size(10);
+    bench_elements(&mut group, name, "parse", num_defs, || {
+        black_box(corpus.parse());
+    });
+    group.sample_size(100);
+
+    bench_elements(&mut group, name, "defs", num_defs, || {
+        for (name, def) in keeper.defs() {
+            black_box((name.ok(), def));
+        }
+    });
+
+    bench_elements(
+        &mut group,
+        name,
+        "all_derived_definitions",
+        derived.len(),
+        || {
+            for def in keeper.all_derived_definitions(corpus.class) {
+                black_box(def);
+            }
+        },
+    );
+
+    bench_elements(&mut group, name, "value", derived.len(), || {
+        for def in &derived {
+            black_box(def.value(corpus.string_field).ok());
+        }
+    });
+
+    if let Some(id) = keeper.field_id(corpus.string_field) {
+        bench_elements(&mut group, name, "value_by_id", derived.len(), || {
+            for def in &derived {
+                black_box(def.value_by_id(id).ok());
+            }
+        });
+    }
+
+    bench_elements(&mut group, name, "str_value", derived.len(), || {
+        for def in &derived {
+            black_box(def.str_value(corpus.string_field).ok());
+        }
+    });
+
+    if let Some(field) = corpus.bits_field {
+        let bits: Vec<BitsInit> = derived
+            .iter()
+            .filter_map(|def| def.value(field).ok()?.init.as_bits().ok())
+            .collect();
+        bench_elements(&mut group, name, "bits_to_vec", bits.len(), || {
+            for &init in &bits {
+                black_box(Vec::<bool>::from(init));
+            }
+        });
+        bench_elements(&mut group, name, "bits_to_packed", bits.len(), || {
+            let mut words = [0; 4];
+            for &init in &bits {
+                black_box(init.to_packed(&mut words, None));
+            }
+        });
+    }
+
+    let dags: Vec<DagInit> = derived
+        .iter()
+        .filter_map(|def| def.value(corpus.dag_field).ok()?.init.as_dag().ok())
+        .collect();
+    bench_elements(&mut group, name, "dag_walk", dags.len(), || {
+        for &dag in &dags {
+            black_box(walk_dag(dag));
+        }
+    });
+    bench_elements(&mut group, name, "dag_flatten", dags.len(), || {
+        for &dag in &dags {
+            black_box(dag.flatten());
+        }
+    });
+
+    group.finish();
+}
+
+fn corpora(c: &mut Criterion) {
+    let corpora = [Some(synthetic()), x86(), mlir()];
+    for corpus in corpora.iter().flatten() {
+        bench_corpus(c, corpus);
+    }
+}
+
+criterion_group!(benches, corpora);
+criterion_main!(benches);
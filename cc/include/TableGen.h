@@ -51,20 +51,419 @@ typedef struct TableGenStringRef {
 
 typedef void (*TableGenStringCallback)(TableGenStringRef, void *);
 
+/// Value of an init decoded with `tableGenInitDecode`, depending on its kind:
+/// - Bit: `bit`
+/// - Int: `integer`
+/// - String, Code: `string`
+/// - Record: `record`
+/// - Bits, List, Dag: `num_elements`, the number of bits, elements or
+///   arguments
+typedef union TableGenInitPayload {
+  int8_t bit;
+  int64_t integer;
+  TableGenStringRef string;
+  TableGenRecordRef record;
+  size_t num_elements;
+} TableGenInitPayload;
+
+typedef struct TableGenInitValue {
+  TableGenRecTyKind kind;
+  /// False if the init is no concrete value of its kind, such as a reference
+  /// to a template argument, in which case `payload` is unspecified.
+  TableGenBool has_value;
+  TableGenInitPayload payload;
+} TableGenInitValue;
+
+/// Caller-owned output buffer for the `PrintToBuffer` functions, which append
+/// to `data` and advance `len`.
+typedef struct TableGenBuffer {
+  char *data;
+  size_t len;
+  size_t capacity;
+} TableGenBuffer;
+
+/// Called when a buffer needs room for `additional` more bytes after `len`.
+/// Must update `data` and `capacity`, keeping the first `len` bytes, or
+/// return false to stop printing.
+typedef TableGenBool (*TableGenBufferReserveCallback)(TableGenBuffer *buffer,
+                                                      size_t additional,
+                                                      void *userData);
+
+/// Borrowed array of records.
+typedef struct TableGenRecordSpan {
+  const TableGenRecordRef *records;
+  size_t len;
+} TableGenRecordSpan;
+
+/// A position in a source buffer, layout-compatible with `llvm::SMLoc`.
+typedef struct TableGenSMLoc {
+  const char *ptr;
+} TableGenSMLoc;
+
+/// Borrowed list of source locations, layout-compatible with
+/// `llvm::ArrayRef<llvm::SMLoc>`. The locations of records and values stay
+/// valid as long as their keeper and do not need to be freed.
+typedef struct TableGenSourceLocationSpan {
+  const TableGenSMLoc *locs;
+  size_t len;
+} TableGenSourceLocationSpan;
+
+/// A resolved source location. `buffer` is 0 if the location is not in any
+/// buffer of the parser.
+typedef struct TableGenLineColumn {
+  uint32_t buffer;
+  uint32_t line;
+  uint32_t column;
+} TableGenLineColumn;
+
+/// Interned field name of a record keeper, see
+/// `tableGenRecordKeeperGetFieldId`. Zero is never a valid id.
+typedef uint32_t TableGenFieldId;
+
+/// Class of a record keeper, see `tableGenRecordKeeperGetClassId`. Zero is
+/// never a valid id.
+typedef uint32_t TableGenClassId;
+
+/// Class or def of a record keeper, see `tableGenRecordKeeperGetRecordId`.
+/// Zero is never a valid id.
+typedef uint32_t TableGenRecordId;
+
+typedef enum {
+  TableGenRecordAdded,
+  TableGenRecordRemoved,
+  TableGenRecordModified,
+} TableGenRecordChangeKind;
+
+/// Comparison of a field with a constant, see `tableGenPredicateCompareInt`.
+typedef enum {
+  TableGenPredicateEq,
+  TableGenPredicateNe,
+  TableGenPredicateLt,
+  TableGenPredicateLe,
+  TableGenPredicateGt,
+  TableGenPredicateGe,
+} TableGenPredicateOp;
+
+/// Index of a node of a predicate, see `tableGenPredicateCreate`.
+typedef uint32_t TableGenPredicateNode;
+
+/// A field that differs between the old and new version of a modified
+/// record. `old_value` is null for added fields and `new_value` is null for
+/// removed fields.
+typedef struct TableGenFieldChange {
+  TableGenRecordChangeKind kind;
+  TableGenStringRef name;
+  TableGenRecordValRef old_value;
+  TableGenRecordValRef new_value;
+} TableGenFieldChange;
+
+/// A class or def that differs between two keepers. `old_record` is null for
+/// added records and `new_record` is null for removed records.
+typedef struct TableGenRecordChange {
+  TableGenRecordChangeKind kind;
+  TableGenBool is_class;
+  TableGenRecordRef old_record;
+  TableGenRecordRef new_record;
+  /// Fields that differ if the record was modified: removed and modified
+  /// fields in the order of the old record, then added fields in the order
+  /// of the new record. Empty if only the superclasses or template arguments
+  /// of the record changed.
+  const TableGenFieldChange *field_changes;
+  size_t num_field_changes;
+} TableGenRecordChange;
+
+/// One node of a flattened init, see `tableGenInitFlatten`. Nodes are stored
+/// in preorder: the children of a node directly follow it, and the nodes in
+/// `[index + 1, end)` form its subtree.
+typedef struct TableGenInitNode {
+  /// Null for untyped values, such as `?`.
+  TableGenTypedInitRef init;
+  TableGenRecTyKind kind;
+  /// The operator of a dag or the record of a def, null otherwise.
+  TableGenRecordRef record;
+  /// The name of the argument if the parent is a dag, empty otherwise.
+  TableGenStringRef name;
+  /// Index of the parent node, or `UINT32_MAX` for the root.
+  uint32_t parent;
+  uint32_t num_children;
+  uint32_t end;
+} TableGenInitNode;
+
+typedef struct TableGenNamedRecord {
+  TableGenStringRef name;
+  TableGenRecordRef record;
+} TableGenNamedRecord;
+
+/// Statistics of a parser and of the C API, see `tableGenStatsGet`.
+typedef struct TableGenStats {
+  /// Time spent reading source files and copying source strings.
+  uint64_t read_ns;
+  /// Time spent in `tableGenParse`, which lexes, parses and elaborates all
+  /// records in a single step.
+  uint64_t parse_ns;
+  uint64_t num_parses;
+  /// Number and total size of the source buffers, including files pulled in
+  /// through `include`.
+  uint64_t num_buffers;
+  uint64_t num_source_bytes;
+  /// Records and record values created by the last successful parse.
+  uint64_t num_classes;
+  uint64_t num_defs;
+  uint64_t num_values;
+  /// Heap allocations made by the C API on behalf of the caller, counted
+  /// process-wide while counters are enabled.
+  uint64_t num_iterator_allocations;
+  uint64_t num_vector_allocations;
+  uint64_t num_location_allocations;
+  uint64_t num_string_allocations;
+  uint64_t num_other_allocations;
+} TableGenStats;
+
+/// Estimated bytes held by a record keeper and its parser, see
+/// `tableGenRecordKeeperMemoryUsage`.
+typedef struct TableGenMemoryUsage {
+  /// Records, including their names, superclass lists and locations.
+  uint64_t records;
+  /// Record values of all records.
+  uint64_t values;
+  /// Inits reachable from the records, each counted once. Inits are uniqued
+  /// by LLVM and may also be used by other keepers.
+  uint64_t inits;
+  /// Source buffers on the heap and mapped source files. Buffers shared
+  /// with other parsers are counted by each of them.
+  uint64_t sources;
+  uint64_t mapped_sources;
+  /// Indices and caches built by the C API for the keeper.
+  uint64_t indices;
+} TableGenMemoryUsage;
+
+typedef enum {
+  /// Drops the caches of resolved values and structural hashes of a keeper,
+  /// which are rebuilt when needed.
+  TableGenCompactCaches = 1 << 0,
+  /// Replaces every source buffer of a parser with an empty one. Locations
+  /// of records keep their identity, but are no longer resolved to a file,
+  /// line or column, and diagnostics are printed without source lines.
+  /// Changes to source files are still detected through hashes of their
+  /// contents, but the parser can no longer parse, and reloading it fails if
+  /// it has input strings.
+  TableGenCompactSources = 1 << 1,
+} TableGenCompactFlags;
+
+typedef void (*TableGenCallCountCallback)(TableGenStringRef name,
+                                          uint64_t count, void *userData);
+
+// Snapshot format
+//
+// A snapshot is a single flat, read-only block of memory. All structs below
+// are stored in it as-is, and all references between them are indices or
+// byte offsets relative to the start of the snapshot, so it can be memory
+// mapped and read without any decoding step.
+
+#define TABLEGEN_SNAPSHOT_VERSION 1
+
+typedef enum {
+  TABLEGEN_SNAPSHOT_RECORD_CLASS = 1 << 0,
+  TABLEGEN_SNAPSHOT_RECORD_ANONYMOUS = 1 << 1,
+} TableGenSnapshotRecordFlags;
+
+typedef enum {
+  TableGenSnapshotUnsetInitKind,
+  TableGenSnapshotBitInitKind,
+  TableGenSnapshotBitsInitKind,
+  TableGenSnapshotIntInitKind,
+  TableGenSnapshotStringInitKind,
+  TableGenSnapshotCodeInitKind,
+  TableGenSnapshotListInitKind,
+  TableGenSnapshotDagInitKind,
+  TableGenSnapshotDefInitKind,
+  TableGenSnapshotUnresolvedInitKind,
+} TableGenSnapshotInitKind;
+
+/// Byte range in the string section.
+typedef struct {
+  uint32_t offset;
+  uint32_t len;
+} TableGenSnapshotString;
+
+/// Array of `count` elements starting `offset` bytes into the snapshot.
+typedef struct {
+  uint64_t offset;
+  uint64_t count;
+} TableGenSnapshotSection;
+
+typedef struct {
+  uint8_t magic[8];
+  uint32_t version;
+  /// Number of leading buffers that were added to the parser directly. The
+  /// remaining buffers were pulled in through `include`.
+  uint32_t num_input_buffers;
+  /// Hash of the input buffers and include paths of the parser.
+  uint64_t key;
+  /// Number of leading records that are classes. The rest are defs.
+  uint64_t num_classes;
+  TableGenSnapshotSection strings;   // char
+  TableGenSnapshotSection buffers;   // TableGenSnapshotBuffer
+  TableGenSnapshotSection records;   // TableGenSnapshotRecord
+  TableGenSnapshotSection values;    // TableGenSnapshotValue
+  TableGenSnapshotSection inits;     // TableGenSnapshotInit
+  TableGenSnapshotSection indices;   // uint32_t
+  TableGenSnapshotSection locations; // TableGenSnapshotLocation
+} TableGenSnapshotHeader;
+
+typedef struct {
+  TableGenSnapshotString identifier;
+  uint64_t size;
+  uint64_t hash;
+} TableGenSnapshotBuffer;
+
+typedef struct {
+  uint32_t buffer;
+  uint32_t offset;
+  uint32_t line;
+  uint32_t column;
+} TableGenSnapshotLocation;
+
+typedef struct {
+  TableGenSnapshotString name;
+  uint32_t flags;
+  /// Range in the location section.
+  uint32_t first_location;
+  uint32_t num_locations;
+  /// Range in the index section, holding record indices of all superclasses.
+  uint32_t first_superclass;
+  uint32_t num_superclasses;
+  /// Range in the value section.
+  uint32_t first_value;
+  uint32_t num_values;
+} TableGenSnapshotRecord;
+
+typedef struct {
+  TableGenSnapshotString name;
+  /// Printed type of the field, e.g. `bits<4>` or `list<Register>`.
+  TableGenSnapshotString type;
+  /// A TableGenRecTyKind.
+  uint32_t kind;
+  /// Index in the init section.
+  uint32_t init;
+  /// Index in the location section.
+  uint32_t location;
+  uint32_t reserved;
+} TableGenSnapshotValue;
+
+/// Inits are deduplicated, so the same index can be referenced many times.
+///
+/// - Bit: `value` is 0 or 1.
+/// - Int: `value` is the integer.
+/// - Def: `value` is the record index.
+/// - String, Code, Unresolved: `string` is the value, or the printed init
+///   for unresolved values.
+/// - Bits, List: `count` init indices start at `first` in the index section.
+/// - Dag: `value` is the init index of the operator and `string` the dag
+///   name. `count` arguments start at `first` in the index section, each
+///   stored as three entries: init index, name offset and name length.
+typedef struct {
+  uint32_t kind;
+  uint32_t first;
+  uint32_t count;
+  uint32_t reserved;
+  int64_t value;
+  TableGenSnapshotString string;
+} TableGenSnapshotInit;
+
 TableGenParserRef tableGenGet();
 void tableGenFree(TableGenParserRef tg_ref);
 TableGenBool tableGenAddSource(TableGenParserRef tg_ref, const char *source);
+/// Adds a source string of the given length, which is copied once.
+TableGenBool tableGenAddSourceRef(TableGenParserRef tg_ref,
+                                  TableGenStringRef source);
 TableGenBool tableGenAddSourceFile(TableGenParserRef tg_ref,
                                    TableGenStringRef source);
+/// Same as `tableGenAddSourceFile`, but reads the file through a process-wide
+/// cache, so that parsers adding the same unchanged file share a single,
+/// memory-mapped copy of it. Files pulled in through `include` are not
+/// cached.
+TableGenBool tableGenAddSharedSourceFile(TableGenParserRef tg_ref,
+                                         TableGenStringRef source);
 void tableGenAddIncludePath(TableGenParserRef tg_ref,
                             TableGenStringRef include);
 
+/// Returns true if any file read by the parser, including files pulled in
+/// through `include` during a parse, changed on disk since it was read.
+TableGenBool tableGenSourcesChanged(TableGenParserRef tg_ref);
+/// Returns a new parser with the same include paths and sources, re-reading
+/// source files from disk and copying source strings. Parsing it and
+/// diffing the result against the previous keeper with
+/// `tableGenRecordKeeperDiff` gives the records affected by an edit.
+/// Returns null if a source file can no longer be read.
+TableGenParserRef tableGenReload(TableGenParserRef tg_ref);
+
 /// NOTE: TableGen currently relies on global state within a given parser
-///       invocation, so this function is not thread-safe.
+///       invocation. Concurrent calls are therefore serialized internally,
+///       which makes this function thread-safe but not parallel.
 TableGenRecordKeeperRef tableGenParse(TableGenParserRef tg_ref);
+/// Parses `count` independent parsers, storing each resulting keeper (or null
+/// on failure) in `rk_refs`. Returns true if all parses succeeded. The
+/// parsers are parsed one after another under the same lock as
+/// `tableGenParse`, so this is a convenience rather than a faster path.
+TableGenBool tableGenParseBatch(TableGenParserRef *tg_refs, size_t count,
+                                TableGenRecordKeeperRef *rk_refs);
+
+// Lazy parsing
+//
+// A lazy keeper splits the sources of a parser into top-level statements
+// without parsing them. Looking up a record parses only the statements it
+// depends on, and records are only parsed once. Records found in different
+// parses are distinct objects, so classes returned by a lazy keeper should
+// only be compared by name. Statements that do not declare a single name,
+// such as `foreach`, anonymous defs and asserts, are parsed with every
+// record. If a record cannot be attributed to a statement, the records it
+// depends on cannot be determined because their names are computed, or the
+// sources contain a `dump`, all sources are parsed once, so lookups always
+// find the same records as `tableGenParse`. Looking up a name that no
+// statement declares parses all sources as well, unless the sources contain
+// no `foreach`, `if`, `defset`, anonymous or computed names, or multiclass
+// referring to `NAME`. A failed full parse is not retried, and later lookups
+// that need it return null.
+// Anonymous records are numbered per parse, so their names may still differ
+// from `tableGenParse`. The parser must outlive the keeper.
+
+/// Returns null if the parser has no sources or they were dropped.
+TableGenLazyRecordKeeperRef tableGenParseLazy(TableGenParserRef tg_ref);
+TableGenRecordRef
+tableGenLazyRecordKeeperGetDef(TableGenLazyRecordKeeperRef lk_ref,
+                               TableGenStringRef name);
+TableGenRecordRef
+tableGenLazyRecordKeeperGetClass(TableGenLazyRecordKeeperRef lk_ref,
+                                 TableGenStringRef name);
+/// Parses the records with the given names and their dependencies at once,
+/// which is faster than looking them up one by one. Returns false if the
+/// sources are invalid.
+TableGenBool tableGenLazyRecordKeeperLoad(TableGenLazyRecordKeeperRef lk_ref,
+                                          const TableGenStringRef *names,
+                                          size_t len);
+/// Returns the number of times (part of) the sources were parsed.
+size_t tableGenLazyRecordKeeperGetNumParses(TableGenLazyRecordKeeperRef lk_ref);
+/// Returns true if all sources were parsed.
+TableGenBool
+tableGenLazyRecordKeeperIsComplete(TableGenLazyRecordKeeperRef lk_ref);
+void tableGenLazyRecordKeeperFree(TableGenLazyRecordKeeperRef lk_ref);
 
 // LLVM RecordKeeper
 void tableGenRecordKeeperFree(TableGenRecordKeeperRef rk_ref);
+/// Makes `tableGenRecordKeeperFree` skip destroying the keeper and its
+/// records, which can take a noticeable amount of time for large keepers.
+/// Meant for short-lived tools that exit soon after.
+void tableGenRecordKeeperSetLeakOnFree(TableGenRecordKeeperRef rk_ref,
+                                       TableGenBool leak);
+/// Prints all classes and defs, calling `callback` each time `bufferSize`
+/// bytes have been collected.
+void tableGenRecordKeeperPrint(TableGenRecordKeeperRef rk_ref,
+                               TableGenStringCallback callback, void *userData,
+                               size_t bufferSize);
+TableGenBool tableGenRecordKeeperPrintToBuffer(
+    TableGenRecordKeeperRef rk_ref, TableGenBuffer *buffer,
+    TableGenBufferReserveCallback reserve, void *userData);
 TableGenRecordMapRef
 tableGenRecordKeeperGetClasses(TableGenRecordKeeperRef rk_ref);
 TableGenRecordMapRef
@@ -76,11 +475,111 @@ TableGenRecordRef tableGenRecordKeeperGetDef(TableGenRecordKeeperRef rk_ref,
 TableGenRecordVectorRef
 tableGenRecordKeeperGetAllDerivedDefinitions(TableGenRecordKeeperRef rk_ref,
                                              TableGenStringRef className);
+/// Returns all defs deriving from the given class from an index that is
+/// built on first use. The span is owned by the keeper and stays valid until
+/// it is freed. Unknown classes yield an empty span.
+TableGenRecordSpan
+tableGenRecordKeeperGetDerivedDefinitionsSpan(TableGenRecordKeeperRef rk_ref,
+                                              TableGenStringRef className);
+/// Same as `tableGenRecordKeeperGetDerivedDefinitionsSpan`, but takes the
+/// id of the class instead of its name. Unknown ids yield an empty span.
+TableGenRecordSpan tableGenRecordKeeperGetDerivedDefinitionsSpanById(
+    TableGenRecordKeeperRef rk_ref, TableGenClassId id);
+/// Returns all defs deriving from every one of the given classes.
+TableGenRecordVectorRef tableGenRecordKeeperGetAllDerivedDefinitionsMulti(
+    TableGenRecordKeeperRef rk_ref, const TableGenStringRef *classNames,
+    size_t len);
+/// Same as `tableGenRecordKeeperGetAllDerivedDefinitionsMulti`, but takes
+/// class ids instead of names.
+TableGenRecordVectorRef tableGenRecordKeeperGetAllDerivedDefinitionsMultiById(
+    TableGenRecordKeeperRef rk_ref, const TableGenClassId *ids, size_t len);
 
 TableGenRecordRef tableGenRecordVectorGet(TableGenRecordVectorRef vec_ref,
                                           size_t index);
+TableGenRecordSpan tableGenRecordVectorGetSpan(TableGenRecordVectorRef vec_ref);
 void tableGenRecordVectorFree(TableGenRecordVectorRef vec_ref);
 
+/// Fills `records` with the name and record of the first `len` classes, in
+/// order, and returns the number of elements written. All classes fit if
+/// `len` is `tableGenRecordKeeperGetNumClasses`.
+size_t tableGenRecordKeeperGetNumClasses(TableGenRecordKeeperRef rk_ref);
+size_t tableGenRecordKeeperGetClassesArray(TableGenRecordKeeperRef rk_ref,
+                                           TableGenNamedRecord *records,
+                                           size_t len);
+/// Fills `records` with the name and record of the first `len` defs, in
+/// order, and returns the number of elements written. All defs fit if `len`
+/// is `tableGenRecordKeeperGetNumDefs`.
+size_t tableGenRecordKeeperGetNumDefs(TableGenRecordKeeperRef rk_ref);
+size_t tableGenRecordKeeperGetDefsArray(TableGenRecordKeeperRef rk_ref,
+                                        TableGenNamedRecord *records,
+                                        size_t len);
+
+/// Compares the classes and defs of two keepers by name and structural hash,
+/// see `tableGenRecordHash`. Changes are ordered as classes, then defs, each
+/// by name. Records present in both keepers are compared from up to
+/// `num_threads` threads, or one per hardware thread if it is 0.
+TableGenRecordDiffRef tableGenRecordKeeperDiff(TableGenRecordKeeperRef old_ref,
+                                               TableGenRecordKeeperRef new_ref,
+                                               size_t num_threads);
+size_t tableGenRecordDiffGetNumChanges(TableGenRecordDiffRef diff_ref);
+const TableGenRecordChange *
+tableGenRecordDiffGetChanges(TableGenRecordDiffRef diff_ref);
+void tableGenRecordDiffFree(TableGenRecordDiffRef diff_ref);
+
+/// Returns a structural hash of all classes and defs of the keeper, see
+/// `tableGenRecordHash`. Keepers with the same records have the same hash,
+/// regardless of the numbering of their anonymous defs.
+uint64_t tableGenRecordKeeperHash(TableGenRecordKeeperRef rk_ref);
+
+/// Returns the id of the field with the given name, or 0 if no record of the
+/// keeper has such a field. The first call builds an index over the fields
+/// of all records, which makes lookups by id a binary search over integers.
+TableGenFieldId tableGenRecordKeeperGetFieldId(TableGenRecordKeeperRef rk_ref,
+                                               TableGenStringRef name);
+TableGenStringRef tableGenRecordKeeperGetFieldName(TableGenRecordKeeperRef rk_ref,
+                                                   TableGenFieldId id);
+/// Returns the names of all fields indexed by field id, with an empty name at
+/// index 0. The array is owned by the keeper.
+const TableGenStringRef *
+tableGenRecordKeeperGetFieldNames(TableGenRecordKeeperRef rk_ref, size_t *len);
+
+/// Returns the id of the class with the given name, or 0 if there is no such
+/// class. The first call stores the superclasses of every class and def as a
+/// bitset indexed by class id, which makes subclass tests single bit tests.
+TableGenClassId tableGenRecordKeeperGetClassId(TableGenRecordKeeperRef rk_ref,
+                                               TableGenStringRef name);
+/// Returns the dense id of a class or def of the keeper, or 0 if the record
+/// belongs to another keeper. Classes are numbered from 1 in order, followed
+/// by the defs in order, so the record id of a class is its class id, and
+/// tables of records can be vectors indexed by id. The first call builds
+/// the table of all records.
+TableGenRecordId tableGenRecordKeeperGetRecordId(TableGenRecordKeeperRef rk_ref,
+                                                 TableGenRecordRef record_ref);
+/// Stores the ids of `len` records in `ids`.
+void tableGenRecordKeeperGetRecordIds(TableGenRecordKeeperRef rk_ref,
+                                      const TableGenRecordRef *records,
+                                      size_t len, TableGenRecordId *ids);
+/// Returns the class or def with the given id, or null.
+TableGenRecordRef
+tableGenRecordKeeperGetRecordById(TableGenRecordKeeperRef rk_ref,
+                                  TableGenRecordId id);
+/// Returns all classes and defs indexed by record id, with null at index 0.
+/// The span is owned by the keeper.
+TableGenRecordSpan
+tableGenRecordKeeperGetRecordTable(TableGenRecordKeeperRef rk_ref);
+/// Returns the names of all classes and defs indexed by record id, with an
+/// empty name at index 0. The array is owned by the keeper.
+const TableGenStringRef *
+tableGenRecordKeeperGetRecordNames(TableGenRecordKeeperRef rk_ref,
+                                   size_t *len);
+
+/// Sets `result[i]`, unless `result` is null, to whether `records[i]` is a
+/// subclass of all `num_ids` classes, and returns the number of such
+/// records. All records must belong to the keeper of the ids.
+size_t tableGenRecordsAreSubclassesOf(const TableGenRecordRef *records,
+                                      size_t len, const TableGenClassId *ids,
+                                      size_t num_ids, uint8_t *result);
+
 TableGenRecordKeeperIteratorRef
 tableGenRecordKeeperGetFirstClass(TableGenRecordKeeperRef rk_ref);
 
@@ -103,30 +602,90 @@ TableGenRecordKeeperRef tableGenRecordGetRecords(TableGenRecordRef record_ref);
 TableGenStringRef tableGenRecordGetName(TableGenRecordRef record_ref);
 TableGenRecordValRef tableGenRecordGetValue(TableGenRecordRef record_ref,
                                             TableGenStringRef name);
+/// Same as `tableGenRecordValGetType` on the field with the given name.
 TableGenRecTyKind tableGenRecordGetFieldType(TableGenRecordRef record_ref,
                                              TableGenStringRef name);
+/// Same as `tableGenRecordGetValue`, with an id of the keeper that owns the
+/// record.
+TableGenRecordValRef tableGenRecordGetValueById(TableGenRecordRef record_ref,
+                                                TableGenFieldId id);
+TableGenRecTyKind tableGenRecordGetFieldTypeById(TableGenRecordRef record_ref,
+                                                 TableGenFieldId id);
+/// Returns the value of `rv_ref`, a field of `record_ref`, with references to
+/// other fields and template arguments of the record resolved and operators
+/// folded as far as possible. Unlike `tableGenRecordValGetValue`, this gives
+/// concrete values for fields of classes that are computed from other fields,
+/// and for bits that mix constant bits with bits of other fields. Results are
+/// cached by the keeper that owns the record.
+TableGenTypedInitRef
+tableGenRecordGetResolvedValue(TableGenRecordRef record_ref,
+                               TableGenRecordValRef rv_ref);
 TableGenBool tableGenRecordIsAnonymous(TableGenRecordRef record_ref);
 TableGenBool tableGenRecordIsSubclassOf(TableGenRecordRef record_ref,
                                         TableGenStringRef name);
+/// Same as `tableGenRecordIsSubclassOf`, with a class id of the keeper that
+/// owns the record.
+TableGenBool tableGenRecordIsSubclassOfId(TableGenRecordRef record_ref,
+                                          TableGenClassId id);
 void tableGenRecordPrint(TableGenRecordRef record_ref,
                          TableGenStringCallback callback, void *userData);
+/// Same as `tableGenRecordPrint`, but collects up to `bufferSize` bytes in
+/// between calls to `callback`. Chunks may end in the middle of a UTF-8
+/// sequence.
+void tableGenRecordPrintBuffered(TableGenRecordRef record_ref,
+                                 TableGenStringCallback callback,
+                                 void *userData, size_t bufferSize);
+/// Appends the printed record to `buffer`. Returns false if `reserve` failed.
+TableGenBool tableGenRecordPrintToBuffer(TableGenRecordRef record_ref,
+                                         TableGenBuffer *buffer,
+                                         TableGenBufferReserveCallback reserve,
+                                         void *userData);
 void tableGenRecordDump(TableGenRecordRef record_ref);
+/// Returns a structural hash of the record, computed from its name, template
+/// arguments, superclasses and the name, type and value of every field.
+/// Referenced records contribute their name, except for anonymous records,
+/// which contribute their contents, so hashes do not change when anonymous
+/// records are renumbered. Hashes of records and shared inits are memoized
+/// by the keeper. Hashes are stable across processes, but not across LLVM
+/// versions.
+uint64_t tableGenRecordHash(TableGenRecordRef record_ref);
 TableGenSourceLocationRef tableGenRecordGetLoc(TableGenRecordRef record_ref);
+TableGenSourceLocationSpan
+tableGenRecordGetLocSpan(TableGenRecordRef record_ref);
 
 // LLVM RecordVal
 TableGenStringRef tableGenRecordValGetName(TableGenRecordValRef rv_ref);
 TableGenTypedInitRef tableGenRecordValGetNameInit(TableGenRecordValRef rv_ref);
+/// Returns the type of the field. String fields holding code (`[{ ... }]`)
+/// have kind TableGenCodeRecTyKind, as in `tableGenInitRecType`.
 TableGenRecTyKind tableGenRecordValGetType(TableGenRecordValRef rv_ref);
 TableGenTypedInitRef tableGenRecordValGetValue(TableGenRecordValRef rv_ref);
+/// Same as `tableGenInitDecode` on the value of the field.
+TableGenInitValue tableGenRecordValDecode(TableGenRecordValRef rv_ref);
 void tableGenRecordValTest(TableGenRecordValRef rv_ref);
 TableGenRecordValRef tableGenRecordGetFirstValue(TableGenRecordRef record_ref);
 TableGenRecordValRef tableGenRecordValNext(TableGenRecordRef record,
                                            TableGenRecordValRef current);
 void tableGenRecordValPrint(TableGenRecordValRef rv_ref,
                             TableGenStringCallback callback, void *userData);
+void tableGenRecordValPrintBuffered(TableGenRecordValRef rv_ref,
+                                    TableGenStringCallback callback,
+                                    void *userData, size_t bufferSize);
+TableGenBool
+tableGenRecordValPrintToBuffer(TableGenRecordValRef rv_ref,
+                               TableGenBuffer *buffer,
+                               TableGenBufferReserveCallback reserve,
+                               void *userData);
 void tableGenRecordValDump(TableGenRecordValRef rv_ref);
 TableGenSourceLocationRef tableGenRecordValGetLoc(TableGenRecordValRef rv_ref);
+TableGenSourceLocationSpan
+tableGenRecordValGetLocSpan(TableGenRecordValRef rv_ref);
 
+/// Returns the string value of the field, borrowed from the keeper, or a null
+/// string if it is not a string.
+TableGenStringRef tableGenRecordValGetValAsStringRef(TableGenRecordValRef rv_ref);
+/// Returns a copy of the string value that must be freed with
+/// `tableGenStringFree`. Prefer `tableGenRecordValGetValAsStringRef`.
 char *tableGenRecordValGetValAsNewString(TableGenRecordValRef rv_ref);
 TableGenBool tableGenRecordValGetValAsBit(TableGenRecordValRef rv_ref,
                                           int8_t *bit);
@@ -137,11 +696,122 @@ TableGenRecordRef tableGenRecordValGetValAsRecord(TableGenRecordValRef rv_ref);
 TableGenRecordRef
 tableGenRecordValGetValAsDefRecord(TableGenRecordValRef rv_ref);
 
+// Columns
+//
+// Reads the field with the given id of `len` records from the same keeper
+// into `values`. If `valid` is not null, `valid[i]` is set to whether record
+// `i` has the field with the expected type; otherwise `values[i]` is zeroed.
+// Returns the number of valid entries.
+size_t tableGenRecordsGetBitColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   int8_t *values, uint8_t *valid);
+size_t tableGenRecordsGetIntColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   int64_t *values, uint8_t *valid);
+/// The strings are borrowed from the keeper.
+size_t tableGenRecordsGetStringColumn(const TableGenRecordRef *records,
+                                      size_t len, TableGenFieldId id,
+                                      TableGenStringRef *values,
+                                      uint8_t *valid);
+size_t tableGenRecordsGetDefColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   TableGenRecordRef *values, uint8_t *valid);
+/// Same as `tableGenRecordsGetDefColumn`, storing the record ids of the defs.
+size_t tableGenRecordsGetDefIdColumn(const TableGenRecordRef *records,
+                                     size_t len, TableGenFieldId id,
+                                     TableGenRecordId *values, uint8_t *valid);
+
+// Parallel queries
+//
+// Once parsed, a record keeper is never modified, and all functions reading
+// records, record values and inits, as well as the derived definitions and
+// field indices of the keeper, may be called from several threads at once.
+// The same holds for printing diagnostics and resolving locations of a
+// parser. Functions that add sources to or parse with a parser, and freeing
+// any object, are not thread-safe.
+
+/// Called by `tableGenRecordsParallelForEach` for the record at `index`.
+typedef void (*TableGenRecordCallback)(TableGenRecordRef record, size_t index,
+                                       void *userData);
+/// Calls `callback` for each of the `len` records from up to `num_threads`
+/// threads, or one per hardware thread if `num_threads` is 0, and returns
+/// when all calls finished. Threads take records in small chunks from a
+/// shared counter, so uneven per-record work is balanced across threads.
+void tableGenRecordsParallelForEach(const TableGenRecordRef *records,
+                                    size_t len, TableGenRecordCallback callback,
+                                    void *userData, size_t num_threads);
+
+// Predicates
+//
+// A predicate filters the records of one keeper natively, so that only the
+// matching records cross the API. It is built once from nodes: every builder
+// function adds a node and returns its index, and nodes can only refer to
+// nodes added before them. Fields and classes are given by their ids in the
+// keeper; unknown names have id 0, which never matches. Fields that are not
+// concrete are resolved as by `tableGenRecordGetResolvedValue`. Building a
+// predicate is not thread-safe, evaluating it is.
+TableGenPredicateRef tableGenPredicateCreate(TableGenRecordKeeperRef rk_ref);
+void tableGenPredicateFree(TableGenPredicateRef pred_ref);
+/// Matches records deriving from the class.
+TableGenPredicateNode tableGenPredicateSubclassOf(TableGenPredicateRef pred_ref,
+                                                  TableGenClassId id);
+/// Matches records that have the field.
+TableGenPredicateNode tableGenPredicateHasField(TableGenPredicateRef pred_ref,
+                                                TableGenFieldId id);
+/// Matches records with a bit, int or fully known bits field for which
+/// `field op value` holds. Bits are read as an unsigned integer.
+TableGenPredicateNode tableGenPredicateCompareInt(TableGenPredicateRef pred_ref,
+                                                  TableGenFieldId id,
+                                                  TableGenPredicateOp op,
+                                                  int64_t value);
+/// Same as `tableGenPredicateCompareInt` for string and code fields, which
+/// are compared bytewise.
+TableGenPredicateNode
+tableGenPredicateCompareString(TableGenPredicateRef pred_ref,
+                               TableGenFieldId id, TableGenPredicateOp op,
+                               TableGenStringRef value);
+/// Matches records with a field referring to a def deriving from the class.
+TableGenPredicateNode
+tableGenPredicateDefSubclassOf(TableGenPredicateRef pred_ref,
+                               TableGenFieldId id, TableGenClassId class_id);
+/// Matches records matching all nodes, or any record if `len` is 0.
+TableGenPredicateNode tableGenPredicateAnd(TableGenPredicateRef pred_ref,
+                                           const TableGenPredicateNode *nodes,
+                                           size_t len);
+/// Matches records matching any of the nodes, or no record if `len` is 0.
+TableGenPredicateNode tableGenPredicateOr(TableGenPredicateRef pred_ref,
+                                          const TableGenPredicateNode *nodes,
+                                          size_t len);
+TableGenPredicateNode tableGenPredicateNot(TableGenPredicateRef pred_ref,
+                                           TableGenPredicateNode node);
+/// Returns true if the record, which must belong to the keeper of the
+/// predicate, matches the node.
+TableGenBool tableGenPredicateMatches(TableGenPredicateRef pred_ref,
+                                      TableGenPredicateNode node,
+                                      TableGenRecordRef record_ref);
+/// Returns the records matching the node, in order, evaluated from up to
+/// `num_threads` threads, or one per hardware thread if it is 0.
+TableGenRecordVectorRef
+tableGenPredicateFilter(TableGenPredicateRef pred_ref,
+                        TableGenPredicateNode node,
+                        const TableGenRecordRef *records, size_t len,
+                        size_t num_threads);
+/// Same as `tableGenPredicateFilter` for all defs of the keeper.
+TableGenRecordVectorRef
+tableGenPredicateFilterDefs(TableGenPredicateRef pred_ref,
+                            TableGenPredicateNode node, size_t num_threads);
+
 // LLVM ListType
 TableGenRecTyKind tableGenListRecordGetType(TableGenRecordValRef rv_ref);
 TableGenTypedInitRef tableGenListRecordGet(TableGenTypedInitRef rv_ref,
                                            size_t index);
 size_t tableGenListRecordNumElements(TableGenTypedInitRef rv_ref);
+/// Stores up to `len` elements of the list and their types in `elements` and
+/// `kinds`, either of which may be null. Untyped elements are stored as null.
+/// Returns the number of elements in the list.
+size_t tableGenListRecordGetElements(TableGenTypedInitRef rv_ref,
+                                     TableGenTypedInitRef *elements,
+                                     TableGenRecTyKind *kinds, size_t len);
 
 // LLVM DagType
 TableGenRecordRef tableGenDagRecordOperator(TableGenTypedInitRef rv_ref);
@@ -150,32 +820,201 @@ TableGenTypedInitRef tableGenDagRecordGet(TableGenTypedInitRef rv_ref,
 TableGenStringRef tableGenDagRecordArgName(TableGenTypedInitRef rv_ref,
                                            size_t index);
 size_t tableGenDagRecordNumArgs(TableGenTypedInitRef rv_ref);
+/// Same as `tableGenListRecordGetElements`, for the arguments of a dag and
+/// their names.
+size_t tableGenDagRecordGetArgs(TableGenTypedInitRef rv_ref,
+                                TableGenTypedInitRef *args,
+                                TableGenStringRef *names,
+                                TableGenRecTyKind *kinds, size_t len);
+/// Flattens an init and all dags and lists nested in it into a node table,
+/// see `TableGenInitNode`. The root is the first node. The result must be
+/// freed with `tableGenInitNodeArrayFree`.
+TableGenInitNode *tableGenInitFlatten(TableGenTypedInitRef ti, size_t *len);
 
 // Utility
+/// Returns the kind of the init. Strings in code format (`[{ ... }]`) have
+/// kind TableGenCodeRecTyKind.
 TableGenRecTyKind tableGenInitRecType(TableGenTypedInitRef ti);
+/// Returns the kind and value of the init in a single call, see
+/// `TableGenInitValue`.
+TableGenInitValue tableGenInitDecode(TableGenTypedInitRef ti);
 TableGenBool tableGenBitInitGetValue(TableGenTypedInitRef ti, int8_t *bit);
 int8_t *tableGenBitsInitGetValue(TableGenTypedInitRef ti, size_t *len);
 TableGenBool tableGenBitsInitGetNumBits(TableGenTypedInitRef ti, size_t *len);
+/// Packs the bits of a BitsInit into `words`, with bit `i` stored at
+/// `(words[i / 64] >> (i % 64)) & 1`. If `known` is not null, it receives a
+/// mask of the bits that are set to 0 or 1; unresolved bits are 0 in
+/// `words`. Both arrays must hold `num_words` words, and `num_words` must be
+/// at least `(num_bits + 63) / 64`. Does not allocate.
+TableGenBool tableGenBitsInitGetPacked(TableGenTypedInitRef ti, uint64_t *words,
+                                       uint64_t *known, size_t num_words);
 TableGenTypedInitRef tableGenBitsInitGetBitInit(TableGenTypedInitRef ti,
                                                 size_t index);
 TableGenBool tableGenIntInitGetValue(TableGenTypedInitRef ti, int64_t *integer);
 TableGenStringRef tableGenStringInitGetValue(TableGenTypedInitRef ti);
+/// Returns a copy of the string that must be freed with `tableGenStringFree`.
+/// Prefer `tableGenStringInitGetValue`, which borrows the string from the
+/// keeper.
 char *tableGenStringInitGetValueNewString(TableGenTypedInitRef ti);
 TableGenRecordRef tableGenDefInitGetValue(TableGenTypedInitRef ti);
 void tableGenInitPrint(TableGenTypedInitRef ti,
                          TableGenStringCallback callback, void *userData);
+void tableGenInitPrintBuffered(TableGenTypedInitRef ti,
+                               TableGenStringCallback callback, void *userData,
+                               size_t bufferSize);
+TableGenBool tableGenInitPrintToBuffer(TableGenTypedInitRef ti,
+                                       TableGenBuffer *buffer,
+                                       TableGenBufferReserveCallback reserve,
+                                       void *userData);
 void tableGenInitDump(TableGenTypedInitRef ti);
 TableGenBool tableGenPrintError(TableGenParserRef ref, TableGenSourceLocationRef loc_ref, TableGenDiagKind dk,
                         TableGenStringRef message,
                         TableGenStringCallback callback, void *userData);
+/// Same as `tableGenPrintError`, with a location span.
+TableGenBool tableGenPrintErrorSpan(TableGenParserRef ref,
+                                    TableGenSourceLocationSpan loc,
+                                    TableGenDiagKind dk,
+                                    TableGenStringRef message,
+                                    TableGenStringCallback callback,
+                                    void *userData);
+/// Resolves `len` locations to their buffer, line and column in a single
+/// pass over the buffers of the parser.
+void tableGenResolveLocations(TableGenParserRef ref, const TableGenSMLoc *locs,
+                              size_t len, TableGenLineColumn *resolved);
+TableGenSourceLocationSpan
+tableGenSourceLocationGetSpan(TableGenSourceLocationRef loc_ref);
 TableGenSourceLocationRef tableGenSourceLocationNull();
 TableGenSourceLocationRef tableGenSourceLocationClone(TableGenSourceLocationRef loc_ref);
 
+// Diagnostics
+/// Creates an empty batch of diagnostics for the sources of `ref`, which must
+/// outlive the batch. Printing many diagnostics through a batch is much
+/// faster than calling `tableGenPrintErrorSpan` for each of them.
+TableGenDiagnosticsRef tableGenDiagnosticsCreate(TableGenParserRef ref);
+/// Adds a diagnostic at the first location of `loc`. The remaining locations
+/// are printed as "initiated from multiclass" notes, like
+/// `tableGenPrintErrorSpan` does.
+void tableGenDiagnosticsAdd(TableGenDiagnosticsRef diag_ref,
+                            TableGenSourceLocationSpan loc,
+                            TableGenDiagKind dk, TableGenStringRef message);
+size_t tableGenDiagnosticsGetNumDiagnostics(TableGenDiagnosticsRef diag_ref);
+/// Prints all diagnostics sorted by buffer and offset and clears the batch.
+/// Identical diagnostics are printed once, and notes shared by consecutive
+/// diagnostics are only printed after the last of them. Output is passed to
+/// `callback` in chunks of up to `bufferSize` bytes. Returns the number of
+/// diagnostics printed.
+size_t tableGenDiagnosticsFlush(TableGenDiagnosticsRef diag_ref,
+                                TableGenStringCallback callback,
+                                void *userData, size_t bufferSize);
+/// Same as `tableGenDiagnosticsFlush`, but appends the output to `buffer`.
+/// Returns false if the buffer could not be grown.
+TableGenBool tableGenDiagnosticsFlushToBuffer(
+    TableGenDiagnosticsRef diag_ref, TableGenBuffer *buffer,
+    TableGenBufferReserveCallback reserve, void *userData);
+void tableGenDiagnosticsFree(TableGenDiagnosticsRef diag_ref);
+
+// Snapshot
+TableGenBool tableGenRecordKeeperSaveSnapshot(TableGenParserRef tg_ref,
+                                              TableGenRecordKeeperRef rk_ref,
+                                              TableGenStringRef path);
+/// Returns null if there is no snapshot at the given path, if it is invalid
+/// or if any of the source buffers or include paths changed since it was
+/// saved.
+TableGenSnapshotRef tableGenLoadSnapshot(TableGenParserRef tg_ref,
+                                         TableGenStringRef path);
+/// Writes all classes and defs in the snapshot format to `buffer`. The
+/// result can be loaded with `tableGenSnapshotFromBuffer`, or read directly
+/// by anything that understands the layout described above.
+TableGenBool tableGenRecordKeeperExport(TableGenParserRef tg_ref,
+                                        TableGenRecordKeeperRef rk_ref,
+                                        TableGenBuffer *buffer,
+                                        TableGenBufferReserveCallback reserve,
+                                        void *userData);
+/// Same as `tableGenRecordKeeperExport`, but streams the output to
+/// `callback` in chunks.
+void tableGenRecordKeeperExportStream(TableGenParserRef tg_ref,
+                                      TableGenRecordKeeperRef rk_ref,
+                                      TableGenStringCallback callback,
+                                      void *userData);
+/// Loads a snapshot from memory, copying it once. Returns null if it is not
+/// a valid snapshot. Unlike `tableGenLoadSnapshot`, this does not check
+/// whether the sources changed.
+TableGenSnapshotRef tableGenSnapshotFromBuffer(TableGenStringRef data);
+const TableGenSnapshotHeader *
+tableGenSnapshotGetHeader(TableGenSnapshotRef snapshot_ref);
+void tableGenSnapshotFree(TableGenSnapshotRef snapshot_ref);
+
+// JSON
+//
+// Records are written in the format of `llvm-tblgen --dump-json`, without
+// whitespace. If `num_classes` is not 0, only defs that derive from all of
+// the given classes are written, and `!instanceof` only lists those and the
+// classes they derive from. Otherwise `!instanceof` lists every class, with
+// an empty array for classes without defs. If `num_fields` is not 0, only
+// the given fields of each def are written.
+// Unknown ids have id 0, which matches nothing.
+
+/// Streams the defs of `rk_ref` as JSON to `callback` in chunks. Defs are
+/// encoded in batches on up to `num_threads` threads, or one per hardware
+/// thread if it is 0, and written in the order of their names, so the memory
+/// used does not grow with the size of the output. `callback` is only
+/// called from the calling thread.
+void tableGenRecordKeeperEmitJson(TableGenParserRef tg_ref,
+                                  TableGenRecordKeeperRef rk_ref,
+                                  const TableGenClassId *classes,
+                                  size_t num_classes,
+                                  const TableGenFieldId *fields,
+                                  size_t num_fields,
+                                  TableGenStringCallback callback,
+                                  void *userData, size_t num_threads);
+
+// Statistics
+//
+// Counters and trace events are process-wide and disabled by default. While
+// counters are enabled, every entry point counts its calls and the
+// allocations it makes; while tracing is enabled, parsing, reading sources,
+// building indices and other expensive operations are recorded as trace
+// events.
+void tableGenStatsSetEnabled(TableGenBool counters, TableGenBool trace);
+/// Fills `stats` with the statistics of `tg_ref` and the process-wide
+/// allocation counts. If `tg_ref` is null, only the latter are set.
+void tableGenStatsGet(TableGenParserRef tg_ref, TableGenStats *stats);
+/// Calls `callback` with the name and call count of every entry point called
+/// at least once while counters were enabled.
+void tableGenStatsGetCallCounts(TableGenCallCountCallback callback,
+                                void *userData);
+/// Writes all trace events in the Chrome trace event format, which can be
+/// loaded in `chrome://tracing` or Perfetto. At most about a million events
+/// are kept until the next reset; the number of events dropped after that is
+/// written as `droppedEvents` in `otherData`.
+void tableGenStatsWriteTrace(TableGenStringCallback callback, void *userData);
+/// Clears all call and allocation counts and trace events.
+void tableGenStatsReset();
+
+// Memory usage
+
+/// Fills `usage` with an estimate of the memory held by `rk_ref` and, if
+/// `tg_ref` is not null, by the source buffers of its parser. May be called
+/// while other threads query the keeper; indices they are still building
+/// are left out.
+void tableGenRecordKeeperMemoryUsage(TableGenParserRef tg_ref,
+                                     TableGenRecordKeeperRef rk_ref,
+                                     TableGenMemoryUsage *usage);
+/// Frees the memory selected by `flags`, a combination of
+/// `TableGenCompactFlags`. `tg_ref` is only used for
+/// `TableGenCompactSources` and may otherwise be null. Sources must not be
+/// dropped while a lazy keeper of the parser exists, nor while other
+/// threads use the parser.
+void tableGenRecordKeeperCompact(TableGenParserRef tg_ref,
+                                 TableGenRecordKeeperRef rk_ref,
+                                 uint32_t flags);
+
 // Memory
 void tableGenSourceLocationFree(TableGenSourceLocationRef loc_ref);
 void tableGenBitArrayFree(int8_t bit_array[]);
 void tableGenStringFree(const char *str);
 void tableGenStringArrayFree(const char **str_array);
+void tableGenInitNodeArrayFree(TableGenInitNode *nodes);
 
 #ifdef __cplusplus
 }
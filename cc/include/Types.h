@@ -35,6 +35,16 @@ typedef struct TableGenDagPair *TableGenDagPairRef;
 
 typedef struct TableGenSourceLocation *TableGenSourceLocationRef;
 
+typedef struct TableGenSnapshot *TableGenSnapshotRef;
+
+typedef struct TableGenRecordDiff *TableGenRecordDiffRef;
+
+typedef struct TableGenDiagnostics *TableGenDiagnosticsRef;
+
+typedef struct TableGenLazyRecordKeeper *TableGenLazyRecordKeeperRef;
+
+typedef struct TableGenPredicate *TableGenPredicateRef;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,184 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/xxhash.h>
+
+using ctablegen::Stats;
+
+namespace {
+
+/// Collects the words and strings describing a single record, init or type
+/// in a contiguous buffer, which is then hashed in one pass.
+class HashBuilder {
+public:
+  void add(uint64_t word) {
+    auto *bytes = reinterpret_cast<const uint8_t *>(&word);
+    buffer.append(bytes, bytes + sizeof(word));
+  }
+
+  void add(StringRef string) {
+    add(string.size());
+    buffer.append(string.bytes_begin(), string.bytes_end());
+  }
+
+  uint64_t finish() const {
+#if LLVM_VERSION_MAJOR >= 17
+    return xxh3_64bits(buffer);
+#else
+    return xxHash64(buffer);
+#endif
+  }
+
+private:
+  SmallVector<uint8_t, 128> buffer;
+};
+
+} // namespace
+
+uint64_t ctablegen::RecordHasher::hashType(const RecTy *type) {
+  auto known = typeHashes.find(type);
+  if (known != typeHashes.end())
+    return known->second;
+  HashBuilder hash;
+  hash.add(type->getAsString());
+  return typeHashes[type] = hash.finish();
+}
+
+uint64_t ctablegen::RecordHasher::hashInit(const Init *init) {
+  auto known = initHashes.find(init);
+  if (known != initHashes.end())
+    return known->second;
+
+  HashBuilder hash;
+  hash.add(init->getKind());
+  if (auto *bit = dyn_cast<BitInit>(init)) {
+    hash.add(bit->getValue());
+  } else if (auto *bits = dyn_cast<BitsInit>(init)) {
+    for (unsigned i = 0, e = bits->getNumBits(); i < e; i++)
+      hash.add(hashInit(bits->getBit(i)));
+  } else if (auto *integer = dyn_cast<IntInit>(init)) {
+    hash.add(integer->getValue());
+  } else if (auto *str = dyn_cast<StringInit>(init)) {
+    hash.add(str->hasCodeFormat());
+    hash.add(str->getValue());
+  } else if (auto *list = dyn_cast<ListInit>(init)) {
+    hash.add(hashType(list->getElementType()));
+    for (size_t i = 0, e = list->size(); i < e; i++)
+      hash.add(hashInit(list->getElement(i)));
+  } else if (auto *dag = dyn_cast<DagInit>(init)) {
+    hash.add(hashInit(dag->getOperator()));
+    hash.add(dag->getNameStr());
+    for (unsigned i = 0, e = dag->getNumArgs(); i < e; i++) {
+      hash.add(hashInit(dag->getArg(i)));
+      hash.add(dag->getArgNameStr(i));
+    }
+  } else if (auto *def = dyn_cast<DefInit>(init)) {
+    // Named records are referred to by name, their contents are covered by
+    // their own hash. Anonymous records are hashed by contents, so hashes do
+    // not change when they are renumbered.
+    if (def->getDef()->isAnonymous())
+      hash.add(hashRecord(def->getDef()));
+    else
+      hash.add(def->getDef()->getName());
+  } else if (!isa<UnsetInit>(init)) {
+    hash.add(init->getAsString());
+  }
+  return initHashes[init] = hash.finish();
+}
+
+uint64_t ctablegen::RecordHasher::hashHeader(const Record *record) {
+  HashBuilder hash;
+  hash.add(record->isClass());
+  if (!record->isAnonymous())
+    hash.add(record->getName());
+  for (const Init *arg : record->getTemplateArgs())
+    hash.add(hashInit(arg));
+  for (const auto &superClass : record->getSuperClasses())
+    hash.add(superClass.first->getName());
+  return hash.finish();
+}
+
+uint64_t ctablegen::RecordHasher::hashField(const RecordVal &value) {
+  HashBuilder hash;
+  hash.add(value.getName());
+  hash.add(hashType(value.getType()));
+  hash.add(value.isNonconcreteOK());
+  hash.add(hashInit(value.getValue()));
+  return hash.finish();
+}
+
+uint64_t ctablegen::RecordHasher::hashRecord(const Record *record) {
+  auto known = recordHashes.find(record);
+  if (known != recordHashes.end())
+    return known->second;
+
+  HashBuilder hash;
+  if (is_contained(hashingRecords, record)) {
+    // An anonymous record that refers to itself.
+    hash.add(record->getName());
+    return hash.finish();
+  }
+  hashingRecords.push_back(record);
+  hash.add(hashHeader(record));
+  for (const RecordVal &value : record->getValues())
+    hash.add(hashField(value));
+  hashingRecords.pop_back();
+  return recordHashes[record] = hash.finish();
+}
+
+size_t ctablegen::RecordHasher::getMemorySize() const {
+  return recordHashes.getMemorySize() + initHashes.getMemorySize() +
+         typeHashes.getMemorySize();
+}
+
+uint64_t ctablegen::TableGenRecordKeeper::getHash(const Record *record) {
+  std::lock_guard<std::mutex> guard(hashMutex);
+  return hasher.hashRecord(record);
+}
+
+uint64_t ctablegen::TableGenRecordKeeper::getHash() {
+  std::lock_guard<std::mutex> guard(hashMutex);
+  if (keeperHash)
+    return *keeperHash;
+
+  Stats::TraceScope scope("hashRecordKeeper");
+  HashBuilder hash;
+  hash.add(getClasses().size());
+  for (const auto &cls : getClasses())
+    hash.add(hasher.hashRecord(cls.second.get()));
+  // Anonymous defs are combined independently of their order, which depends
+  // on their numbering.
+  uint64_t anonymousDefs = 0;
+  hash.add(getDefs().size());
+  for (const auto &def : getDefs()) {
+    if (def.second->isAnonymous())
+      anonymousDefs += hasher.hashRecord(def.second.get());
+    else
+      hash.add(hasher.hashRecord(def.second.get()));
+  }
+  hash.add(anonymousDefs);
+  keeperHash = hash.finish();
+  return *keeperHash;
+}
+
+uint64_t tableGenRecordHash(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
+  auto *record = unwrap(record_ref);
+  return ctablegen::TableGenRecordKeeper::of(*record).getHash(record);
+}
+
+uint64_t tableGenRecordKeeperHash(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getHash();
+}
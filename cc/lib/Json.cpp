@@ -0,0 +1,267 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Path.h>
+
+using ctablegen::RecordVector;
+using ctablegen::Stats;
+using ctablegen::TableGenParser;
+
+namespace {
+
+/// Number of records encoded per thread before the encoded records are
+/// written out, which bounds the memory used for their encodings.
+constexpr size_t recordsPerThread = 256;
+
+json::Value toJson(StringRef string) {
+  if (LLVM_LIKELY(json::isUTF8(string)))
+    return string;
+  return json::fixUTF8(string);
+}
+
+/// Writes records in the same format as `llvm-tblgen --dump-json`, one
+/// record at a time.
+class JsonEncoder {
+public:
+  JsonEncoder(TableGenParser &parser, ctablegen::TableGenRecordKeeper &keeper,
+              ArrayRef<unsigned> fieldIds)
+      : parser(parser), keeper(keeper), filterFields(!fieldIds.empty()) {
+    for (unsigned id : fieldIds)
+      if (id != 0)
+        fields.push_back({keeper.getFieldName(id), id});
+    llvm::sort(fields);
+    fields.erase(std::unique(fields.begin(), fields.end()), fields.end());
+  }
+
+  void encodeRecord(const Record *record, raw_ostream &os) const {
+    SmallVector<const RecordVal *, 32> values;
+    if (filterFields) {
+      for (const auto &field : fields)
+        if (const RecordVal *value = keeper.getValue(record, field.second))
+          values.push_back(value);
+    } else {
+      for (const RecordVal &value : record->getValues())
+        if (!record->isTemplateArg(value.getNameInit()))
+          values.push_back(&value);
+    }
+
+    json::OStream json(os);
+    json.object([&] {
+      json.attribute("!anonymous", record->isAnonymous());
+      json.attributeArray("!fields", [&] {
+        for (const RecordVal *value : values)
+          if (value->isNonconcreteOK())
+            json.value(toJson(value->getName()));
+      });
+      json.attributeArray("!locs", [&] {
+        std::lock_guard<std::mutex> guard(parser.sourceMgrMutex);
+        for (SMLoc loc : record->getLoc()) {
+          unsigned buffer = parser.sourceMgr.FindBufferContainingLoc(loc);
+          if (!buffer)
+            continue;
+          StringRef file = sys::path::filename(
+              parser.sourceMgr.getMemoryBuffer(buffer)->getBufferIdentifier());
+          json.value(toJson(
+              (file + ":" +
+               Twine(parser.sourceMgr.FindLineNumber(loc, buffer)))
+                  .str()));
+        }
+      });
+      json.attribute("!name", toJson(record->getName()));
+      json.attributeArray("!superclasses", [&] {
+        for (const auto &superClass : record->getSuperClasses())
+          json.value(toJson(superClass.first->getName()));
+      });
+
+      // Attributes are ordered by name, as in LLVM's JSON backend.
+      if (!filterFields)
+        llvm::sort(values, [](const RecordVal *a, const RecordVal *b) {
+          return a->getName() < b->getName();
+        });
+      for (const RecordVal *value : values) {
+        json.attributeBegin(value->getName());
+        encodeInit(value->getValue(), json);
+        json.attributeEnd();
+      }
+    });
+  }
+
+private:
+  void encodeInit(const Init *init, json::OStream &json) const {
+    if (isa<UnsetInit>(init))
+      return json.value(nullptr);
+    if (auto *bit = dyn_cast<BitInit>(init))
+      return json.value(bit->getValue() ? 1 : 0);
+    if (auto *bits = dyn_cast<BitsInit>(init))
+      return json.array([&] {
+        for (unsigned i = 0, e = bits->getNumBits(); i < e; i++)
+          encodeInit(bits->getBit(i), json);
+      });
+    if (auto *integer = dyn_cast<IntInit>(init))
+      return json.value(integer->getValue());
+    if (auto *string = dyn_cast<StringInit>(init))
+      return json.value(toJson(string->getValue()));
+    if (auto *list = dyn_cast<ListInit>(init))
+      return json.array([&] {
+        for (const Init *element : list->getValues())
+          encodeInit(element, json);
+      });
+
+    // Everything else is an object with a kind and the printed init. Its
+    // attributes are ordered by name, as in LLVM's JSON backend.
+    auto printable = [&] {
+      json.attribute("printable", toJson(init->getAsString()));
+    };
+    json.object([&] {
+      if (auto *def = dyn_cast<DefInit>(init)) {
+        json.attribute("def", toJson(def->getDef()->getName()));
+        json.attribute("kind", "def");
+        printable();
+      } else if (auto *var = dyn_cast<VarInit>(init)) {
+        json.attribute("kind", "var");
+        printable();
+        json.attribute("var", toJson(var->getName()));
+      } else if (auto *varBit = dyn_cast<VarBitInit>(init);
+                 varBit && isa<VarInit>(varBit->getBitVar())) {
+        json.attribute("index", varBit->getBitNum());
+        json.attribute("kind", "varbit");
+        printable();
+        json.attribute("var",
+                       toJson(cast<VarInit>(varBit->getBitVar())->getName()));
+      } else if (auto *dag = dyn_cast<DagInit>(init)) {
+        json.attributeArray("args", [&] {
+          for (unsigned i = 0, e = dag->getNumArgs(); i < e; i++)
+            json.array([&] {
+              encodeInit(dag->getArg(i), json);
+              if (const StringInit *name = dag->getArgName(i))
+                json.value(toJson(name->getValue()));
+              else
+                json.value(nullptr);
+            });
+        });
+        json.attribute("kind", "dag");
+        if (const StringInit *name = dag->getName())
+          json.attribute("name", toJson(name->getValue()));
+        json.attributeBegin("operator");
+        encodeInit(dag->getOperator(), json);
+        json.attributeEnd();
+        printable();
+      } else {
+        json.attribute("kind", "complex");
+        printable();
+      }
+    });
+  }
+
+  TableGenParser &parser;
+  ctablegen::TableGenRecordKeeper &keeper;
+  /// The fields to encode by name, if `filterFields` is set.
+  std::vector<std::pair<StringRef, unsigned>> fields;
+  bool filterFields;
+};
+
+} // namespace
+
+void tableGenRecordKeeperEmitJson(TableGenParserRef tg_ref,
+                                  TableGenRecordKeeperRef rk_ref,
+                                  const TableGenClassId *classes,
+                                  size_t num_classes,
+                                  const TableGenFieldId *fields,
+                                  size_t num_fields,
+                                  TableGenStringCallback callback,
+                                  void *userData, size_t num_threads) {
+  TABLEGEN_COUNT_CALL();
+  Stats::TraceScope scope("emitJson");
+  auto &keeper = *unwrap(rk_ref);
+  JsonEncoder encoder(*unwrap(tg_ref), keeper,
+                      ArrayRef<unsigned>(fields, num_fields));
+
+  // Without class filter, the defs are taken from `getDefs()` in batches
+  // instead of being collected up front.
+  RecordVector defs;
+  llvm::DenseSet<const Record *> selected;
+  bool filterClasses = num_classes != 0;
+  if (filterClasses) {
+    SmallVector<const Record *, 4> bases;
+    for (size_t i = 0; i < num_classes; i++)
+      bases.push_back(keeper.getClassById(classes[i]));
+    if (!llvm::is_contained(bases, nullptr))
+      defs = keeper.getDerivedDefinitions(bases);
+    selected.insert(defs.begin(), defs.end());
+  }
+
+  ctablegen::CallbackOstream os(callback, userData, /*bufferSize=*/1 << 16);
+  json::OStream json(os);
+  json.objectBegin();
+
+  json.attributeObject("!instanceof", [&] {
+    for (const auto &cls : keeper.getClasses()) {
+      ArrayRef<Record *> instances =
+          keeper.getDerivedDefinitions(cls.second.get());
+      auto isSelected = [&](const Record *def) {
+        return !filterClasses || selected.count(def);
+      };
+      // As in LLVM, classes without defs are listed with an empty array,
+      // unless defs are filtered by class.
+      if (filterClasses && llvm::none_of(instances, isSelected))
+        continue;
+      json.attributeArray(cls.first, [&] {
+        for (const Record *def : instances)
+          if (isSelected(def))
+            json.value(toJson(def->getName()));
+      });
+    }
+  });
+  json.attribute("!tablegen_json_version", 1);
+
+  // Records are encoded in parallel one batch at a time and then written
+  // in order, so at most one batch of encodings is kept in memory.
+  size_t numThreads = num_threads
+                          ? num_threads
+                          : std::max(1u, std::thread::hardware_concurrency());
+  size_t batchSize = numThreads * recordsPerThread;
+  std::vector<const Record *> batch;
+  std::vector<std::string> encoded;
+  batch.reserve(batchSize);
+  auto flush = [&] {
+    encoded.assign(batch.size(), std::string());
+    ctablegen::parallelFor(batch.size(), numThreads, [&](size_t i) {
+      raw_string_ostream recordOs(encoded[i]);
+      encoder.encodeRecord(batch[i], recordOs);
+    });
+    for (size_t i = 0; i < batch.size(); i++) {
+      json.attributeBegin(batch[i]->getName());
+      json.rawValue(encoded[i]);
+      json.attributeEnd();
+    }
+    batch.clear();
+  };
+  auto add = [&](const Record *def) {
+    batch.push_back(def);
+    if (batch.size() == batchSize)
+      flush();
+  };
+  if (filterClasses) {
+    for (const Record *def : defs)
+      add(def);
+  } else {
+    for (const auto &def : keeper.getDefs())
+      add(def.second.get());
+  }
+  flush();
+
+  json.objectEnd();
+  os << "\n";
+}
@@ -0,0 +1,686 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/Path.h"
+
+using ctablegen::LazyRecordKeeper;
+using ctablegen::Stats;
+
+namespace {
+
+/// Files nested deeper than this are left to TableGen, which reports the
+/// include cycle.
+constexpr unsigned maxIncludeDepth = 64;
+
+struct Token {
+  enum Kind {
+    Eof,
+    Identifier,
+    String,
+    Code,
+    Punctuation,
+    Bang,
+    Variable,
+    Directive
+  } kind;
+  StringRef text;
+
+  bool is(StringRef punctuation) const {
+    return kind == Punctuation && text == punctuation;
+  }
+  bool isKeyword(StringRef keyword) const {
+    return kind == Identifier && text == keyword;
+  }
+};
+
+/// A lexer recognizing just enough of TableGen to split it into statements.
+class Lexer {
+public:
+  explicit Lexer(StringRef buffer) : buffer(buffer) {}
+
+  Token next();
+  Token peek(unsigned ahead = 0) const {
+    Lexer copy = *this;
+    copy.identifiers = nullptr;
+    for (unsigned i = 0; i < ahead; i++)
+      copy.next();
+    return copy.next();
+  }
+
+  /// If set, every identifier is appended to it.
+  std::vector<StringRef> *identifiers = nullptr;
+
+private:
+  static bool isIdentifierChar(char c) { return isAlnum(c) || c == '_'; }
+  bool lookingAt(StringRef text) const {
+    return buffer.substr(pos, text.size()) == text;
+  }
+  bool atLineStart(size_t pos) const;
+  void skipSpace();
+
+  StringRef buffer;
+  size_t pos = 0;
+};
+
+bool Lexer::atLineStart(size_t pos) const {
+  while (pos > 0 && (buffer[pos - 1] == ' ' || buffer[pos - 1] == '\t'))
+    pos--;
+  return pos == 0 || buffer[pos - 1] == '\n' || buffer[pos - 1] == '\r';
+}
+
+void Lexer::skipSpace() {
+  while (pos < buffer.size()) {
+    if (isSpace(buffer[pos])) {
+      pos++;
+    } else if (lookingAt("//")) {
+      pos = std::min(buffer.find('\n', pos), buffer.size());
+    } else if (lookingAt("/*")) {
+      // Block comments nest in TableGen.
+      unsigned depth = 0;
+      do {
+        if (lookingAt("/*")) {
+          depth++;
+          pos += 2;
+        } else if (lookingAt("*/")) {
+          depth--;
+          pos += 2;
+        } else {
+          pos++;
+        }
+      } while (depth > 0 && pos < buffer.size());
+    } else {
+      return;
+    }
+  }
+}
+
+Token Lexer::next() {
+  skipSpace();
+  size_t start = pos;
+  auto token = [&](Token::Kind kind) {
+    pos = std::min(pos, buffer.size());
+    return Token{kind, buffer.slice(start, pos)};
+  };
+  if (pos >= buffer.size())
+    return token(Token::Eof);
+
+  char c = buffer[pos];
+  if (isIdentifierChar(c)) {
+    while (pos < buffer.size() && isIdentifierChar(buffer[pos]))
+      pos++;
+    Token result = token(Token::Identifier);
+    if (identifiers)
+      identifiers->push_back(result.text);
+    return result;
+  }
+  if (c == '"') {
+    pos++;
+    while (pos < buffer.size() && buffer[pos] != '"' && buffer[pos] != '\n')
+      pos += buffer[pos] == '\\' ? 2 : 1;
+    pos++;
+    return token(Token::String);
+  }
+  if (lookingAt("[{")) {
+    size_t end = buffer.find("}]", pos + 2);
+    pos = end == StringRef::npos ? buffer.size() : end + 2;
+    return token(Token::Code);
+  }
+  if (c == '!' || c == '$') {
+    pos++;
+    while (pos < buffer.size() && isIdentifierChar(buffer[pos]))
+      pos++;
+    return token(c == '!' ? Token::Bang : Token::Variable);
+  }
+  if (c == '#' && atLineStart(pos)) {
+    StringRef directive = buffer.substr(pos + 1);
+    for (StringRef name : {"define", "ifdef", "ifndef", "else", "endif"}) {
+      if (directive.substr(0, name.size()) == name &&
+          (directive.size() == name.size() ||
+           !isIdentifierChar(directive[name.size()]))) {
+        pos = std::min(buffer.find('\n', pos), buffer.size());
+        return token(Token::Directive);
+      }
+    }
+  }
+  pos++;
+  return token(Token::Punctuation);
+}
+
+StringRef range(Token first, Token last) {
+  return StringRef(first.text.begin(), last.text.end() - first.text.begin());
+}
+
+/// Updates the nesting depth of brackets for the given token.
+void nest(Token token, int &depth) {
+  if (token.kind != Token::Punctuation)
+    return;
+  if (token.is("(") || token.is("[") || token.is("{") || token.is("<"))
+    depth++;
+  else if (token.is(")") || token.is("]") || token.is("}") || token.is(">"))
+    depth--;
+}
+
+/// Returns true if all `!cast`s and `!exists` in the text have a literal
+/// string operand, and adds those strings to `identifiers`. Lookups of
+/// `NAME` refer to the record being defined, and are allowed as well.
+bool collectLookupNames(StringRef text, std::vector<StringRef> &identifiers) {
+  Lexer lexer(text);
+  for (Token token = lexer.next(); token.kind != Token::Eof;
+       token = lexer.next()) {
+    if (token.kind != Token::Bang ||
+        (token.text != "!cast" && token.text != "!exists"))
+      continue;
+    int depth = 0;
+    Token next = lexer.next();
+    if (next.is("<")) {
+      for (nest(next, depth); depth > 0 && next.kind != Token::Eof;
+           nest(next, depth))
+        next = lexer.next();
+      next = lexer.next();
+    }
+    Token name = lexer.next();
+    if (!next.is("(") || !lexer.peek().is(")"))
+      return false;
+    if (name.kind == Token::String)
+      identifiers.push_back(name.text.drop_front().drop_back());
+    else if (!name.isKeyword("NAME"))
+      return false;
+  }
+  return true;
+}
+
+/// Returns true if the text refers to `NAME`, which a multiclass may use to
+/// define records whose names do not start with the name of the `defm`.
+bool mentionsName(StringRef text) {
+  Lexer lexer(text);
+  for (Token token = lexer.next(); token.kind != Token::Eof;
+       token = lexer.next()) {
+    if (token.isKeyword("NAME"))
+      return true;
+  }
+  return false;
+}
+
+} // namespace
+
+namespace ctablegen {
+
+/// Splits sources into the statements of a `LazyRecordKeeper`.
+class LazyScanner {
+public:
+  explicit LazyScanner(LazyRecordKeeper &keeper) : keeper(keeper) {}
+
+  void scanBuffer(StringRef buffer, int32_t parent, unsigned depth);
+
+private:
+  void scanList(Lexer &lexer, int32_t parent, bool untilBrace,
+                unsigned depth);
+  void scanStatement(Lexer &lexer, Token first, size_t mark, int32_t parent,
+                     unsigned depth);
+  Token skipUntil(Lexer &lexer, StringRef keyword);
+  Token skipBody(Lexer &lexer);
+  Token skipObject(Lexer &lexer, Token first);
+  unsigned add(LazyRecordKeeper::StatementKind kind, StringRef text,
+               int32_t parent, size_t mark);
+  const MemoryBuffer *openInclude(StringRef path);
+
+  LazyRecordKeeper &keeper;
+};
+
+void LazyScanner::scanBuffer(StringRef buffer, int32_t parent,
+                             unsigned depth) {
+  Lexer lexer(buffer);
+  lexer.identifiers = &keeper.identifiers;
+  scanList(lexer, parent, /*untilBrace=*/false, depth);
+}
+
+void LazyScanner::scanList(Lexer &lexer, int32_t parent, bool untilBrace,
+                           unsigned depth) {
+  for (;;) {
+    size_t mark = keeper.identifiers.size();
+    Token token = lexer.next();
+    if (token.kind == Token::Eof)
+      return;
+    if (untilBrace && token.is("}"))
+      return;
+    scanStatement(lexer, token, mark, parent, depth);
+  }
+}
+
+void LazyScanner::scanStatement(Lexer &lexer, Token first, size_t mark,
+                                int32_t parent, unsigned depth) {
+  if (first.kind == Token::Directive) {
+    add(LazyRecordKeeper::DirectiveStatement, first.text, parent, mark);
+    return;
+  }
+
+  if (first.isKeyword("include")) {
+    Token path = lexer.next();
+    keeper.identifiers.resize(mark);
+    if (path.kind == Token::String && depth < maxIncludeDepth) {
+      if (auto *buffer = openInclude(path.text.drop_front().drop_back())) {
+        scanBuffer(buffer->getBuffer(), parent, depth + 1);
+        return;
+      }
+    }
+    keeper.unindexedRecords = true;
+    add(LazyRecordKeeper::AlwaysStatement, range(first, path), parent, mark);
+    return;
+  }
+
+  // A `let` without braces applies to a single statement, which is
+  // equivalent to a block containing only that statement.
+  if (first.isKeyword("let")) {
+    Token in = skipUntil(lexer, "in");
+    unsigned let = add(LazyRecordKeeper::LetBeginStatement, range(first, in),
+                       parent, mark);
+    size_t bodyMark = keeper.identifiers.size();
+    Token body = lexer.next();
+    if (body.is("{"))
+      scanList(lexer, let, /*untilBrace=*/true, depth);
+    else if (body.kind != Token::Eof)
+      scanStatement(lexer, body, bodyMark, let, depth);
+    add(LazyRecordKeeper::LetEndStatement, "}", let,
+        keeper.identifiers.size());
+    return;
+  }
+
+  auto kind = LazyRecordKeeper::AlwaysStatement;
+  bool parseAll = false;
+  StringRef name;
+  Token second = lexer.peek();
+  if (first.isKeyword("class") || first.isKeyword("multiclass")) {
+    if (second.kind == Token::Identifier) {
+      kind = LazyRecordKeeper::ClassStatement;
+      name = second.text;
+    }
+  } else if (first.isKeyword("def") || first.isKeyword("defm")) {
+    if (second.kind == Token::Identifier && !lexer.peek(1).is("#")) {
+      kind = first.isKeyword("def") ? LazyRecordKeeper::DefStatement
+                                    : LazyRecordKeeper::DefmStatement;
+      name = second.text;
+    }
+    // Anonymous records cannot be looked up, but are kept in every slice so
+    // that the asserts of their classes are checked.
+  } else if (first.isKeyword("defvar") || first.isKeyword("deftype")) {
+    if (second.kind == Token::Identifier) {
+      kind = LazyRecordKeeper::GlobalStatement;
+      name = second.text;
+    }
+  } else if (first.isKeyword("defset")) {
+    // The name follows the type of the list.
+    int depth = 0;
+    for (unsigned i = 0; i < 32; i++) {
+      Token token = lexer.peek(i);
+      if (token.kind == Token::Eof || (depth <= 0 && token.is("=")))
+        break;
+      nest(token, depth);
+      if (depth <= 0 && token.kind == Token::Identifier) {
+        kind = LazyRecordKeeper::GlobalStatement;
+        name = token.text;
+      }
+    }
+  } else if (first.isKeyword("dump")) {
+    // Every slice would print the message again.
+    parseAll = true;
+  }
+
+  Token last = skipObject(lexer, first);
+  unsigned index = add(kind, range(first, last), parent, mark);
+  keeper.statements[index].dynamic |= parseAll;
+  // Records defined by a `foreach`, an `if`, a `defset` or under a computed
+  // name are not in the index.
+  if (kind == LazyRecordKeeper::AlwaysStatement
+          ? first.isKeyword("def") || first.isKeyword("defm") ||
+                first.isKeyword("foreach") || first.isKeyword("if")
+          : first.isKeyword("defset") ||
+                (first.isKeyword("multiclass") &&
+                 mentionsName(keeper.statements[index].text)))
+    keeper.unindexedRecords = true;
+  if (kind == LazyRecordKeeper::DefmStatement)
+    keeper.defmStatements[name].push_back(index);
+  else if (!name.empty())
+    keeper.namedStatements[name].push_back(index);
+}
+
+Token LazyScanner::skipUntil(Lexer &lexer, StringRef keyword) {
+  int depth = 0;
+  Token token = lexer.next();
+  while (token.kind != Token::Eof && !(depth <= 0 && token.isKeyword(keyword))) {
+    nest(token, depth);
+    token = lexer.next();
+  }
+  return token;
+}
+
+Token LazyScanner::skipBody(Lexer &lexer) {
+  Token token = lexer.next();
+  if (!token.is("{"))
+    return skipObject(lexer, token);
+  int depth = 1;
+  while (depth > 0 && token.kind != Token::Eof) {
+    token = lexer.next();
+    if (token.is("{"))
+      depth++;
+    else if (token.is("}"))
+      depth--;
+  }
+  return token;
+}
+
+Token LazyScanner::skipObject(Lexer &lexer, Token first) {
+  if (first.kind == Token::Eof || first.kind == Token::Directive)
+    return first;
+  if (first.isKeyword("include"))
+    return lexer.next();
+  if (first.isKeyword("foreach") || first.isKeyword("let")) {
+    skipUntil(lexer, "in");
+    return skipBody(lexer);
+  }
+  if (first.isKeyword("if")) {
+    skipUntil(lexer, "then");
+    Token last = skipBody(lexer);
+    if (lexer.peek().isKeyword("else")) {
+      lexer.next();
+      last = skipBody(lexer);
+    }
+    return last;
+  }
+
+  // Everything else ends with a semicolon, and records may instead end with
+  // a body.
+  bool hasBody = first.isKeyword("def") || first.isKeyword("class") ||
+                 first.isKeyword("multiclass") || first.isKeyword("defset");
+  int depth = 0;
+  Token last = first;
+  for (;;) {
+    Token token = lexer.next();
+    if (token.kind == Token::Eof)
+      return last;
+    nest(token, depth);
+    if (depth <= 0 && (token.is(";") || (hasBody && token.is("}"))))
+      return token;
+    last = token;
+  }
+}
+
+unsigned LazyScanner::add(LazyRecordKeeper::StatementKind kind, StringRef text,
+                          int32_t parent, size_t mark) {
+  auto &identifiers = keeper.identifiers;
+  bool dynamic = false;
+  if (kind == LazyRecordKeeper::DirectiveStatement)
+    identifiers.resize(mark);
+  else
+    dynamic = !collectLookupNames(text, identifiers);
+  keeper.statements.push_back(LazyRecordKeeper::Statement{
+      kind, dynamic, parent, text, unsigned(mark),
+      unsigned(identifiers.size() - mark)});
+  return keeper.statements.size() - 1;
+}
+
+const MemoryBuffer *LazyScanner::openInclude(StringRef path) {
+  // Same lookup order as `SourceMgr::AddIncludeFile`.
+  auto FileOrErr = MemoryBuffer::getFile(path);
+  for (const auto &dir : keeper.parser.getIncludeDirs()) {
+    if (FileOrErr)
+      break;
+    SmallString<128> candidate(dir);
+    sys::path::append(candidate, path);
+    FileOrErr = MemoryBuffer::getFile(candidate);
+  }
+  if (!FileOrErr)
+    return nullptr;
+  keeper.files.push_back(std::move(*FileOrErr));
+  return keeper.files.back().get();
+}
+
+} // namespace ctablegen
+
+LazyRecordKeeper::LazyRecordKeeper(const TableGenParser &parser)
+    : parser(parser) {
+  Stats::TraceScope scope("lazyScan");
+  // Like `TableGenParseFile`, only the main buffer is parsed.
+  ctablegen::LazyScanner(*this).scanBuffer(
+      parser.sourceMgr.getMemoryBuffer(parser.sourceMgr.getMainFileID())
+          ->getBuffer(),
+      -1, 0);
+}
+
+bool LazyRecordKeeper::isIndexed(StringRef name, bool isClass) const {
+  auto it = namedStatements.find(name);
+  if (it != namedStatements.end()) {
+    for (unsigned index : it->second) {
+      if ((statements[index].kind == ClassStatement) == isClass)
+        return true;
+    }
+  }
+  if (isClass)
+    return false;
+  for (size_t len = 1; len <= name.size(); len++) {
+    if (defmStatements.count(name.take_front(len)))
+      return true;
+  }
+  return false;
+}
+
+std::string LazyRecordKeeper::buildSlice(ArrayRef<StringRef> names) const {
+  std::vector<uint8_t> kept(statements.size());
+  std::vector<StringRef> worklist(names.begin(), names.end());
+  bool dynamic = false;
+  auto keep = [&](unsigned index) {
+    for (int32_t i = index; i >= 0 && !kept[i]; i = statements[i].parent) {
+      kept[i] = true;
+      dynamic |= statements[i].dynamic;
+      auto first = identifiers.begin() + statements[i].firstIdentifier;
+      worklist.insert(worklist.end(), first,
+                      first + statements[i].numIdentifiers);
+    }
+  };
+
+  for (unsigned i = 0; i < statements.size(); i++) {
+    if (statements[i].kind == AlwaysStatement)
+      keep(i);
+  }
+
+  StringSet<> visited;
+  while (!worklist.empty() && !dynamic) {
+    StringRef name = worklist.back();
+    worklist.pop_back();
+    if (!visited.insert(name).second)
+      continue;
+    auto it = namedStatements.find(name);
+    if (it != namedStatements.end()) {
+      for (unsigned index : it->second)
+        keep(index);
+    }
+    // Records defined by a defm are usually prefixed with its name.
+    for (size_t len = 1; len <= name.size(); len++) {
+      auto defm = defmStatements.find(name.take_front(len));
+      if (defm != defmStatements.end()) {
+        for (unsigned index : defm->second)
+          keep(index);
+      }
+    }
+  }
+  if (dynamic)
+    return std::string();
+
+  std::string slice;
+  for (unsigned i = 0; i < statements.size(); i++) {
+    const auto &statement = statements[i];
+    if (statement.kind == DirectiveStatement) {
+      slice += statement.text;
+    } else if (statement.kind == LetEndStatement) {
+      if (!kept[statement.parent])
+        continue;
+      slice += '}';
+    } else if (kept[i]) {
+      slice += statement.text;
+      if (statement.kind == LetBeginStatement)
+        slice += " {";
+    } else {
+      continue;
+    }
+    slice += '\n';
+  }
+  return slice;
+}
+
+void LazyRecordKeeper::addRecords(std::unique_ptr<TableGenParser> slice,
+                                  TableGenRecordKeeper *keeper) {
+  // Records found in an earlier slice are kept, so that a name always
+  // refers to the same record.
+  for (const auto &cls : keeper->getClasses())
+    classes.try_emplace(cls.first, cls.second.get());
+  for (const auto &def : keeper->getDefs())
+    defs.try_emplace(def.first, def.second.get());
+  parsers.push_back(std::move(slice));
+  keepers.emplace_back(keeper);
+}
+
+bool LazyRecordKeeper::parseSlice(StringRef source) {
+  auto slice = std::make_unique<TableGenParser>();
+  slice->addSource(source);
+  for (const auto &dir : parser.getIncludeDirs())
+    slice->addIncludePath(dir);
+  // A slice that fails to parse falls back to parsing all sources, which
+  // reports the actual errors.
+  slice->sourceMgr.setDiagHandler([](const SMDiagnostic &, void *) {});
+
+  auto *keeper = slice->parse();
+  if (!keeper)
+    return false;
+  addRecords(std::move(slice), keeper);
+  return true;
+}
+
+bool LazyRecordKeeper::parseAll() {
+  if (complete)
+    return true;
+  if (failed)
+    return false;
+  std::unique_ptr<TableGenParser> all(parser.reload());
+  auto *keeper = all ? all->parse() : nullptr;
+  if (!keeper) {
+    failed = true;
+    return false;
+  }
+  addRecords(std::move(all), keeper);
+  complete = true;
+  return true;
+}
+
+bool LazyRecordKeeper::loadLocked(ArrayRef<StringRef> names) {
+  if (complete)
+    return true;
+  if (failed)
+    return false;
+  Stats::TraceScope scope("lazyLoad");
+  std::string slice = buildSlice(names);
+  if (!slice.empty() && parseSlice(slice))
+    return true;
+  return parseAll();
+}
+
+Record *LazyRecordKeeper::lookup(StringMap<Record *> &records, StringRef name,
+                                 bool isClass) {
+  std::lock_guard<std::mutex> guard(mutex);
+  if (auto *record = records.lookup(name))
+    return record;
+  if (complete || failed)
+    return nullptr;
+  if (isIndexed(name, isClass)) {
+    loadLocked(name);
+    if (auto *record = records.lookup(name))
+      return record;
+  } else if (!unindexedRecords) {
+    return nullptr;
+  }
+  // The record may still be defined under a computed name, for instance by
+  // a multiclass.
+  parseAll();
+  return records.lookup(name);
+}
+
+Record *LazyRecordKeeper::getDef(StringRef name) {
+  return lookup(defs, name, /*isClass=*/false);
+}
+
+Record *LazyRecordKeeper::getClass(StringRef name) {
+  return lookup(classes, name, /*isClass=*/true);
+}
+
+bool LazyRecordKeeper::load(ArrayRef<StringRef> names) {
+  std::lock_guard<std::mutex> guard(mutex);
+  return loadLocked(names);
+}
+
+size_t LazyRecordKeeper::getNumParses() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return keepers.size();
+}
+
+bool LazyRecordKeeper::isComplete() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return complete;
+}
+
+TableGenLazyRecordKeeperRef tableGenParseLazy(TableGenParserRef tg_ref) {
+  TABLEGEN_COUNT_CALL();
+  const auto &parser = *unwrap(tg_ref);
+  if (parser.sourceMgr.getNumBuffers() == 0 || parser.sourcesDropped())
+    return nullptr;
+  Stats::countAllocation(Stats::OtherAllocation);
+  return wrap(new LazyRecordKeeper(parser));
+}
+
+TableGenRecordRef
+tableGenLazyRecordKeeperGetDef(TableGenLazyRecordKeeperRef lk_ref,
+                               TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
+  return wrap(unwrap(lk_ref)->getDef(StringRef(name.data, name.len)));
+}
+
+TableGenRecordRef
+tableGenLazyRecordKeeperGetClass(TableGenLazyRecordKeeperRef lk_ref,
+                                 TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
+  return wrap(unwrap(lk_ref)->getClass(StringRef(name.data, name.len)));
+}
+
+TableGenBool tableGenLazyRecordKeeperLoad(TableGenLazyRecordKeeperRef lk_ref,
+                                          const TableGenStringRef *names,
+                                          size_t len) {
+  TABLEGEN_COUNT_CALL();
+  SmallVector<StringRef, 8> refs;
+  for (size_t i = 0; i < len; i++)
+    refs.emplace_back(names[i].data, names[i].len);
+  return unwrap(lk_ref)->load(refs);
+}
+
+size_t tableGenLazyRecordKeeperGetNumParses(TableGenLazyRecordKeeperRef lk_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(lk_ref)->getNumParses();
+}
+
+TableGenBool
+tableGenLazyRecordKeeperIsComplete(TableGenLazyRecordKeeperRef lk_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(lk_ref)->isComplete();
+}
+
+void tableGenLazyRecordKeeperFree(TableGenLazyRecordKeeperRef lk_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(lk_ref);
+}
@@ -0,0 +1,219 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+
+#include <llvm/ADT/DenseSet.h>
+
+using ctablegen::Stats;
+
+namespace {
+
+template <typename T> size_t vectorBytes(const std::vector<T> &vector) {
+  return vector.capacity() * sizeof(T);
+}
+
+size_t stringBytes(const std::string &string) {
+  // Short strings are stored inline.
+  return string.capacity() >= sizeof(std::string) ? string.capacity() + 1
+                                                  : 0;
+}
+
+/// Estimates the size of inits, counting every init once.
+class InitSizes {
+public:
+  void add(const Init *root) {
+    SmallVector<const Init *, 32> worklist{root};
+    while (!worklist.empty()) {
+      const Init *init = worklist.pop_back_val();
+      if (init && visited.insert(init).second)
+        total += addChildren(init, worklist);
+    }
+  }
+
+  uint64_t getTotal() const { return total; }
+
+private:
+  /// Pushes the inits referenced by `init` and returns its own size.
+  static size_t addChildren(const Init *init,
+                            SmallVectorImpl<const Init *> &worklist) {
+    if (auto *bits = dyn_cast<BitsInit>(init)) {
+      for (unsigned i = 0, e = bits->getNumBits(); i < e; i++)
+        worklist.push_back(bits->getBit(i));
+      return sizeof(BitsInit) + bits->getNumBits() * sizeof(Init *);
+    }
+    if (auto *string = dyn_cast<StringInit>(init))
+      // Strings are uniqued in a string map holding a copy of their value.
+      return sizeof(StringInit) + sizeof(StringMapEntryBase) +
+             string->getValue().size() + 1;
+    if (auto *list = dyn_cast<ListInit>(init)) {
+      worklist.append(list->begin(), list->end());
+      return sizeof(ListInit) + list->size() * sizeof(Init *);
+    }
+    if (auto *dag = dyn_cast<DagInit>(init)) {
+      worklist.push_back(dag->getOperator());
+      worklist.push_back(dag->getName());
+      for (unsigned i = 0, e = dag->getNumArgs(); i < e; i++) {
+        worklist.push_back(dag->getArg(i));
+        worklist.push_back(dag->getArgName(i));
+      }
+      return sizeof(DagInit) + dag->getNumArgs() * 2 * sizeof(Init *);
+    }
+    if (auto *op = dyn_cast<OpInit>(init)) {
+      for (unsigned i = 0, e = op->getNumOperands(); i < e; i++)
+        worklist.push_back(op->getOperand(i));
+      return sizeof(BinOpInit);
+    }
+    if (auto *cond = dyn_cast<CondOpInit>(init)) {
+      for (unsigned i = 0, e = cond->getNumConds(); i < e; i++) {
+        worklist.push_back(cond->getCond(i));
+        worklist.push_back(cond->getVal(i));
+      }
+      return sizeof(CondOpInit) + cond->getNumConds() * 2 * sizeof(Init *);
+    }
+    if (auto *var = dyn_cast<VarInit>(init)) {
+      worklist.push_back(var->getNameInit());
+      return sizeof(VarInit);
+    }
+    if (auto *varBit = dyn_cast<VarBitInit>(init)) {
+      worklist.push_back(varBit->getBitVar());
+      return sizeof(VarBitInit);
+    }
+    if (auto *field = dyn_cast<FieldInit>(init)) {
+      worklist.push_back(field->getRecord());
+      worklist.push_back(field->getFieldName());
+      return sizeof(FieldInit);
+    }
+    if (auto *varDef = dyn_cast<VarDefInit>(init)) {
+      for (unsigned i = 0, e = varDef->args_size(); i < e; i++)
+        worklist.push_back(varDef->getArg(i));
+      return sizeof(VarDefInit) + varDef->args_size() * sizeof(Init *);
+    }
+    if (isa<BitInit>(init))
+      return sizeof(BitInit);
+    if (isa<IntInit>(init))
+      return sizeof(IntInit);
+    if (isa<DefInit>(init))
+      return sizeof(DefInit);
+    if (isa<TypedInit>(init))
+      return sizeof(TypedInit);
+    return sizeof(Init);
+  }
+
+  DenseSet<const Init *> visited;
+  uint64_t total = 0;
+};
+
+size_t recordMapBytes(const ctablegen::RecordMap &records) {
+  // Every entry is a tree node with a color and three pointers.
+  size_t bytes = 0;
+  for (const auto &entry : records)
+    bytes += sizeof(entry) + 4 * sizeof(void *) + stringBytes(entry.first);
+  return bytes;
+}
+
+} // namespace
+
+void ctablegen::TableGenRecordKeeper::addMemoryUsage(
+    TableGenMemoryUsage &usage) {
+  Stats::TraceScope scope("memoryUsage");
+  InitSizes inits;
+  auto addRecord = [&](const Record &record) {
+    usage.records += sizeof(Record) +
+                     record.getSuperClasses().size() *
+                         sizeof(std::pair<Record *, SMRange>) +
+                     record.getLoc().size() * sizeof(SMLoc) +
+                     record.getTemplateArgs().size() * sizeof(Init *);
+    usage.values += record.getValues().size() * sizeof(RecordVal);
+    inits.add(record.getNameInit());
+    for (const Init *arg : record.getTemplateArgs())
+      inits.add(arg);
+    for (const RecordVal &value : record.getValues()) {
+      inits.add(value.getNameInit());
+      inits.add(value.getValue());
+    }
+  };
+  usage.records += recordMapBytes(getClasses()) + recordMapBytes(getDefs());
+  for (const auto &cls : getClasses())
+    addRecord(*cls.second);
+  for (const auto &def : getDefs())
+    addRecord(*def.second);
+  usage.inits += inits.getTotal();
+
+  // Indices being built by other threads are left out.
+  unsigned built = builtIndices.load(std::memory_order_acquire);
+  if (built & ClassIndex)
+    usage.indices += classIds.getMemorySize() + vectorBytes(superClassBits) +
+                     superClassOffsets.getMemorySize();
+  if (built & RecordIndex)
+    usage.indices += vectorBytes(recordTable) + vectorBytes(recordNames) +
+                     recordIds.getMemorySize();
+  if (built & DerivedDefsIndex)
+    usage.indices += vectorBytes(derivedDefRecords) +
+                     derivedDefRanges.getMemorySize() +
+                     defIndices.getMemorySize();
+  if (built & FieldIndex) {
+    usage.indices +=
+        fieldIds.getNumBuckets() * (sizeof(void *) + sizeof(unsigned));
+    for (const auto &entry : fieldIds)
+      usage.indices += sizeof(entry) + entry.getKey().size() + 1;
+    usage.indices += vectorBytes(fieldNames) + vectorBytes(fieldEntries) +
+                     fieldRanges.getMemorySize();
+  }
+  {
+    std::lock_guard<std::mutex> guard(resolveMutex);
+    usage.indices += resolvedInits.getMemorySize();
+  }
+  {
+    std::lock_guard<std::mutex> guard(hashMutex);
+    usage.indices += hasher.getMemorySize();
+  }
+}
+
+void ctablegen::TableGenRecordKeeper::dropCaches() {
+  {
+    std::lock_guard<std::mutex> guard(resolveMutex);
+    decltype(resolvedInits)().swap(resolvedInits);
+  }
+  std::lock_guard<std::mutex> guard(hashMutex);
+  hasher = RecordHasher();
+}
+
+void ctablegen::TableGenParser::addMemoryUsage(TableGenMemoryUsage &usage) {
+  std::lock_guard<std::mutex> guard(sourceMgrMutex);
+  for (unsigned i = 1; i <= sourceMgr.getNumBuffers(); i++) {
+    auto *buffer = sourceMgr.getMemoryBuffer(i);
+    if (buffer->getBufferKind() == MemoryBuffer::MemoryBuffer_MMap)
+      usage.mapped_sources += buffer->getBufferSize();
+    else
+      usage.sources += buffer->getBufferSize();
+  }
+}
+
+void tableGenRecordKeeperMemoryUsage(TableGenParserRef tg_ref,
+                                     TableGenRecordKeeperRef rk_ref,
+                                     TableGenMemoryUsage *usage) {
+  TABLEGEN_COUNT_CALL();
+  std::memset(usage, 0, sizeof(*usage));
+  unwrap(rk_ref)->addMemoryUsage(*usage);
+  if (tg_ref)
+    unwrap(tg_ref)->addMemoryUsage(*usage);
+}
+
+void tableGenRecordKeeperCompact(TableGenParserRef tg_ref,
+                                 TableGenRecordKeeperRef rk_ref,
+                                 uint32_t flags) {
+  TABLEGEN_COUNT_CALL();
+  if (flags & TableGenCompactCaches)
+    unwrap(rk_ref)->dropCaches();
+  if ((flags & TableGenCompactSources) && tg_ref)
+    unwrap(tg_ref)->dropSources();
+}
@@ -0,0 +1,254 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+
+using ctablegen::Predicate;
+using ctablegen::RecordVector;
+using ctablegen::Stats;
+
+namespace {
+
+template <typename T> bool compare(TableGenPredicateOp op, T lhs, T rhs) {
+  switch (op) {
+  case TableGenPredicateEq:
+    return lhs == rhs;
+  case TableGenPredicateNe:
+    return lhs != rhs;
+  case TableGenPredicateLt:
+    return lhs < rhs;
+  case TableGenPredicateLe:
+    return lhs <= rhs;
+  case TableGenPredicateGt:
+    return lhs > rhs;
+  case TableGenPredicateGe:
+    return lhs >= rhs;
+  }
+  return false;
+}
+
+bool getInteger(const Init *init, int64_t &result) {
+  if (auto *integer = dyn_cast<IntInit>(init)) {
+    result = integer->getValue();
+    return true;
+  }
+  if (auto *bit = dyn_cast<BitInit>(init)) {
+    result = bit->getValue();
+    return true;
+  }
+  auto *bits = dyn_cast<BitsInit>(init);
+  if (!bits || bits->getNumBits() > 64)
+    return false;
+  uint64_t value = 0;
+  for (unsigned i = 0, e = bits->getNumBits(); i < e; i++) {
+    auto *bit = dyn_cast<BitInit>(bits->getBit(i));
+    if (!bit)
+      return false;
+    value |= uint64_t(bit->getValue()) << i;
+  }
+  result = value;
+  return true;
+}
+
+} // namespace
+
+unsigned ctablegen::Predicate::add(Node node, ArrayRef<unsigned> operands) {
+  node.firstOperand = this->operands.size();
+  node.numOperands = operands.size();
+  this->operands.insert(this->operands.end(), operands.begin(), operands.end());
+  nodes.push_back(std::move(node));
+  return nodes.size() - 1;
+}
+
+const Init *ctablegen::Predicate::getFieldValue(const Record *record,
+                                                unsigned id) const {
+  const RecordVal *value = keeper.getValue(record, id);
+  if (!value)
+    return nullptr;
+  return TableGenRecordKeeper::of(*record).resolve(record, value->getValue());
+}
+
+bool ctablegen::Predicate::matches(unsigned index,
+                                   const Record *record) const {
+  if (index >= nodes.size())
+    return false;
+  const Node &node = nodes[index];
+  ArrayRef<unsigned> children =
+      ArrayRef<unsigned>(operands).slice(node.firstOperand, node.numOperands);
+  // Operands always precede their node, so evaluation terminates.
+  auto matchesChild = [&](unsigned child) {
+    return child < index && matches(child, record);
+  };
+
+  switch (node.kind) {
+  case SubclassOf:
+    return keeper.isSubClassOf(record, node.id);
+  case HasField:
+    return keeper.getValue(record, node.id) != nullptr;
+  case And:
+    return llvm::all_of(children, matchesChild);
+  case Or:
+    return llvm::any_of(children, matchesChild);
+  case Not:
+    return !llvm::all_of(children, matchesChild);
+  default:
+    break;
+  }
+
+  const Init *value = getFieldValue(record, node.id);
+  if (!value)
+    return false;
+  switch (node.kind) {
+  case CompareInt: {
+    int64_t integer;
+    return getInteger(value, integer) &&
+           compare(node.op, integer, node.integer);
+  }
+  case CompareString: {
+    auto *string = dyn_cast<StringInit>(value);
+    return string &&
+           compare(node.op, string->getValue().compare(node.string), 0);
+  }
+  case DefSubclassOf: {
+    auto *def = dyn_cast<DefInit>(value);
+    return def && keeper.isSubClassOf(def->getDef(), node.classId);
+  }
+  default:
+    return false;
+  }
+}
+
+RecordVector ctablegen::Predicate::filter(unsigned node,
+                                          ArrayRef<Record *> records,
+                                          size_t numThreads) const {
+  Stats::TraceScope scope("filterRecords");
+  std::vector<uint8_t> matched(records.size());
+  parallelFor(records.size(), numThreads,
+              [&](size_t i) { matched[i] = matches(node, records[i]); });
+  RecordVector result;
+  for (size_t i = 0; i < records.size(); i++)
+    if (matched[i])
+      result.push_back(records[i]);
+  return result;
+}
+
+TableGenPredicateRef tableGenPredicateCreate(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  Stats::countAllocation(Stats::OtherAllocation);
+  return wrap(new Predicate(*unwrap(rk_ref)));
+}
+
+void tableGenPredicateFree(TableGenPredicateRef pred_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(pred_ref);
+}
+
+TableGenPredicateNode tableGenPredicateSubclassOf(TableGenPredicateRef pred_ref,
+                                                  TableGenClassId id) {
+  TABLEGEN_COUNT_CALL();
+  Predicate::Node node(Predicate::SubclassOf);
+  node.id = id;
+  return unwrap(pred_ref)->add(std::move(node));
+}
+
+TableGenPredicateNode tableGenPredicateHasField(TableGenPredicateRef pred_ref,
+                                                TableGenFieldId id) {
+  TABLEGEN_COUNT_CALL();
+  Predicate::Node node(Predicate::HasField);
+  node.id = id;
+  return unwrap(pred_ref)->add(std::move(node));
+}
+
+TableGenPredicateNode tableGenPredicateCompareInt(TableGenPredicateRef pred_ref,
+                                                  TableGenFieldId id,
+                                                  TableGenPredicateOp op,
+                                                  int64_t value) {
+  TABLEGEN_COUNT_CALL();
+  Predicate::Node node(Predicate::CompareInt, op);
+  node.id = id;
+  node.integer = value;
+  return unwrap(pred_ref)->add(std::move(node));
+}
+
+TableGenPredicateNode
+tableGenPredicateCompareString(TableGenPredicateRef pred_ref,
+                               TableGenFieldId id, TableGenPredicateOp op,
+                               TableGenStringRef value) {
+  TABLEGEN_COUNT_CALL();
+  Predicate::Node node(Predicate::CompareString, op);
+  node.id = id;
+  node.string = std::string(value.data, value.len);
+  return unwrap(pred_ref)->add(std::move(node));
+}
+
+TableGenPredicateNode
+tableGenPredicateDefSubclassOf(TableGenPredicateRef pred_ref,
+                               TableGenFieldId id, TableGenClassId class_id) {
+  TABLEGEN_COUNT_CALL();
+  Predicate::Node node(Predicate::DefSubclassOf);
+  node.id = id;
+  node.classId = class_id;
+  return unwrap(pred_ref)->add(std::move(node));
+}
+
+TableGenPredicateNode tableGenPredicateAnd(TableGenPredicateRef pred_ref,
+                                           const TableGenPredicateNode *nodes,
+                                           size_t len) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(pred_ref)->add(Predicate::Node(Predicate::And),
+                               ArrayRef<unsigned>(nodes, len));
+}
+
+TableGenPredicateNode tableGenPredicateOr(TableGenPredicateRef pred_ref,
+                                          const TableGenPredicateNode *nodes,
+                                          size_t len) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(pred_ref)->add(Predicate::Node(Predicate::Or),
+                               ArrayRef<unsigned>(nodes, len));
+}
+
+TableGenPredicateNode tableGenPredicateNot(TableGenPredicateRef pred_ref,
+                                           TableGenPredicateNode node) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(pred_ref)->add(Predicate::Node(Predicate::Not), node);
+}
+
+TableGenBool tableGenPredicateMatches(TableGenPredicateRef pred_ref,
+                                      TableGenPredicateNode node,
+                                      TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(pred_ref)->matches(node, unwrap(record_ref));
+}
+
+TableGenRecordVectorRef
+tableGenPredicateFilter(TableGenPredicateRef pred_ref,
+                        TableGenPredicateNode node,
+                        const TableGenRecordRef *records, size_t len,
+                        size_t num_threads) {
+  TABLEGEN_COUNT_CALL();
+  auto *predicate = unwrap(pred_ref);
+  ArrayRef<Record *> array(reinterpret_cast<Record *const *>(records), len);
+  Stats::countAllocation(Stats::VectorAllocation);
+  return wrap(new RecordVector(predicate->filter(node, array, num_threads)));
+}
+
+TableGenRecordVectorRef
+tableGenPredicateFilterDefs(TableGenPredicateRef pred_ref,
+                            TableGenPredicateNode node, size_t num_threads) {
+  TABLEGEN_COUNT_CALL();
+  auto *predicate = unwrap(pred_ref);
+  RecordVector defs;
+  defs.reserve(predicate->getRecords().getDefs().size());
+  for (const auto &def : predicate->getRecords().getDefs())
+    defs.push_back(def.second.get());
+  Stats::countAllocation(Stats::VectorAllocation);
+  return wrap(new RecordVector(predicate->filter(node, defs, num_threads)));
+}
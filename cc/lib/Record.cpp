@@ -11,36 +11,67 @@
 #include "TableGen.hpp"
 #include "Types.h"
 
-using ctablegen::tableGenFromRecType;
-
 TableGenRecordKeeperRef tableGenRecordGetRecords(TableGenRecordRef record_ref) {
-  return wrap(&unwrap(record_ref)->getRecords());
+  TABLEGEN_COUNT_CALL();
+  return wrap(&ctablegen::TableGenRecordKeeper::of(*unwrap(record_ref)));
 }
 
 TableGenStringRef tableGenRecordGetName(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
   auto name = unwrap(record_ref)->getName();
   return TableGenStringRef{.data = name.data(), .len = name.size()};
 }
 
 TableGenRecordValRef tableGenRecordGetValue(TableGenRecordRef record_ref,
                                             TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
   return wrap(unwrap(record_ref)->getValue(StringRef(name.data, name.len)));
 }
 
 TableGenRecTyKind tableGenRecordGetFieldType(TableGenRecordRef record_ref,
                                              TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
   auto value = unwrap(record_ref)->getValue(StringRef(name.data, name.len));
   if (!value)
     return TableGenInvalidRecTyKind;
-  return tableGenFromRecType(value->getType());
+  return ctablegen::tableGenRecordValKind(*value);
+}
+
+TableGenRecordValRef tableGenRecordGetValueById(TableGenRecordRef record_ref,
+                                                TableGenFieldId id) {
+  TABLEGEN_COUNT_CALL();
+  auto *record = unwrap(record_ref);
+  return wrap(ctablegen::TableGenRecordKeeper::of(*record).getValue(record, id));
+}
+
+TableGenRecTyKind tableGenRecordGetFieldTypeById(TableGenRecordRef record_ref,
+                                                 TableGenFieldId id) {
+  TABLEGEN_COUNT_CALL();
+  auto *record = unwrap(record_ref);
+  auto *value = ctablegen::TableGenRecordKeeper::of(*record).getValue(record, id);
+  if (!value)
+    return TableGenInvalidRecTyKind;
+  return ctablegen::tableGenRecordValKind(*value);
+}
+
+TableGenTypedInitRef
+tableGenRecordGetResolvedValue(TableGenRecordRef record_ref,
+                               TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
+  auto *record = unwrap(record_ref);
+  auto *init = ctablegen::TableGenRecordKeeper::of(*record).resolve(
+      record, unwrap(rv_ref)->getValue());
+  return wrap(dyn_cast<TypedInit>(init));
 }
 
 TableGenRecordValRef tableGenRecordGetFirstValue(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(unwrap(record_ref)->getValues().begin());
 }
 
 TableGenRecordValRef tableGenRecordValNext(TableGenRecordRef record,
                                            TableGenRecordValRef current) {
+  TABLEGEN_COUNT_CALL();
   auto next = std::next(ArrayRef<RecordVal>::iterator(unwrap(current)));
   if (next == unwrap(record)->getValues().end()) {
     return nullptr;
@@ -49,24 +80,61 @@ TableGenRecordValRef tableGenRecordValNext(TableGenRecordRef record,
 }
 
 TableGenBool tableGenRecordIsAnonymous(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
   return unwrap(record_ref)->isAnonymous();
 }
 
 TableGenBool tableGenRecordIsSubclassOf(TableGenRecordRef record_ref,
                                         TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
   return unwrap(record_ref)->isSubClassOf(StringRef(name.data, name.len));
 }
 
+TableGenBool tableGenRecordIsSubclassOfId(TableGenRecordRef record_ref,
+                                          TableGenClassId id) {
+  TABLEGEN_COUNT_CALL();
+  auto record = unwrap(record_ref);
+  return ctablegen::TableGenRecordKeeper::of(*record).isSubClassOf(record, id);
+}
+
 TableGenSourceLocationRef tableGenRecordGetLoc(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::LocationAllocation);
   return wrap(new ArrayRef(unwrap(record_ref)->getLoc()));
 }
 
+TableGenSourceLocationSpan
+tableGenRecordGetLocSpan(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::toLocationSpan(unwrap(record_ref)->getLoc());
+}
+
 void tableGenRecordPrint(TableGenRecordRef record_ref,
                          TableGenStringCallback callback, void *userData) {
+  TABLEGEN_COUNT_CALL();
   ctablegen::CallbackOstream stream(callback, userData);
   stream << *unwrap(record_ref);
 }
 
+void tableGenRecordPrintBuffered(TableGenRecordRef record_ref,
+                                 TableGenStringCallback callback,
+                                 void *userData, size_t bufferSize) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream stream(callback, userData, bufferSize);
+  stream << *unwrap(record_ref);
+}
+
+TableGenBool tableGenRecordPrintToBuffer(TableGenRecordRef record_ref,
+                                         TableGenBuffer *buffer,
+                                         TableGenBufferReserveCallback reserve,
+                                         void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream stream(buffer, reserve, userData);
+  stream << *unwrap(record_ref);
+  return stream.succeeded();
+}
+
 void tableGenRecordDump(TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
   unwrap(record_ref)->dump();
 }
@@ -12,13 +12,635 @@
 #include "Types.h"
 
 using ctablegen::RecordMap;
+using ctablegen::RecordVector;
+using ctablegen::Stats;
+
+void ctablegen::TableGenRecordKeeper::buildFieldIndex() {
+  Stats::TraceScope scope("buildFieldIndex");
+  // Id 0 is reserved for unknown fields.
+  fieldNames.emplace_back();
+  for (const auto &cls : getClasses())
+    addFieldEntries(cls.second.get());
+  for (const auto &def : getDefs())
+    addFieldEntries(def.second.get());
+  builtIndices.fetch_or(FieldIndex, std::memory_order_release);
+}
+
+void ctablegen::TableGenRecordKeeper::addFieldEntries(const Record *record) {
+  unsigned first = fieldEntries.size();
+  ArrayRef<RecordVal> values = record->getValues();
+  for (unsigned i = 0; i < values.size(); i++) {
+    auto inserted = fieldIds.try_emplace(values[i].getName(), fieldNames.size());
+    if (inserted.second)
+      fieldNames.push_back(inserted.first->first());
+    fieldEntries.push_back(FieldEntry{inserted.first->second, i});
+  }
+  std::sort(fieldEntries.begin() + first, fieldEntries.end(),
+            [](FieldEntry a, FieldEntry b) { return a.id < b.id; });
+  fieldRanges[record] = {first, fieldEntries.size() - first};
+}
+
+unsigned ctablegen::TableGenRecordKeeper::getFieldId(StringRef name) {
+  std::call_once(fieldIndexFlag, [this] { buildFieldIndex(); });
+  return fieldIds.lookup(name);
+}
+
+StringRef ctablegen::TableGenRecordKeeper::getFieldName(unsigned id) {
+  std::call_once(fieldIndexFlag, [this] { buildFieldIndex(); });
+  if (id >= fieldNames.size())
+    return {};
+  return fieldNames[id];
+}
+
+const RecordVal *
+ctablegen::TableGenRecordKeeper::getValue(const Record *record, unsigned id) {
+  std::call_once(fieldIndexFlag, [this] { buildFieldIndex(); });
+  if (id == 0 || id >= fieldNames.size())
+    return nullptr;
+
+  auto range = fieldRanges.find(record);
+  if (range == fieldRanges.end())
+    return record->getValue(fieldNames[id]);
+
+  auto begin = fieldEntries.begin() + range->second.first;
+  auto end = begin + range->second.second;
+  auto entry = std::lower_bound(
+      begin, end, id, [](FieldEntry a, unsigned id) { return a.id < id; });
+  if (entry == end || entry->id != id)
+    return nullptr;
+  return &record->getValues()[entry->index];
+}
+
+void ctablegen::TableGenRecordKeeper::buildClassIndex() {
+  Stats::TraceScope scope("buildClassIndex");
+  unsigned id = 1;
+  for (const auto &cls : getClasses())
+    classIds[cls.second.get()] = id++;
+  classWords = (id + 63) / 64;
+
+  superClassBits.resize((getClasses().size() + getDefs().size()) * classWords);
+  unsigned offset = 0;
+  auto addRecord = [&](const Record *record) {
+    superClassOffsets[record] = offset;
+    for (const auto &superClass : record->getSuperClasses()) {
+      unsigned bit = classIds.lookup(superClass.first);
+      superClassBits[offset + bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    offset += classWords;
+  };
+  for (const auto &cls : getClasses())
+    addRecord(cls.second.get());
+  for (const auto &def : getDefs())
+    addRecord(def.second.get());
+  builtIndices.fetch_or(ClassIndex, std::memory_order_release);
+}
+
+const uint64_t *
+ctablegen::TableGenRecordKeeper::getSuperClassBits(const Record *record) {
+  std::call_once(classIndexFlag, [this] { buildClassIndex(); });
+  auto it = superClassOffsets.find(record);
+  if (it == superClassOffsets.end())
+    return nullptr;
+  return superClassBits.data() + it->second;
+}
+
+unsigned ctablegen::TableGenRecordKeeper::getClassId(StringRef name) {
+  std::call_once(classIndexFlag, [this] { buildClassIndex(); });
+  return classIds.lookup(getClass(name));
+}
+
+bool ctablegen::TableGenRecordKeeper::isSubClassOf(const Record *record,
+                                                   unsigned classId) {
+  const uint64_t *bits = getSuperClassBits(record);
+  if (!bits || classId == 0 || classId / 64 >= classWords)
+    return false;
+  return bits[classId / 64] & (uint64_t(1) << (classId % 64));
+}
+
+size_t ctablegen::TableGenRecordKeeper::areSubClassesOf(
+    ArrayRef<const Record *> records, ArrayRef<unsigned> ids,
+    uint8_t *result) {
+  std::call_once(classIndexFlag, [this] { buildClassIndex(); });
+
+  // Only the words holding the bits of the requested classes are compared,
+  // which usually makes the test for a record one or two ANDs.
+  SmallVector<std::pair<unsigned, uint64_t>, 4> masks;
+  bool valid = true;
+  for (unsigned id : ids) {
+    if (id == 0 || id / 64 >= classWords) {
+      valid = false;
+      break;
+    }
+    uint64_t bit = uint64_t(1) << (id % 64);
+    auto it = llvm::find_if(masks, [&](const std::pair<unsigned, uint64_t> &m) {
+      return m.first == id / 64;
+    });
+    if (it != masks.end())
+      it->second |= bit;
+    else
+      masks.emplace_back(id / 64, bit);
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    const uint64_t *bits = valid ? getSuperClassBits(records[i]) : nullptr;
+    bool matches = bits != nullptr;
+    for (const auto &mask : masks) {
+      if (!matches)
+        break;
+      matches = (bits[mask.first] & mask.second) == mask.second;
+    }
+    if (result)
+      result[i] = matches;
+    count += matches;
+  }
+  return count;
+}
+
+Init *ctablegen::TableGenRecordKeeper::resolve(const Record *record,
+                                               Init *init) {
+  // The fields of defs are resolved when they are instantiated.
+  if (init->isConcrete())
+    return init;
+
+  // Resolving creates new inits, which are not thread-safe to create.
+  std::lock_guard<std::mutex> guard(resolveMutex);
+  auto inserted = resolvedInits.try_emplace({record, init}, nullptr);
+  if (inserted.second) {
+    RecordResolver resolver(const_cast<Record &>(*record));
+    inserted.first->second = init->resolveReferences(resolver);
+  }
+  return inserted.first->second;
+}
+
+void ctablegen::TableGenRecordKeeper::buildRecordIndex() {
+  Stats::TraceScope scope("buildRecordIndex");
+  size_t size = getClasses().size() + getDefs().size() + 1;
+  recordTable.reserve(size);
+  recordNames.reserve(size);
+  recordIds.reserve(size);
+  // Id 0 is reserved for unknown records.
+  recordTable.push_back(nullptr);
+  recordNames.emplace_back();
+  auto addRecords = [&](const ctablegen::RecordMap &records) {
+    for (const auto &record : records) {
+      recordIds[record.second.get()] = recordTable.size();
+      recordTable.push_back(record.second.get());
+      recordNames.push_back(record.first);
+    }
+  };
+  addRecords(getClasses());
+  addRecords(getDefs());
+  builtIndices.fetch_or(RecordIndex, std::memory_order_release);
+}
+
+unsigned ctablegen::TableGenRecordKeeper::getRecordId(const Record *record) {
+  std::call_once(recordIndexFlag, [this] { buildRecordIndex(); });
+  return recordIds.lookup(record);
+}
+
+ArrayRef<Record *> ctablegen::TableGenRecordKeeper::getRecordTable() {
+  std::call_once(recordIndexFlag, [this] { buildRecordIndex(); });
+  return recordTable;
+}
+
+ArrayRef<StringRef> ctablegen::TableGenRecordKeeper::getRecordNames() {
+  std::call_once(recordIndexFlag, [this] { buildRecordIndex(); });
+  return recordNames;
+}
+
+ArrayRef<StringRef> ctablegen::TableGenRecordKeeper::getFieldNames() {
+  std::call_once(fieldIndexFlag, [this] { buildFieldIndex(); });
+  return fieldNames;
+}
+
+Record *ctablegen::TableGenRecordKeeper::getClassById(unsigned classId) {
+  if (classId == 0 || classId > getClasses().size())
+    return nullptr;
+  return getRecordTable()[classId];
+}
+
+void ctablegen::TableGenRecordKeeper::buildDerivedDefinitions() {
+  Stats::TraceScope scope("buildDerivedDefinitions");
+  // Count the defs of every class first, so that all of them can be stored
+  // in a single array.
+  unsigned index = 0;
+  for (const auto &def : getDefs()) {
+    Record *record = def.second.get();
+    defIndices[record] = index++;
+    for (const auto &superClass : record->getSuperClasses())
+      derivedDefRanges[superClass.first].second++;
+  }
+
+  unsigned offset = 0;
+  for (auto &range : derivedDefRanges) {
+    range.second.first = offset;
+    offset += range.second.second;
+    range.second.second = 0;
+  }
+
+  derivedDefRecords.resize(offset);
+  for (const auto &def : getDefs()) {
+    Record *record = def.second.get();
+    for (const auto &superClass : record->getSuperClasses()) {
+      auto &range = derivedDefRanges[superClass.first];
+      derivedDefRecords[range.first + range.second++] = record;
+    }
+  }
+  builtIndices.fetch_or(DerivedDefsIndex, std::memory_order_release);
+}
+
+ArrayRef<Record *>
+ctablegen::TableGenRecordKeeper::getDerivedDefinitions(const Record *cls) {
+  std::call_once(derivedDefsFlag, [this] { buildDerivedDefinitions(); });
+  auto it = derivedDefRanges.find(cls);
+  if (it == derivedDefRanges.end())
+    return {};
+  return ArrayRef<Record *>(derivedDefRecords).slice(it->second.first,
+                                                     it->second.second);
+}
+
+RecordVector ctablegen::TableGenRecordKeeper::getDerivedDefinitions(
+    ArrayRef<const Record *> classes) {
+  if (classes.empty())
+    return {};
+
+  SmallVector<ArrayRef<Record *>, 4> spans;
+  for (const Record *cls : classes)
+    spans.push_back(getDerivedDefinitions(cls));
+  llvm::sort(spans, [](ArrayRef<Record *> a, ArrayRef<Record *> b) {
+    return a.size() < b.size();
+  });
+
+  // All spans are sorted by def index, so they can be intersected by
+  // advancing through each of them once.
+  RecordVector result(spans.front().begin(), spans.front().end());
+  for (size_t i = 1; i < spans.size(); i++) {
+    ArrayRef<Record *> span = spans[i];
+    auto next = span.begin();
+    auto out = result.begin();
+    for (Record *record : result) {
+      unsigned index = defIndices.lookup(record);
+      while (next != span.end() && defIndices.lookup(*next) < index)
+        ++next;
+      if (next == span.end())
+        break;
+      if (*next == record)
+        *out++ = record;
+    }
+    result.erase(out, result.end());
+  }
+  return result;
+}
 
 void tableGenRecordKeeperFree(TableGenRecordKeeperRef rk_ref) {
-  delete unwrap(rk_ref);
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  if (!rk->leaksOnFree())
+    delete rk;
+}
+
+void tableGenRecordKeeperSetLeakOnFree(TableGenRecordKeeperRef rk_ref,
+                                       TableGenBool leak) {
+  TABLEGEN_COUNT_CALL();
+  unwrap(rk_ref)->setLeakOnFree(leak);
+}
+
+void tableGenRecordKeeperPrint(TableGenRecordKeeperRef rk_ref,
+                               TableGenStringCallback callback, void *userData,
+                               size_t bufferSize) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream stream(callback, userData, bufferSize);
+  stream << *unwrap(rk_ref);
+}
+
+TableGenBool tableGenRecordKeeperPrintToBuffer(
+    TableGenRecordKeeperRef rk_ref, TableGenBuffer *buffer,
+    TableGenBufferReserveCallback reserve, void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream stream(buffer, reserve, userData);
+  stream << *unwrap(rk_ref);
+  return stream.succeeded();
+}
+
+static size_t fillRecordArray(const RecordMap &map,
+                              TableGenNamedRecord *records, size_t len) {
+  size_t count = 0;
+  for (auto it = map.begin(); it != map.end() && count < len; ++it) {
+    auto &name = it->first;
+    records[count++] = TableGenNamedRecord{
+        .name = TableGenStringRef{.data = name.data(), .len = name.size()},
+        .record = wrap(it->second.get())};
+  }
+  return count;
+}
+
+size_t tableGenRecordKeeperGetNumClasses(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getClasses().size();
+}
+
+size_t tableGenRecordKeeperGetClassesArray(TableGenRecordKeeperRef rk_ref,
+                                           TableGenNamedRecord *records,
+                                           size_t len) {
+  TABLEGEN_COUNT_CALL();
+  return fillRecordArray(unwrap(rk_ref)->getClasses(), records, len);
+}
+
+size_t tableGenRecordKeeperGetNumDefs(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getDefs().size();
+}
+
+size_t tableGenRecordKeeperGetDefsArray(TableGenRecordKeeperRef rk_ref,
+                                        TableGenNamedRecord *records,
+                                        size_t len) {
+  TABLEGEN_COUNT_CALL();
+  return fillRecordArray(unwrap(rk_ref)->getDefs(), records, len);
+}
+
+static void diffRecordMaps(const RecordMap &oldMap, const RecordMap &newMap,
+                           bool isClass,
+                           std::vector<TableGenRecordChange> &changes) {
+  auto change = [&](TableGenRecordChangeKind kind, Record *oldRecord,
+                    Record *newRecord) {
+    changes.push_back(TableGenRecordChange{.kind = kind,
+                                           .is_class = isClass,
+                                           .old_record = wrap(oldRecord),
+                                           .new_record = wrap(newRecord),
+                                           .field_changes = nullptr,
+                                           .num_field_changes = 0});
+  };
+
+  // Both maps are sorted by name, so they can be merged in a single pass.
+  // Records present in both are added as modified and compared later.
+  auto oldIt = oldMap.begin(), newIt = newMap.begin();
+  while (oldIt != oldMap.end() || newIt != newMap.end()) {
+    if (newIt == newMap.end() ||
+        (oldIt != oldMap.end() && oldIt->first < newIt->first)) {
+      change(TableGenRecordRemoved, oldIt->second.get(), nullptr);
+      ++oldIt;
+    } else if (oldIt == oldMap.end() || newIt->first < oldIt->first) {
+      change(TableGenRecordAdded, nullptr, newIt->second.get());
+      ++newIt;
+    } else {
+      change(TableGenRecordModified, oldIt->second.get(), newIt->second.get());
+      ++oldIt;
+      ++newIt;
+    }
+  }
+}
+
+/// Returns the field of `record` with the same name as `value`, which is
+/// usually at the same index.
+static const RecordVal *findField(const Record &record, size_t index,
+                                  const RecordVal &value) {
+  auto values = record.getValues();
+  if (index < values.size() && values[index].getName() == value.getName())
+    return &values[index];
+  return record.getValue(value.getName());
+}
+
+/// Appends the fields that differ between two versions of a record to
+/// `fieldChanges`: removed and modified fields in the order of the old
+/// record, followed by added fields in the order of the new record.
+static void diffFields(ctablegen::RecordHasher &oldHasher,
+                       ctablegen::RecordHasher &newHasher,
+                       const Record &oldRecord, const Record &newRecord,
+                       std::vector<TableGenFieldChange> &fieldChanges) {
+  auto change = [&](TableGenRecordChangeKind kind, const RecordVal *oldValue,
+                    const RecordVal *newValue) {
+    StringRef name = (oldValue ? oldValue : newValue)->getName();
+    fieldChanges.push_back(TableGenFieldChange{
+        .kind = kind,
+        .name = TableGenStringRef{.data = name.data(), .len = name.size()},
+        .old_value = wrap(oldValue),
+        .new_value = wrap(newValue)});
+  };
+
+  auto oldValues = oldRecord.getValues();
+  for (size_t i = 0; i < oldValues.size(); i++) {
+    const RecordVal *newValue = findField(newRecord, i, oldValues[i]);
+    if (!newValue)
+      change(TableGenRecordRemoved, &oldValues[i], nullptr);
+    else if (oldHasher.hashField(oldValues[i]) !=
+             newHasher.hashField(*newValue))
+      change(TableGenRecordModified, &oldValues[i], newValue);
+  }
+  auto newValues = newRecord.getValues();
+  for (size_t i = 0; i < newValues.size(); i++) {
+    if (!findField(oldRecord, i, newValues[i]))
+      change(TableGenRecordAdded, nullptr, &newValues[i]);
+  }
+}
+
+namespace {
+
+/// A range of records present in both keepers, compared by one thread.
+///
+/// Every block has its own hashers, so threads never share memoized hashes.
+/// Inits shared between blocks are hashed once per block.
+struct DiffBlock {
+  size_t begin;
+  size_t end;
+  std::vector<uint8_t> modified;
+  std::vector<size_t> numFieldChanges;
+  std::vector<TableGenFieldChange> fieldChanges;
+};
+
+} // namespace
+
+/// Compares the records present in both keepers, which `diffRecordMaps`
+/// marked as modified, and removes the ones that did not change.
+static void compareMatchedRecords(ctablegen::RecordDiff &diff,
+                                  size_t numThreads) {
+  std::vector<size_t> matched;
+  for (size_t i = 0; i < diff.changes.size(); i++) {
+    if (diff.changes[i].kind == TableGenRecordModified)
+      matched.push_back(i);
+  }
+
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  // A few blocks per thread balance records of uneven size.
+  size_t numBlocks = std::min(matched.size(), numThreads * 4);
+  std::vector<DiffBlock> blocks(numBlocks);
+  for (size_t i = 0; i < numBlocks; i++) {
+    blocks[i].begin = matched.size() * i / numBlocks;
+    blocks[i].end = matched.size() * (i + 1) / numBlocks;
+  }
+
+  ctablegen::parallelFor(numBlocks, numThreads, [&](size_t i) {
+    auto &block = blocks[i];
+    ctablegen::RecordHasher oldHasher, newHasher;
+    for (size_t j = block.begin; j < block.end; j++) {
+      const auto &change = diff.changes[matched[j]];
+      const Record *oldRecord = unwrap(change.old_record);
+      const Record *newRecord = unwrap(change.new_record);
+      bool modified =
+          oldHasher.hashRecord(oldRecord) != newHasher.hashRecord(newRecord);
+      size_t numFieldChanges = block.fieldChanges.size();
+      if (modified)
+        diffFields(oldHasher, newHasher, *oldRecord, *newRecord,
+                   block.fieldChanges);
+      block.modified.push_back(modified);
+      block.numFieldChanges.push_back(block.fieldChanges.size() -
+                                      numFieldChanges);
+    }
+  });
+
+  // Field changes are stored back to back in the order of their records, so
+  // pointers into them are only handed out once all of them are added.
+  std::vector<uint8_t> modified(diff.changes.size(), true);
+  std::vector<size_t> numFieldChanges(diff.changes.size());
+  for (const auto &block : blocks) {
+    for (size_t j = block.begin; j < block.end; j++) {
+      modified[matched[j]] = block.modified[j - block.begin];
+      numFieldChanges[matched[j]] = block.numFieldChanges[j - block.begin];
+    }
+    diff.fieldChanges.insert(diff.fieldChanges.end(),
+                             block.fieldChanges.begin(),
+                             block.fieldChanges.end());
+  }
+
+  size_t kept = 0, nextFieldChange = 0;
+  for (size_t i = 0; i < diff.changes.size(); i++) {
+    if (!modified[i])
+      continue;
+    auto &change = diff.changes[kept++] = diff.changes[i];
+    change.num_field_changes = numFieldChanges[i];
+    if (change.num_field_changes)
+      change.field_changes = &diff.fieldChanges[nextFieldChange];
+    nextFieldChange += change.num_field_changes;
+  }
+  diff.changes.resize(kept);
+}
+
+TableGenRecordDiffRef tableGenRecordKeeperDiff(TableGenRecordKeeperRef old_ref,
+                                               TableGenRecordKeeperRef new_ref,
+                                               size_t num_threads) {
+  TABLEGEN_COUNT_CALL();
+  Stats::TraceScope scope("diff");
+  Stats::countAllocation(Stats::OtherAllocation);
+  auto *diff = new ctablegen::RecordDiff;
+  diffRecordMaps(unwrap(old_ref)->getClasses(), unwrap(new_ref)->getClasses(),
+                 true, diff->changes);
+  diffRecordMaps(unwrap(old_ref)->getDefs(), unwrap(new_ref)->getDefs(), false,
+                 diff->changes);
+  compareMatchedRecords(*diff, num_threads);
+  return wrap(diff);
+}
+
+size_t tableGenRecordDiffGetNumChanges(TableGenRecordDiffRef diff_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(diff_ref)->changes.size();
+}
+
+const TableGenRecordChange *
+tableGenRecordDiffGetChanges(TableGenRecordDiffRef diff_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(diff_ref)->changes.data();
+}
+
+void tableGenRecordDiffFree(TableGenRecordDiffRef diff_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(diff_ref);
+}
+
+TableGenFieldId tableGenRecordKeeperGetFieldId(TableGenRecordKeeperRef rk_ref,
+                                               TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getFieldId(StringRef(name.data, name.len));
+}
+
+TableGenStringRef
+tableGenRecordKeeperGetFieldName(TableGenRecordKeeperRef rk_ref,
+                                 TableGenFieldId id) {
+  TABLEGEN_COUNT_CALL();
+  auto name = unwrap(rk_ref)->getFieldName(id);
+  return TableGenStringRef{.data = name.data(), .len = name.size()};
+}
+
+TableGenClassId tableGenRecordKeeperGetClassId(TableGenRecordKeeperRef rk_ref,
+                                               TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getClassId(StringRef(name.data, name.len));
+}
+
+// `StringRef` has the same layout as `TableGenStringRef`, so name tables are
+// returned without copying them.
+static_assert(sizeof(StringRef) == sizeof(TableGenStringRef) &&
+                  alignof(StringRef) == alignof(TableGenStringRef),
+              "StringRef is not layout-compatible with TableGenStringRef");
+
+static const TableGenStringRef *toStringRefs(ArrayRef<StringRef> names,
+                                             size_t *len) {
+  *len = names.size();
+  return reinterpret_cast<const TableGenStringRef *>(names.data());
+}
+
+const TableGenStringRef *
+tableGenRecordKeeperGetFieldNames(TableGenRecordKeeperRef rk_ref, size_t *len) {
+  TABLEGEN_COUNT_CALL();
+  return toStringRefs(unwrap(rk_ref)->getFieldNames(), len);
+}
+
+TableGenRecordId tableGenRecordKeeperGetRecordId(TableGenRecordKeeperRef rk_ref,
+                                                 TableGenRecordRef record_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(rk_ref)->getRecordId(unwrap(record_ref));
+}
+
+void tableGenRecordKeeperGetRecordIds(TableGenRecordKeeperRef rk_ref,
+                                      const TableGenRecordRef *records,
+                                      size_t len, TableGenRecordId *ids) {
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  for (size_t i = 0; i < len; i++)
+    ids[i] = rk->getRecordId(unwrap(records[i]));
+}
+
+TableGenRecordRef
+tableGenRecordKeeperGetRecordById(TableGenRecordKeeperRef rk_ref,
+                                  TableGenRecordId id) {
+  TABLEGEN_COUNT_CALL();
+  auto table = unwrap(rk_ref)->getRecordTable();
+  return id < table.size() ? wrap(table[id]) : nullptr;
+}
+
+TableGenRecordSpan
+tableGenRecordKeeperGetRecordTable(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  auto table = unwrap(rk_ref)->getRecordTable();
+  return TableGenRecordSpan{
+      .records = reinterpret_cast<const TableGenRecordRef *>(table.data()),
+      .len = table.size()};
+}
+
+const TableGenStringRef *
+tableGenRecordKeeperGetRecordNames(TableGenRecordKeeperRef rk_ref,
+                                   size_t *len) {
+  TABLEGEN_COUNT_CALL();
+  return toStringRefs(unwrap(rk_ref)->getRecordNames(), len);
+}
+
+size_t tableGenRecordsAreSubclassesOf(const TableGenRecordRef *records,
+                                      size_t len, const TableGenClassId *ids,
+                                      size_t num_ids, uint8_t *result) {
+  TABLEGEN_COUNT_CALL();
+  if (len == 0)
+    return 0;
+  auto &rk = ctablegen::TableGenRecordKeeper::of(*unwrap(records[0]));
+  return rk.areSubClassesOf(
+      ArrayRef<const Record *>(reinterpret_cast<const Record *const *>(records),
+                               len),
+      ArrayRef<unsigned>(ids, num_ids), result);
 }
 
 TableGenRecordKeeperIteratorRef
 tableGenRecordKeeperGetFirstClass(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  Stats::countAllocation(Stats::IteratorAllocation);
   auto *it =
       new RecordMap::const_iterator(unwrap(rk_ref)->getClasses().begin());
   if (*it == unwrap(rk_ref)->getClasses().end()) {
@@ -29,6 +651,8 @@ tableGenRecordKeeperGetFirstClass(TableGenRecordKeeperRef rk_ref) {
 
 TableGenRecordKeeperIteratorRef
 tableGenRecordKeeperGetFirstDef(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
+  Stats::countAllocation(Stats::IteratorAllocation);
   auto *it = new RecordMap::const_iterator(unwrap(rk_ref)->getDefs().begin());
   if (*it == unwrap(rk_ref)->getDefs().end()) {
     return nullptr;
@@ -37,6 +661,7 @@ tableGenRecordKeeperGetFirstDef(TableGenRecordKeeperRef rk_ref) {
 }
 
 void tableGenRecordKeeperGetNextClass(TableGenRecordKeeperIteratorRef *item) {
+  TABLEGEN_COUNT_CALL();
   auto *it = unwrap(*item);
   auto end = (*it)->second->getRecords().getClasses().end();
   if (++*it == end) {
@@ -45,6 +670,7 @@ void tableGenRecordKeeperGetNextClass(TableGenRecordKeeperIteratorRef *item) {
 }
 
 void tableGenRecordKeeperGetNextDef(TableGenRecordKeeperIteratorRef *item) {
+  TABLEGEN_COUNT_CALL();
   auto *it = unwrap(*item);
   auto end = (*it)->second->getRecords().getDefs().end();
   if (++*it == end) {
@@ -53,56 +679,140 @@ void tableGenRecordKeeperGetNextDef(TableGenRecordKeeperIteratorRef *item) {
 }
 
 void tableGenRecordKeeperIteratorFree(TableGenRecordKeeperIteratorRef item) {
+  TABLEGEN_COUNT_CALL();
   if (item)
     delete unwrap(item);
 }
 
 TableGenRecordKeeperIteratorRef
 tableGenRecordKeeperIteratorClone(TableGenRecordKeeperIteratorRef item) {
+  TABLEGEN_COUNT_CALL();
+  Stats::countAllocation(Stats::IteratorAllocation);
   return wrap(new RecordMap::const_iterator(*unwrap(item)));
 }
 
 TableGenStringRef
 tableGenRecordKeeperItemGetName(TableGenRecordKeeperIteratorRef item) {
+  TABLEGEN_COUNT_CALL();
   auto &s = (*unwrap(item))->first;
   return TableGenStringRef{.data = s.data(), .len = s.size()};
 }
 
 TableGenRecordRef
 tableGenRecordKeeperItemGetRecord(TableGenRecordKeeperIteratorRef item) {
+  TABLEGEN_COUNT_CALL();
   return wrap((*unwrap(item))->second.get());
 }
 
 TableGenRecordMapRef
 tableGenRecordKeeperGetClasses(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(&unwrap(rk_ref)->getClasses());
 }
 
 TableGenRecordMapRef
 tableGenRecordKeeperGetDefs(TableGenRecordKeeperRef rk_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(&unwrap(rk_ref)->getDefs());
 }
 
 TableGenRecordRef tableGenRecordKeeperGetClass(TableGenRecordKeeperRef rk_ref,
                                                TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
   return wrap(unwrap(rk_ref)->getClass(StringRef(name.data, name.len)));
 }
 
 TableGenRecordRef tableGenRecordKeeperGetDef(TableGenRecordKeeperRef rk_ref,
                                              TableGenStringRef name) {
+  TABLEGEN_COUNT_CALL();
   return wrap(unwrap(rk_ref)->getDef(StringRef(name.data, name.len)));
 }
 
 TableGenRecordVectorRef
 tableGenRecordKeeperGetAllDerivedDefinitions(TableGenRecordKeeperRef rk_ref,
                                              TableGenStringRef className) {
-  return wrap(
-      new ctablegen::RecordVector(unwrap(rk_ref)->getAllDerivedDefinitions(
-          StringRef(className.data, className.len))));
+  TABLEGEN_COUNT_CALL();
+  auto span =
+      tableGenRecordKeeperGetDerivedDefinitionsSpan(rk_ref, className);
+  Stats::countAllocation(Stats::VectorAllocation);
+  return wrap(new ctablegen::RecordVector(
+      reinterpret_cast<Record *const *>(span.records),
+      reinterpret_cast<Record *const *>(span.records) + span.len));
+}
+
+TableGenRecordSpan
+tableGenRecordKeeperGetDerivedDefinitionsSpan(TableGenRecordKeeperRef rk_ref,
+                                              TableGenStringRef className) {
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  auto *cls = rk->getClass(StringRef(className.data, className.len));
+  if (!cls)
+    return TableGenRecordSpan{.records = nullptr, .len = 0};
+  auto defs = rk->getDerivedDefinitions(cls);
+  return TableGenRecordSpan{
+      .records = reinterpret_cast<const TableGenRecordRef *>(defs.data()),
+      .len = defs.size()};
+}
+
+TableGenRecordSpan tableGenRecordKeeperGetDerivedDefinitionsSpanById(
+    TableGenRecordKeeperRef rk_ref, TableGenClassId id) {
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  auto *cls = rk->getClassById(id);
+  if (!cls)
+    return TableGenRecordSpan{.records = nullptr, .len = 0};
+  auto defs = rk->getDerivedDefinitions(cls);
+  return TableGenRecordSpan{
+      .records = reinterpret_cast<const TableGenRecordRef *>(defs.data()),
+      .len = defs.size()};
+}
+
+TableGenRecordVectorRef tableGenRecordKeeperGetAllDerivedDefinitionsMulti(
+    TableGenRecordKeeperRef rk_ref, const TableGenStringRef *classNames,
+    size_t len) {
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  SmallVector<const Record *, 4> classes;
+  for (size_t i = 0; i < len; i++) {
+    auto *cls = rk->getClass(StringRef(classNames[i].data, classNames[i].len));
+    if (!cls) {
+      Stats::countAllocation(Stats::VectorAllocation);
+      return wrap(new ctablegen::RecordVector());
+    }
+    classes.push_back(cls);
+  }
+  Stats::countAllocation(Stats::VectorAllocation);
+  return wrap(new ctablegen::RecordVector(rk->getDerivedDefinitions(classes)));
+}
+
+TableGenRecordVectorRef tableGenRecordKeeperGetAllDerivedDefinitionsMultiById(
+    TableGenRecordKeeperRef rk_ref, const TableGenClassId *ids, size_t len) {
+  TABLEGEN_COUNT_CALL();
+  auto *rk = unwrap(rk_ref);
+  SmallVector<const Record *, 4> classes;
+  for (size_t i = 0; i < len; i++) {
+    auto *cls = rk->getClassById(ids[i]);
+    if (!cls) {
+      Stats::countAllocation(Stats::VectorAllocation);
+      return wrap(new ctablegen::RecordVector());
+    }
+    classes.push_back(cls);
+  }
+  Stats::countAllocation(Stats::VectorAllocation);
+  return wrap(new ctablegen::RecordVector(rk->getDerivedDefinitions(classes)));
+}
+
+TableGenRecordSpan tableGenRecordVectorGetSpan(TableGenRecordVectorRef vec_ref) {
+  TABLEGEN_COUNT_CALL();
+  auto *vec = unwrap(vec_ref);
+  return TableGenRecordSpan{
+      .records = reinterpret_cast<const TableGenRecordRef *>(vec->data()),
+      .len = vec->size()};
 }
 
 TableGenRecordRef tableGenRecordVectorGet(TableGenRecordVectorRef vec_ref,
                                           size_t index) {
+  TABLEGEN_COUNT_CALL();
   auto *vec = unwrap(vec_ref);
   if (index < vec->size())
     return wrap(((*vec)[index]));
@@ -110,5 +820,16 @@ TableGenRecordRef tableGenRecordVectorGet(TableGenRecordVectorRef vec_ref,
 }
 
 void tableGenRecordVectorFree(TableGenRecordVectorRef vec_ref) {
+  TABLEGEN_COUNT_CALL();
   delete unwrap(vec_ref);
 }
+
+void tableGenRecordsParallelForEach(const TableGenRecordRef *records,
+                                    size_t len, TableGenRecordCallback callback,
+                                    void *userData, size_t num_threads) {
+  TABLEGEN_COUNT_CALL();
+  Stats::TraceScope scope("parallelForEach");
+  ctablegen::parallelFor(len, num_threads, [&](size_t i) {
+    callback(records[i], i, userData);
+  });
+}
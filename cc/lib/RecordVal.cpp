@@ -13,61 +13,182 @@
 #include "Types.h"
 
 TableGenStringRef tableGenRecordValGetName(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   auto s = unwrap(rv_ref)->getName();
   return TableGenStringRef { .data = s.data(), .len = s.size() };
 }
 
 TableGenTypedInitRef tableGenRecordValGetNameInit(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getNameInit()));
 }
 
 TableGenRecTyKind tableGenRecordValGetType(TableGenRecordValRef rv_ref) {
-  return ctablegen::tableGenFromRecType(unwrap(rv_ref)->getType());
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::tableGenRecordValKind(*unwrap(rv_ref));
 }
 
 TableGenTypedInitRef tableGenRecordValGetValue(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue()));
 }
 
+TableGenInitValue tableGenRecordValDecode(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::tableGenDecodeInit(unwrap(rv_ref)->getValue());
+}
+
+TableGenStringRef
+tableGenRecordValGetValAsStringRef(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
+  return tableGenStringInitGetValue(
+      wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())));
+}
+
 char *tableGenRecordValGetValAsNewString(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   return tableGenStringInitGetValueNewString(
       wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())));
 }
 
 TableGenBool tableGenRecordValGetValAsBit(TableGenRecordValRef rv_ref,
                                           int8_t *bit) {
+  TABLEGEN_COUNT_CALL();
   return tableGenBitInitGetValue(
       wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())), bit);
 }
 
 int8_t *tableGenRecordValGetValAsBits(TableGenRecordValRef rv_ref,
                                       size_t *len) {
+  TABLEGEN_COUNT_CALL();
   return tableGenBitsInitGetValue(
       wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())), len);
 }
 
 TableGenBool tableGenRecordValGetValAsInt(TableGenRecordValRef rv_ref,
                                           int64_t *integer) {
+  TABLEGEN_COUNT_CALL();
   return tableGenIntInitGetValue(
       wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())), integer);
 }
 
 TableGenRecordRef
 tableGenRecordValGetValAsDefRecord(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   return tableGenDefInitGetValue(
       wrap(dyn_cast<TypedInit>(unwrap(rv_ref)->getValue())));
 }
 
 void tableGenRecordValPrint(TableGenRecordValRef rv_ref, TableGenStringCallback callback,
                         void *userData) {
+  TABLEGEN_COUNT_CALL();
   ctablegen::CallbackOstream stream(callback, userData);
   stream << *unwrap(rv_ref);
 }
 
+void tableGenRecordValPrintBuffered(TableGenRecordValRef rv_ref,
+                                    TableGenStringCallback callback,
+                                    void *userData, size_t bufferSize) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream stream(callback, userData, bufferSize);
+  stream << *unwrap(rv_ref);
+}
+
+TableGenBool
+tableGenRecordValPrintToBuffer(TableGenRecordValRef rv_ref,
+                               TableGenBuffer *buffer,
+                               TableGenBufferReserveCallback reserve,
+                               void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream stream(buffer, reserve, userData);
+  stream << *unwrap(rv_ref);
+  return stream.succeeded();
+}
+
 void tableGenRecordValDump(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   unwrap(rv_ref)->dump();
 }
 
 TableGenSourceLocationRef tableGenRecordValGetLoc(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::LocationAllocation);
   return wrap(new ArrayRef(unwrap(rv_ref)->getLoc()));
 }
+
+TableGenSourceLocationSpan
+tableGenRecordValGetLocSpan(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
+  // A RecordVal has a single location, stored inline.
+  const SMLoc &loc = unwrap(rv_ref)->getLoc();
+  return ctablegen::toLocationSpan(ArrayRef<SMLoc>(loc));
+}
+
+template <typename InitTy, typename T, typename F>
+static size_t getColumn(const TableGenRecordRef *records, size_t len,
+                        TableGenFieldId id, T *values, uint8_t *valid,
+                        F get) {
+  if (len == 0)
+    return 0;
+
+  auto &rk = ctablegen::TableGenRecordKeeper::of(*unwrap(records[0]));
+  size_t count = 0;
+  for (size_t i = 0; i < len; i++) {
+    auto *value = rk.getValue(unwrap(records[i]), id);
+    auto *init = value ? dyn_cast<InitTy>(value->getValue()) : nullptr;
+    values[i] = init ? get(init) : T{};
+    if (valid)
+      valid[i] = init != nullptr;
+    count += init != nullptr;
+  }
+  return count;
+}
+
+size_t tableGenRecordsGetBitColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   int8_t *values, uint8_t *valid) {
+  TABLEGEN_COUNT_CALL();
+  return getColumn<BitInit>(records, len, id, values, valid,
+                            [](BitInit *init) { return init->getValue(); });
+}
+
+size_t tableGenRecordsGetIntColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   int64_t *values, uint8_t *valid) {
+  TABLEGEN_COUNT_CALL();
+  return getColumn<IntInit>(records, len, id, values, valid,
+                            [](IntInit *init) { return init->getValue(); });
+}
+
+size_t tableGenRecordsGetStringColumn(const TableGenRecordRef *records,
+                                      size_t len, TableGenFieldId id,
+                                      TableGenStringRef *values,
+                                      uint8_t *valid) {
+  TABLEGEN_COUNT_CALL();
+  return getColumn<StringInit>(
+      records, len, id, values, valid, [](StringInit *init) {
+        auto val = init->getValue();
+        return TableGenStringRef{.data = val.data(), .len = val.size()};
+      });
+}
+
+size_t tableGenRecordsGetDefColumn(const TableGenRecordRef *records,
+                                   size_t len, TableGenFieldId id,
+                                   TableGenRecordRef *values, uint8_t *valid) {
+  TABLEGEN_COUNT_CALL();
+  return getColumn<DefInit>(records, len, id, values, valid,
+                            [](DefInit *init) { return wrap(init->getDef()); });
+}
+
+size_t tableGenRecordsGetDefIdColumn(const TableGenRecordRef *records,
+                                     size_t len, TableGenFieldId id,
+                                     TableGenRecordId *values,
+                                     uint8_t *valid) {
+  TABLEGEN_COUNT_CALL();
+  if (len == 0)
+    return 0;
+  auto &rk = ctablegen::TableGenRecordKeeper::of(*unwrap(records[0]));
+  return getColumn<DefInit>(
+      records, len, id, values, valid,
+      [&](DefInit *init) { return rk.getRecordId(init->getDef()); });
+}
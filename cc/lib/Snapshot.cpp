@@ -0,0 +1,508 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+#include <cstring>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Support/xxhash.h>
+
+namespace {
+
+const uint8_t SnapshotMagic[8] = {'T', 'G', 'S', 'N', 'A', 'P', 0, 0};
+
+uint64_t hashCombine(uint64_t seed, StringRef data) {
+  uint64_t parts[2] = {seed, xxHash64(data)};
+  return xxHash64(
+      StringRef(reinterpret_cast<const char *>(parts), sizeof(parts)));
+}
+
+/// Hashes everything that determines the result of a parse before it
+/// happens: the directly added buffers and the include paths.
+uint64_t snapshotKey(const ctablegen::TableGenParser &parser) {
+  uint64_t key = TABLEGEN_SNAPSHOT_VERSION;
+  for (const auto &dir : parser.getIncludeDirs())
+    key = hashCombine(key, dir);
+  for (unsigned i = 1; i <= parser.getNumInputBuffers(); i++) {
+    auto *buffer = parser.sourceMgr.getMemoryBuffer(i);
+    key = hashCombine(key, buffer->getBufferIdentifier());
+    key = hashCombine(key, buffer->getBuffer());
+  }
+  return key;
+}
+
+uint64_t alignTo8(uint64_t pos) { return (pos + 7) & ~uint64_t(7); }
+
+class SnapshotWriter {
+public:
+  SnapshotWriter(ctablegen::TableGenParser &parser, const RecordKeeper &rk)
+      : parser(parser), rk(rk) {}
+
+  void write(raw_ostream &os);
+
+private:
+  TableGenSnapshotString addString(StringRef str);
+  uint32_t addLocation(SMLoc loc);
+  uint32_t addInit(Init *init);
+  void addRecord(const Record &record);
+
+  template <typename T>
+  void addSection(TableGenSnapshotSection &section, const std::vector<T> &data,
+                  uint64_t &pos) {
+    pos = alignTo8(pos);
+    section.offset = pos;
+    section.count = data.size();
+    pos += data.size() * sizeof(T);
+  }
+
+  template <typename T>
+  void writeSection(raw_ostream &os, const TableGenSnapshotSection &section,
+                    const T *data, uint64_t &pos) {
+    os.write_zeros(section.offset - pos);
+    os.write(reinterpret_cast<const char *>(data), section.count * sizeof(T));
+    pos = section.offset + section.count * sizeof(T);
+  }
+
+  ctablegen::TableGenParser &parser;
+  const RecordKeeper &rk;
+
+  std::string strings;
+  StringMap<TableGenSnapshotString> stringIds;
+  std::vector<TableGenSnapshotBuffer> buffers;
+  std::vector<TableGenSnapshotRecord> records;
+  std::vector<TableGenSnapshotValue> values;
+  std::vector<TableGenSnapshotInit> inits;
+  std::vector<uint32_t> indices;
+  std::vector<TableGenSnapshotLocation> locations;
+
+  DenseMap<const Record *, uint32_t> recordIds;
+  DenseMap<Init *, uint32_t> initIds;
+  DenseMap<const char *, uint32_t> locationIds;
+};
+
+TableGenSnapshotString SnapshotWriter::addString(StringRef str) {
+  auto it = stringIds.try_emplace(str, TableGenSnapshotString{
+                                           uint32_t(strings.size()),
+                                           uint32_t(str.size())});
+  if (it.second)
+    strings.append(str.begin(), str.end());
+  return it.first->second;
+}
+
+uint32_t SnapshotWriter::addLocation(SMLoc loc) {
+  auto it = locationIds.try_emplace(loc.getPointer(), locations.size());
+  if (!it.second)
+    return it.first->second;
+
+  TableGenSnapshotLocation location{~0u, 0, 0, 0};
+  std::lock_guard<std::mutex> guard(parser.sourceMgrMutex);
+  if (unsigned id = parser.sourceMgr.FindBufferContainingLoc(loc)) {
+    auto lineAndColumn = parser.sourceMgr.getLineAndColumn(loc, id);
+    location.buffer = id - 1;
+    location.offset = loc.getPointer() -
+                      parser.sourceMgr.getMemoryBuffer(id)->getBufferStart();
+    location.line = lineAndColumn.first;
+    location.column = lineAndColumn.second;
+  }
+  locations.push_back(location);
+  return it.first->second;
+}
+
+uint32_t SnapshotWriter::addInit(Init *init) {
+  auto known = initIds.find(init);
+  if (known != initIds.end())
+    return known->second;
+
+  TableGenSnapshotInit result{TableGenSnapshotUnresolvedInitKind, 0, 0, 0, 0,
+                              TableGenSnapshotString{0, 0}};
+  SmallVector<uint32_t, 8> children;
+
+  if (isa<UnsetInit>(init)) {
+    result.kind = TableGenSnapshotUnsetInitKind;
+  } else if (auto *bit = dyn_cast<BitInit>(init)) {
+    result.kind = TableGenSnapshotBitInitKind;
+    result.value = bit->getValue();
+  } else if (auto *bits = dyn_cast<BitsInit>(init)) {
+    result.kind = TableGenSnapshotBitsInitKind;
+    for (unsigned i = 0, e = bits->getNumBits(); i < e; i++)
+      children.push_back(addInit(bits->getBit(i)));
+  } else if (auto *integer = dyn_cast<IntInit>(init)) {
+    result.kind = TableGenSnapshotIntInitKind;
+    result.value = integer->getValue();
+  } else if (auto *str = dyn_cast<StringInit>(init)) {
+    result.kind = str->hasCodeFormat() ? TableGenSnapshotCodeInitKind
+                                       : TableGenSnapshotStringInitKind;
+    result.string = addString(str->getValue());
+  } else if (auto *list = dyn_cast<ListInit>(init)) {
+    result.kind = TableGenSnapshotListInitKind;
+    for (size_t i = 0, e = list->size(); i < e; i++)
+      children.push_back(addInit(list->getElement(i)));
+  } else if (auto *dag = dyn_cast<DagInit>(init)) {
+    result.kind = TableGenSnapshotDagInitKind;
+    result.value = addInit(dag->getOperator());
+    result.string = addString(dag->getNameStr());
+    for (unsigned i = 0, e = dag->getNumArgs(); i < e; i++) {
+      auto name = addString(dag->getArgNameStr(i));
+      children.push_back(addInit(dag->getArg(i)));
+      children.push_back(name.offset);
+      children.push_back(name.len);
+    }
+  } else if (auto *def = dyn_cast<DefInit>(init)) {
+    auto it = recordIds.find(def->getDef());
+    if (it != recordIds.end()) {
+      result.kind = TableGenSnapshotDefInitKind;
+      result.value = it->second;
+    }
+  }
+
+  if (result.kind == TableGenSnapshotUnresolvedInitKind)
+    result.string = addString(init->getAsString());
+
+  if (!children.empty()) {
+    result.first = indices.size();
+    result.count = children.size();
+    if (result.kind == TableGenSnapshotDagInitKind)
+      result.count /= 3;
+    indices.insert(indices.end(), children.begin(), children.end());
+  }
+
+  uint32_t id = inits.size();
+  inits.push_back(result);
+  initIds[init] = id;
+  return id;
+}
+
+void SnapshotWriter::addRecord(const Record &record) {
+  TableGenSnapshotRecord result;
+  result.name = addString(record.getName());
+  result.flags = (record.isClass() ? TABLEGEN_SNAPSHOT_RECORD_CLASS : 0) |
+                 (record.isAnonymous() ? TABLEGEN_SNAPSHOT_RECORD_ANONYMOUS : 0);
+
+  SmallVector<uint32_t, 4> recordLocations;
+  for (SMLoc loc : record.getLoc())
+    recordLocations.push_back(addLocation(loc));
+  // Locations are deduplicated, so they are not necessarily contiguous yet.
+  result.first_location = locations.size();
+  result.num_locations = recordLocations.size();
+  for (uint32_t loc : recordLocations) {
+    TableGenSnapshotLocation location = locations[loc];
+    locations.push_back(location);
+  }
+
+  result.first_superclass = indices.size();
+  result.num_superclasses = record.getSuperClasses().size();
+  for (const auto &superClass : record.getSuperClasses())
+    indices.push_back(recordIds.lookup(superClass.first));
+
+  SmallVector<TableGenSnapshotValue, 16> recordValues;
+  for (const RecordVal &value : record.getValues()) {
+    TableGenSnapshotValue field;
+    field.name = addString(value.getName());
+    field.type = addString(value.getType()->getAsString());
+    field.kind = ctablegen::tableGenFromRecType(value.getType());
+    field.init = addInit(value.getValue());
+    field.location = addLocation(value.getLoc());
+    field.reserved = 0;
+    recordValues.push_back(field);
+  }
+  result.first_value = values.size();
+  result.num_values = recordValues.size();
+  values.insert(values.end(), recordValues.begin(), recordValues.end());
+
+  records.push_back(result);
+}
+
+void SnapshotWriter::write(raw_ostream &os) {
+  ctablegen::Stats::TraceScope scope("writeSnapshot");
+  uint32_t recordId = 0;
+  for (const auto &record : rk.getClasses())
+    recordIds[record.second.get()] = recordId++;
+  for (const auto &record : rk.getDefs())
+    recordIds[record.second.get()] = recordId++;
+
+  for (unsigned i = 1; i <= parser.sourceMgr.getNumBuffers(); i++) {
+    auto *buffer = parser.sourceMgr.getMemoryBuffer(i);
+    buffers.push_back(TableGenSnapshotBuffer{
+        addString(buffer->getBufferIdentifier()), buffer->getBufferSize(),
+        xxHash64(buffer->getBuffer())});
+  }
+
+  for (const auto &record : rk.getClasses())
+    addRecord(*record.second);
+  for (const auto &record : rk.getDefs())
+    addRecord(*record.second);
+
+  TableGenSnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+  header.version = TABLEGEN_SNAPSHOT_VERSION;
+  header.num_input_buffers = parser.getNumInputBuffers();
+  header.key = snapshotKey(parser);
+  header.num_classes = rk.getClasses().size();
+
+  uint64_t pos = sizeof(header);
+  pos = alignTo8(pos);
+  header.strings.offset = pos;
+  header.strings.count = strings.size();
+  pos += strings.size();
+  addSection(header.buffers, buffers, pos);
+  addSection(header.records, records, pos);
+  addSection(header.values, values, pos);
+  addSection(header.inits, inits, pos);
+  addSection(header.indices, indices, pos);
+  addSection(header.locations, locations, pos);
+
+  pos = 0;
+  writeSection(os, TableGenSnapshotSection{0, 1}, &header, pos);
+  writeSection(os, header.strings, strings.data(), pos);
+  writeSection(os, header.buffers, buffers.data(), pos);
+  writeSection(os, header.records, records.data(), pos);
+  writeSection(os, header.values, values.data(), pos);
+  writeSection(os, header.inits, inits.data(), pos);
+  writeSection(os, header.indices, indices.data(), pos);
+  writeSection(os, header.locations, locations.data(), pos);
+}
+
+template <typename T>
+bool sectionInBounds(const TableGenSnapshotSection &section, uint64_t size) {
+  return section.offset % alignof(T) == 0 && section.offset <= size &&
+         section.count <= (size - section.offset) / sizeof(T);
+}
+
+bool rangeInBounds(uint64_t first, uint64_t count, uint64_t size) {
+  return first <= size && count <= size - first;
+}
+
+/// Checks that every offset and index in the snapshot stays within its
+/// section, so consumers can read it without further bounds checks.
+bool snapshotInBounds(const MemoryBuffer &buffer) {
+  auto size = buffer.getBufferSize();
+  if (size < sizeof(TableGenSnapshotHeader))
+    return false;
+  auto *start = buffer.getBufferStart();
+  auto &header = *reinterpret_cast<const TableGenSnapshotHeader *>(start);
+  if (std::memcmp(header.magic, SnapshotMagic, sizeof(header.magic)) ||
+      header.version != TABLEGEN_SNAPSHOT_VERSION)
+    return false;
+
+  if (!sectionInBounds<char>(header.strings, size) ||
+      !sectionInBounds<TableGenSnapshotBuffer>(header.buffers, size) ||
+      !sectionInBounds<TableGenSnapshotRecord>(header.records, size) ||
+      !sectionInBounds<TableGenSnapshotValue>(header.values, size) ||
+      !sectionInBounds<TableGenSnapshotInit>(header.inits, size) ||
+      !sectionInBounds<uint32_t>(header.indices, size) ||
+      !sectionInBounds<TableGenSnapshotLocation>(header.locations, size) ||
+      header.num_classes > header.records.count ||
+      header.num_input_buffers > header.buffers.count)
+    return false;
+
+  auto validString = [&](TableGenSnapshotString str) {
+    return rangeInBounds(str.offset, str.len, header.strings.count);
+  };
+
+  auto *buffers = reinterpret_cast<const TableGenSnapshotBuffer *>(
+      start + header.buffers.offset);
+  for (uint64_t i = 0; i < header.buffers.count; i++)
+    if (!validString(buffers[i].identifier))
+      return false;
+
+  auto *indices =
+      reinterpret_cast<const uint32_t *>(start + header.indices.offset);
+  auto *records = reinterpret_cast<const TableGenSnapshotRecord *>(
+      start + header.records.offset);
+  for (uint64_t i = 0; i < header.records.count; i++) {
+    auto &record = records[i];
+    if (!validString(record.name) ||
+        !rangeInBounds(record.first_location, record.num_locations,
+                       header.locations.count) ||
+        !rangeInBounds(record.first_superclass, record.num_superclasses,
+                       header.indices.count) ||
+        !rangeInBounds(record.first_value, record.num_values,
+                       header.values.count))
+      return false;
+    for (uint32_t j = 0; j < record.num_superclasses; j++)
+      if (indices[record.first_superclass + j] >= header.records.count)
+        return false;
+  }
+
+  auto *values = reinterpret_cast<const TableGenSnapshotValue *>(
+      start + header.values.offset);
+  for (uint64_t i = 0; i < header.values.count; i++) {
+    auto &value = values[i];
+    if (!validString(value.name) || !validString(value.type) ||
+        value.init >= header.inits.count ||
+        value.location >= header.locations.count)
+      return false;
+  }
+
+  auto *inits = reinterpret_cast<const TableGenSnapshotInit *>(
+      start + header.inits.offset);
+  for (uint64_t i = 0; i < header.inits.count; i++) {
+    auto &init = inits[i];
+    switch (init.kind) {
+    case TableGenSnapshotUnsetInitKind:
+    case TableGenSnapshotBitInitKind:
+    case TableGenSnapshotIntInitKind:
+      break;
+    case TableGenSnapshotStringInitKind:
+    case TableGenSnapshotCodeInitKind:
+    case TableGenSnapshotUnresolvedInitKind:
+      if (!validString(init.string))
+        return false;
+      break;
+    case TableGenSnapshotDefInitKind:
+      if (init.value < 0 || uint64_t(init.value) >= header.records.count)
+        return false;
+      break;
+    case TableGenSnapshotBitsInitKind:
+    case TableGenSnapshotListInitKind:
+      if (!rangeInBounds(init.first, init.count, header.indices.count))
+        return false;
+      for (uint32_t j = 0; j < init.count; j++)
+        if (indices[init.first + j] >= header.inits.count)
+          return false;
+      break;
+    case TableGenSnapshotDagInitKind:
+      if (!validString(init.string) || init.value < 0 ||
+          uint64_t(init.value) >= header.inits.count ||
+          !rangeInBounds(init.first, uint64_t(init.count) * 3,
+                         header.indices.count))
+        return false;
+      for (uint32_t j = 0; j < init.count; j++) {
+        auto *arg = indices + init.first + 3 * j;
+        if (arg[0] >= header.inits.count ||
+            !validString(TableGenSnapshotString{arg[1], arg[2]}))
+          return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Checks that the snapshot was produced from the same inputs as the given
+/// parser, and that none of the included files changed since.
+bool snapshotUpToDate(const ctablegen::TableGenParser &parser,
+                      const MemoryBuffer &buffer) {
+  auto *start = buffer.getBufferStart();
+  auto &header = *reinterpret_cast<const TableGenSnapshotHeader *>(start);
+  if (header.num_input_buffers != parser.getNumInputBuffers() ||
+      header.key != snapshotKey(parser))
+    return false;
+
+  auto *buffers = reinterpret_cast<const TableGenSnapshotBuffer *>(
+      start + header.buffers.offset);
+  for (uint64_t i = header.num_input_buffers; i < header.buffers.count; i++) {
+    StringRef identifier(start + header.strings.offset +
+                             buffers[i].identifier.offset,
+                         buffers[i].identifier.len);
+    auto FileOrErr = MemoryBuffer::getFile(identifier, /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (FileOrErr.getError())
+      return false;
+    auto &file = *FileOrErr;
+    if (file->getBufferSize() != buffers[i].size ||
+        xxHash64(file->getBuffer()) != buffers[i].hash)
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+TableGenBool tableGenRecordKeeperSaveSnapshot(TableGenParserRef tg_ref,
+                                              TableGenRecordKeeperRef rk_ref,
+                                              TableGenStringRef path) {
+  TABLEGEN_COUNT_CALL();
+  std::string target(path.data, path.len);
+  std::string temporary = target + ".tmp";
+
+  std::error_code EC;
+  raw_fd_ostream os(temporary, EC, sys::fs::OF_None);
+  if (EC)
+    return false;
+
+  SnapshotWriter(*unwrap(tg_ref), *unwrap(rk_ref)).write(os);
+  os.close();
+  if (os.has_error()) {
+    os.clear_error();
+    sys::fs::remove(temporary);
+    return false;
+  }
+
+  // Rename into place so readers never observe a partially written file.
+  return !sys::fs::rename(temporary, target);
+}
+
+TableGenSnapshotRef tableGenLoadSnapshot(TableGenParserRef tg_ref,
+                                         TableGenStringRef path) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::Stats::TraceScope scope("loadSnapshot");
+  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
+      MemoryBuffer::getFile(StringRef(path.data, path.len), /*IsText=*/false,
+                            /*RequiresNullTerminator=*/false);
+
+  if (std::error_code EC = FileOrErr.getError()) {
+    return nullptr;
+  }
+
+  auto &buffer = *FileOrErr;
+  if (!snapshotInBounds(*buffer) || !snapshotUpToDate(*unwrap(tg_ref), *buffer))
+    return nullptr;
+  ctablegen::Stats::countAllocation(ctablegen::Stats::OtherAllocation);
+  return wrap(new ctablegen::Snapshot{std::move(buffer)});
+}
+
+TableGenBool tableGenRecordKeeperExport(TableGenParserRef tg_ref,
+                                        TableGenRecordKeeperRef rk_ref,
+                                        TableGenBuffer *buffer,
+                                        TableGenBufferReserveCallback reserve,
+                                        void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream os(buffer, reserve, userData);
+  SnapshotWriter(*unwrap(tg_ref), *unwrap(rk_ref)).write(os);
+  return os.succeeded();
+}
+
+void tableGenRecordKeeperExportStream(TableGenParserRef tg_ref,
+                                      TableGenRecordKeeperRef rk_ref,
+                                      TableGenStringCallback callback,
+                                      void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream os(callback, userData, /*bufferSize=*/1 << 16);
+  SnapshotWriter(*unwrap(tg_ref), *unwrap(rk_ref)).write(os);
+}
+
+TableGenSnapshotRef tableGenSnapshotFromBuffer(TableGenStringRef data) {
+  TABLEGEN_COUNT_CALL();
+  // The copy is aligned to at least 16 bytes, as required by the sections.
+  auto buffer = MemoryBuffer::getMemBufferCopy(StringRef(data.data, data.len));
+  if (!snapshotInBounds(*buffer))
+    return nullptr;
+  ctablegen::Stats::countAllocation(ctablegen::Stats::OtherAllocation);
+  return wrap(new ctablegen::Snapshot{std::move(buffer)});
+}
+
+const TableGenSnapshotHeader *
+tableGenSnapshotGetHeader(TableGenSnapshotRef snapshot_ref) {
+  TABLEGEN_COUNT_CALL();
+  return reinterpret_cast<const TableGenSnapshotHeader *>(
+      unwrap(snapshot_ref)->buffer->getBufferStart());
+}
+
+void tableGenSnapshotFree(TableGenSnapshotRef snapshot_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(snapshot_ref);
+}
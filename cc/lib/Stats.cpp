@@ -0,0 +1,181 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+#include <chrono>
+
+#include "TableGen.h"
+#include "TableGen.hpp"
+#include "Types.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Process.h"
+
+using ctablegen::Stats;
+
+std::atomic<bool> Stats::counters{false};
+std::atomic<bool> Stats::trace{false};
+std::atomic<uint64_t> Stats::allocations[NumAllocationKinds];
+std::atomic<Stats::CallCounter *> Stats::callCounters{nullptr};
+std::mutex Stats::traceMutex;
+std::vector<Stats::TraceEvent> Stats::traceEvents;
+uint64_t Stats::droppedTraceEvents = 0;
+
+void Stats::CallCounter::countSlow() {
+  calls.fetch_add(1, std::memory_order_relaxed);
+  if (registered.load(std::memory_order_relaxed) ||
+      registered.exchange(true, std::memory_order_relaxed))
+    return;
+  next = callCounters.load(std::memory_order_relaxed);
+  while (!callCounters.compare_exchange_weak(next, this,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed))
+    ;
+}
+
+int64_t Stats::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// Returns a small number identifying the current thread in trace events.
+static unsigned currentThread() {
+  static std::atomic<unsigned> nextThread{1};
+  thread_local unsigned thread =
+      nextThread.fetch_add(1, std::memory_order_relaxed);
+  return thread;
+}
+
+Stats::TraceScope::TraceScope(const char *name, uint64_t *totalNanos,
+                              StringRef detail)
+    : name(name), totalNanos(totalNanos), traced(traceEnabled()) {
+  if (traced)
+    this->detail = std::string(detail);
+  if (traced || totalNanos)
+    start = now();
+}
+
+Stats::TraceScope::~TraceScope() {
+  if (!traced && !totalNanos)
+    return;
+  int64_t duration = now() - start;
+  if (totalNanos)
+    *totalNanos += duration;
+  if (!traced)
+    return;
+  std::lock_guard<std::mutex> guard(traceMutex);
+  if (traceEvents.size() >= maxTraceEvents) {
+    droppedTraceEvents++;
+    return;
+  }
+  traceEvents.push_back(
+      TraceEvent{name, std::move(detail), start, duration, currentThread()});
+}
+
+void Stats::setEnabled(bool enableCounters, bool enableTrace) {
+  counters.store(enableCounters, std::memory_order_relaxed);
+  trace.store(enableTrace, std::memory_order_relaxed);
+}
+
+void Stats::forEachCallCount(TableGenCallCountCallback callback,
+                             void *userData) {
+  for (auto *counter = callCounters.load(std::memory_order_acquire); counter;
+       counter = counter->next) {
+    uint64_t calls = counter->calls.load(std::memory_order_relaxed);
+    if (calls)
+      callback(TableGenStringRef{.data = counter->name,
+                                 .len = std::strlen(counter->name)},
+               calls, userData);
+  }
+}
+
+void Stats::writeTrace(raw_ostream &os) {
+  std::lock_guard<std::mutex> guard(traceMutex);
+  int64_t pid = sys::Process::getProcessId();
+  json::OStream json(os);
+  json.object([&] {
+    json.attributeArray("traceEvents", [&] {
+      for (const auto &event : traceEvents) {
+        json.object([&] {
+          json.attribute("name", event.name);
+          json.attribute("cat", "tablegen");
+          json.attribute("ph", "X");
+          // Timestamps are in microseconds.
+          json.attribute("ts", event.start / 1000.0);
+          json.attribute("dur", event.duration / 1000.0);
+          json.attribute("pid", pid);
+          json.attribute("tid", int64_t(event.thread));
+          if (!event.detail.empty())
+            json.attributeObject(
+                "args", [&] { json.attribute("detail", event.detail); });
+        });
+      }
+    });
+    json.attribute("displayTimeUnit", "ns");
+    if (droppedTraceEvents)
+      json.attributeObject("otherData", [&] {
+        json.attribute("droppedEvents", int64_t(droppedTraceEvents));
+      });
+  });
+}
+
+void Stats::reset() {
+  for (auto &count : allocations)
+    count.store(0, std::memory_order_relaxed);
+  for (auto *counter = callCounters.load(std::memory_order_acquire); counter;
+       counter = counter->next)
+    counter->calls.store(0, std::memory_order_relaxed);
+  std::lock_guard<std::mutex> guard(traceMutex);
+  traceEvents.clear();
+  droppedTraceEvents = 0;
+}
+
+void tableGenStatsSetEnabled(TableGenBool counters, TableGenBool trace) {
+  Stats::setEnabled(counters, trace);
+}
+
+void tableGenStatsGet(TableGenParserRef tg_ref, TableGenStats *stats) {
+  *stats = TableGenStats{};
+  stats->num_iterator_allocations =
+      Stats::getAllocations(Stats::IteratorAllocation);
+  stats->num_vector_allocations =
+      Stats::getAllocations(Stats::VectorAllocation);
+  stats->num_location_allocations =
+      Stats::getAllocations(Stats::LocationAllocation);
+  stats->num_string_allocations =
+      Stats::getAllocations(Stats::StringAllocation);
+  stats->num_other_allocations = Stats::getAllocations(Stats::OtherAllocation);
+  if (!tg_ref)
+    return;
+
+  auto *parser = unwrap(tg_ref);
+  const auto &parseStats = parser->getParseStats();
+  stats->read_ns = parseStats.readNanos;
+  stats->parse_ns = parseStats.parseNanos;
+  stats->num_parses = parseStats.numParses;
+  stats->num_classes = parseStats.numClasses;
+  stats->num_defs = parseStats.numDefs;
+  stats->num_values = parseStats.numValues;
+  stats->num_buffers = parser->sourceMgr.getNumBuffers();
+  for (unsigned i = 1; i <= parser->sourceMgr.getNumBuffers(); i++)
+    stats->num_source_bytes +=
+        parser->sourceMgr.getMemoryBuffer(i)->getBufferSize();
+}
+
+void tableGenStatsGetCallCounts(TableGenCallCountCallback callback,
+                                void *userData) {
+  Stats::forEachCallCount(callback, userData);
+}
+
+void tableGenStatsWriteTrace(TableGenStringCallback callback,
+                             void *userData) {
+  ctablegen::CallbackOstream os(callback, userData, 64 * 1024);
+  Stats::writeTrace(os);
+}
+
+void tableGenStatsReset() { Stats::reset(); }
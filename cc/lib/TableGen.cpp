@@ -12,26 +12,70 @@
 #include "TableGen.h"
 #include "Types.h"
 #include <cstring>
+#include <mutex>
+
+#include <llvm/Support/xxhash.h>
 
 using ctablegen::RecordMap;
+using ctablegen::Stats;
 using ctablegen::tableGenFromRecType;
 
-RecordKeeper *ctablegen::TableGenParser::parse() {
-  auto recordKeeper = new RecordKeeper;
+// `TableGenParseFile` temporarily moves the parser's buffers into LLVM's
+// global `SrcMgr`, so only one parse can be in flight per process.
+static std::mutex parseMutex;
+
+ctablegen::TableGenRecordKeeper *ctablegen::TableGenParser::parse() {
+  std::lock_guard<std::mutex> guard(parseMutex);
+  return parseLocked();
+}
+
+ctablegen::TableGenRecordKeeper *ctablegen::TableGenParser::parseLocked() {
+  // The sources were replaced by empty buffers.
+  if (hasDroppedSources)
+    return nullptr;
+  Stats::TraceScope scope("parse", &parseStats.parseNanos);
+  parseStats.numParses++;
+  Stats::countAllocation(Stats::OtherAllocation);
+  auto recordKeeper = new TableGenRecordKeeper;
   sourceMgr.setIncludeDirs(includeDirs);
   bool result = TableGenParseFile(sourceMgr, *recordKeeper);
   if (!result) {
+    countRecords(*recordKeeper);
     return recordKeeper;
   }
   delete recordKeeper;
   return nullptr;
 }
 
+void ctablegen::TableGenParser::countRecords(const RecordKeeper &keeper) {
+  parseStats.numClasses = keeper.getClasses().size();
+  parseStats.numDefs = keeper.getDefs().size();
+  parseStats.numValues = 0;
+  for (const auto &cls : keeper.getClasses())
+    parseStats.numValues += cls.second->getValues().size();
+  for (const auto &def : keeper.getDefs())
+    parseStats.numValues += def.second->getValues().size();
+}
+
+bool ctablegen::TableGenParser::parseBatch(TableGenParser **parsers,
+                                           size_t count,
+                                           TableGenRecordKeeper **keepers) {
+  Stats::TraceScope scope("parseBatch");
+  std::lock_guard<std::mutex> guard(parseMutex);
+  bool success = true;
+  for (size_t i = 0; i < count; i++) {
+    keepers[i] = parsers[i]->parseLocked();
+    success &= keepers[i] != nullptr;
+  }
+  return success;
+}
+
 void ctablegen::TableGenParser::addIncludePath(const StringRef include) {
   includeDirs.push_back(std::string(include));
 }
 
 bool ctablegen::TableGenParser::addSource(const char *source) {
+  Stats::TraceScope scope("addSource", &parseStats.readNanos);
   ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
       MemoryBuffer::getMemBuffer(source);
 
@@ -40,10 +84,71 @@ bool ctablegen::TableGenParser::addSource(const char *source) {
   }
 
   sourceMgr.AddNewSourceBuffer(std::move(*FileOrErr), SMLoc());
+  inputFiles.emplace_back();
+  return true;
+}
+
+bool ctablegen::TableGenParser::addSource(StringRef source) {
+  Stats::TraceScope scope("addSource", &parseStats.readNanos);
+  // The lexer relies on a terminating NUL, so the source has to be copied.
+  sourceMgr.AddNewSourceBuffer(MemoryBuffer::getMemBufferCopy(source),
+                               SMLoc());
+  inputFiles.emplace_back();
+  return true;
+}
+
+std::mutex ctablegen::SharedBufferCache::mutex;
+StringMap<ctablegen::SharedBufferCache::Entry>
+    ctablegen::SharedBufferCache::entries;
+
+std::shared_ptr<const MemoryBuffer>
+ctablegen::SharedBufferCache::get(StringRef path) {
+  sys::fs::file_status status;
+  if (sys::fs::status(path, status))
+    return nullptr;
+
+  std::lock_guard<std::mutex> guard(mutex);
+  auto it = entries.find(path);
+  if (it != entries.end()) {
+    if (auto buffer = it->second.buffer.lock()) {
+      if (it->second.modificationTime == status.getLastModificationTime() &&
+          it->second.size == status.getSize())
+        return buffer;
+    }
+  }
+
+  auto FileOrErr = MemoryBuffer::getFile(path);
+  if (FileOrErr.getError())
+    return nullptr;
+  std::shared_ptr<const MemoryBuffer> buffer = std::move(*FileOrErr);
+  // Drop the entries of files that no parser holds on to anymore, so that
+  // the cache only grows with the number of files in use.
+  for (auto entryIt = entries.begin(); entryIt != entries.end();) {
+    auto current = entryIt++;
+    if (current->second.buffer.expired())
+      entries.erase(current);
+  }
+  entries[path] =
+      Entry{buffer, status.getLastModificationTime(), status.getSize()};
+  return buffer;
+}
+
+bool ctablegen::TableGenParser::addSharedSourceFile(const StringRef source) {
+  Stats::TraceScope scope("addSharedSourceFile", &parseStats.readNanos,
+                          source);
+  auto buffer = SharedBufferCache::get(source);
+  if (!buffer)
+    return false;
+
+  sourceMgr.AddNewSourceBuffer(
+      MemoryBuffer::getMemBuffer(buffer->getMemBufferRef()), SMLoc());
+  sharedBuffers.push_back(std::move(buffer));
+  inputFiles.push_back(std::string(source));
   return true;
 }
 
 bool ctablegen::TableGenParser::addSourceFile(const StringRef source) {
+  Stats::TraceScope scope("addSourceFile", &parseStats.readNanos, source);
   ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
       MemoryBuffer::getFile(source);
 
@@ -52,35 +157,142 @@ bool ctablegen::TableGenParser::addSourceFile(const StringRef source) {
   }
 
   sourceMgr.AddNewSourceBuffer(std::move(*FileOrErr), SMLoc());
+  inputFiles.push_back(std::string(source));
   return true;
 }
 
+bool ctablegen::TableGenParser::sourcesChanged() const {
+  Stats::TraceScope scope("sourcesChanged");
+  for (unsigned i = 1; i <= sourceMgr.getNumBuffers(); i++) {
+    if (i <= inputFiles.size() && inputFiles[i - 1].empty())
+      continue;
+    auto *buffer = sourceMgr.getMemoryBuffer(i);
+    auto FileOrErr = MemoryBuffer::getFile(buffer->getBufferIdentifier(),
+                                           /*IsText=*/false,
+                                           /*RequiresNullTerminator=*/false);
+    if (FileOrErr.getError())
+      return true;
+    StringRef contents = (*FileOrErr)->getBuffer();
+    if (hasDroppedSources ? contents.size() != droppedBuffers[i - 1].size ||
+                                xxHash64(contents) != droppedBuffers[i - 1].hash
+                          : contents != buffer->getBuffer())
+      return true;
+  }
+  return false;
+}
+
+ctablegen::TableGenParser *ctablegen::TableGenParser::reload() const {
+  auto parser = std::make_unique<TableGenParser>();
+  parser->includeDirs = includeDirs;
+  for (unsigned i = 0; i < inputFiles.size(); i++) {
+    if (!inputFiles[i].empty()) {
+      if (!parser->addSourceFile(inputFiles[i]))
+        return nullptr;
+      continue;
+    }
+    if (hasDroppedSources)
+      return nullptr;
+    auto *buffer = sourceMgr.getMemoryBuffer(i + 1);
+    parser->sourceMgr.AddNewSourceBuffer(
+        MemoryBuffer::getMemBufferCopy(buffer->getBuffer(),
+                                       buffer->getBufferIdentifier()),
+        SMLoc());
+    parser->inputFiles.emplace_back();
+  }
+  return parser.release();
+}
+
+void ctablegen::TableGenParser::dropSources() {
+  Stats::TraceScope scope("dropSources");
+  std::lock_guard<std::mutex> guard(sourceMgrMutex);
+  if (hasDroppedSources)
+    return;
+  // Buffer ids and names are kept, so that inputs and included files can
+  // still be told apart. Include locations point into the dropped buffers
+  // and are reset.
+  SourceMgr empty;
+  empty.setIncludeDirs(includeDirs);
+  empty.setDiagHandler(sourceMgr.getDiagHandler(), sourceMgr.getDiagContext());
+  for (unsigned i = 1; i <= sourceMgr.getNumBuffers(); i++) {
+    auto *buffer = sourceMgr.getMemoryBuffer(i);
+    droppedBuffers.push_back(
+        DroppedBuffer{buffer->getBufferSize(), xxHash64(buffer->getBuffer())});
+    empty.AddNewSourceBuffer(
+        MemoryBuffer::getMemBuffer("", buffer->getBufferIdentifier()),
+        SMLoc());
+  }
+  sourceMgr = std::move(empty);
+  sharedBuffers.clear();
+  hasDroppedSources = true;
+}
+
 TableGenParserRef tableGenGet() {
+  TABLEGEN_COUNT_CALL();
+  Stats::countAllocation(Stats::OtherAllocation);
   return wrap(new ctablegen::TableGenParser());
 }
 
-void tableGenFree(TableGenParserRef tg_ref) { delete unwrap(tg_ref); }
+void tableGenFree(TableGenParserRef tg_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(tg_ref);
+}
 
 TableGenBool tableGenAddSourceFile(TableGenParserRef tg_ref,
                                    TableGenStringRef source) {
+  TABLEGEN_COUNT_CALL();
   return unwrap(tg_ref)->addSourceFile(StringRef(source.data, source.len));
 }
 
 TableGenBool tableGenAddSource(TableGenParserRef tg_ref, const char *source) {
+  TABLEGEN_COUNT_CALL();
   return unwrap(tg_ref)->addSource(source);
 }
 
+TableGenBool tableGenAddSourceRef(TableGenParserRef tg_ref,
+                                  TableGenStringRef source) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(tg_ref)->addSource(StringRef(source.data, source.len));
+}
+
+TableGenBool tableGenAddSharedSourceFile(TableGenParserRef tg_ref,
+                                         TableGenStringRef source) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(tg_ref)->addSharedSourceFile(
+      StringRef(source.data, source.len));
+}
+
 void tableGenAddIncludePath(TableGenParserRef tg_ref,
                             TableGenStringRef include) {
+  TABLEGEN_COUNT_CALL();
   return unwrap(tg_ref)->addIncludePath(StringRef(include.data, include.len));
 }
 
+TableGenBool tableGenSourcesChanged(TableGenParserRef tg_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(tg_ref)->sourcesChanged();
+}
+
+TableGenParserRef tableGenReload(TableGenParserRef tg_ref) {
+  TABLEGEN_COUNT_CALL();
+  return wrap(unwrap(tg_ref)->reload());
+}
+
 TableGenRecordKeeperRef tableGenParse(TableGenParserRef tg_ref) {
+  TABLEGEN_COUNT_CALL();
   return wrap(unwrap(tg_ref)->parse());
 }
 
+TableGenBool tableGenParseBatch(TableGenParserRef *tg_refs, size_t count,
+                                TableGenRecordKeeperRef *rk_refs) {
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::TableGenParser::parseBatch(
+      reinterpret_cast<ctablegen::TableGenParser **>(tg_refs), count,
+      reinterpret_cast<ctablegen::TableGenRecordKeeper **>(rk_refs));
+}
+
 // LLVM ListType
 TableGenRecTyKind tableGenListRecordGetType(TableGenRecordValRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   if (!rv_ref)
     return TableGenInvalidRecTyKind;
   auto rv = unwrap(rv_ref);
@@ -94,6 +306,7 @@ TableGenRecTyKind tableGenListRecordGetType(TableGenRecordValRef rv_ref) {
 }
 
 size_t tableGenListRecordNumElements(TableGenTypedInitRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   auto list = dyn_cast<ListInit>(unwrap(rv_ref));
   if (!list)
     return 0;
@@ -102,6 +315,7 @@ size_t tableGenListRecordNumElements(TableGenTypedInitRef rv_ref) {
 
 TableGenTypedInitRef tableGenListRecordGet(TableGenTypedInitRef rv_ref,
                                            size_t index) {
+  TABLEGEN_COUNT_CALL();
   auto list = dyn_cast<ListInit>(unwrap(rv_ref));
   if (!list)
     return nullptr;
@@ -116,6 +330,7 @@ TableGenTypedInitRef tableGenListRecordGet(TableGenTypedInitRef rv_ref,
 // LLVM DagType
 TableGenTypedInitRef tableGenDagRecordGet(TableGenTypedInitRef rv_ref,
                                           size_t index) {
+  TABLEGEN_COUNT_CALL();
   auto dag = dyn_cast<DagInit>(unwrap(rv_ref));
   if (!dag)
     return nullptr;
@@ -128,6 +343,7 @@ TableGenTypedInitRef tableGenDagRecordGet(TableGenTypedInitRef rv_ref,
 }
 
 size_t tableGenDagRecordNumArgs(TableGenTypedInitRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   auto dag = dyn_cast<DagInit>(unwrap(rv_ref));
   if (!dag)
     return 0;
@@ -135,6 +351,7 @@ size_t tableGenDagRecordNumArgs(TableGenTypedInitRef rv_ref) {
 }
 
 TableGenRecordRef tableGenDagRecordOperator(TableGenTypedInitRef rv_ref) {
+  TABLEGEN_COUNT_CALL();
   auto dag = dyn_cast<DagInit>(unwrap(rv_ref));
   if (!dag)
     return 0;
@@ -143,6 +360,7 @@ TableGenRecordRef tableGenDagRecordOperator(TableGenTypedInitRef rv_ref) {
 
 TableGenStringRef tableGenDagRecordArgName(TableGenTypedInitRef rv_ref,
                                            size_t index) {
+  TABLEGEN_COUNT_CALL();
   auto dag = dyn_cast<DagInit>(unwrap(rv_ref));
   if (!dag)
     return TableGenStringRef{.data = nullptr, .len = 0};
@@ -152,9 +370,106 @@ TableGenStringRef tableGenDagRecordArgName(TableGenTypedInitRef rv_ref,
   return TableGenStringRef{.data = s.data(), .len = s.size()};
 }
 
+size_t tableGenListRecordGetElements(TableGenTypedInitRef rv_ref,
+                                     TableGenTypedInitRef *elements,
+                                     TableGenRecTyKind *kinds, size_t len) {
+  TABLEGEN_COUNT_CALL();
+  auto list = dyn_cast<ListInit>(unwrap(rv_ref));
+  if (!list)
+    return 0;
+  size_t count = std::min(len, size_t(list->size()));
+  for (size_t i = 0; i < count; i++) {
+    auto elem = list->getElement(i);
+    if (elements)
+      elements[i] = wrap(dyn_cast<TypedInit>(elem));
+    if (kinds)
+      kinds[i] = ctablegen::tableGenInitKind(elem);
+  }
+  return list->size();
+}
+
+size_t tableGenDagRecordGetArgs(TableGenTypedInitRef rv_ref,
+                                TableGenTypedInitRef *args,
+                                TableGenStringRef *names,
+                                TableGenRecTyKind *kinds, size_t len) {
+  TABLEGEN_COUNT_CALL();
+  auto dag = dyn_cast<DagInit>(unwrap(rv_ref));
+  if (!dag)
+    return 0;
+  size_t count = std::min(len, size_t(dag->getNumArgs()));
+  for (size_t i = 0; i < count; i++) {
+    auto arg = dag->getArg(i);
+    if (args)
+      args[i] = wrap(dyn_cast<TypedInit>(arg));
+    if (names) {
+      auto name = dag->getArgNameStr(i);
+      names[i] = TableGenStringRef{.data = name.data(), .len = name.size()};
+    }
+    if (kinds)
+      kinds[i] = ctablegen::tableGenInitKind(arg);
+  }
+  return dag->getNumArgs();
+}
+
+static void flattenInit(Init *init, StringRef name, uint32_t parent,
+                        std::vector<TableGenInitNode> &nodes) {
+  uint32_t index = nodes.size();
+  nodes.push_back(TableGenInitNode{
+      .init = wrap(dyn_cast<TypedInit>(init)),
+      .kind = ctablegen::tableGenInitKind(init),
+      .record = nullptr,
+      .name = TableGenStringRef{.data = name.data(), .len = name.size()},
+      .parent = parent,
+      .num_children = 0,
+      .end = 0});
+
+  if (auto dag = dyn_cast<DagInit>(init)) {
+    if (auto op = dyn_cast<DefInit>(dag->getOperator()))
+      nodes[index].record = wrap(op->getDef());
+    nodes[index].num_children = dag->getNumArgs();
+    for (unsigned i = 0; i < dag->getNumArgs(); i++)
+      flattenInit(dag->getArg(i), dag->getArgNameStr(i), index, nodes);
+  } else if (auto list = dyn_cast<ListInit>(init)) {
+    nodes[index].num_children = list->size();
+    for (auto *elem : *list)
+      flattenInit(elem, StringRef(), index, nodes);
+  } else if (auto def = dyn_cast<DefInit>(init)) {
+    nodes[index].record = wrap(def->getDef());
+  }
+  nodes[index].end = nodes.size();
+}
+
+TableGenInitNode *tableGenInitFlatten(TableGenTypedInitRef ti, size_t *len) {
+  TABLEGEN_COUNT_CALL();
+  if (!ti)
+    return nullptr;
+  std::vector<TableGenInitNode> nodes;
+  flattenInit(unwrap(ti), StringRef(), UINT32_MAX, nodes);
+
+  *len = nodes.size();
+  Stats::countAllocation(Stats::VectorAllocation);
+  auto result = new TableGenInitNode[nodes.size()];
+  std::copy(nodes.begin(), nodes.end(), result);
+  return result;
+}
+
 // Memory
-void tableGenBitArrayFree(int8_t bit_array[]) { delete[] bit_array; }
+void tableGenBitArrayFree(int8_t bit_array[]) {
+  TABLEGEN_COUNT_CALL();
+  delete[] bit_array;
+}
 
-void tableGenStringFree(const char *str) { delete str; }
+void tableGenStringFree(const char *str) {
+  TABLEGEN_COUNT_CALL();
+  delete[] str;
+}
+
+void tableGenInitNodeArrayFree(TableGenInitNode *nodes) {
+  TABLEGEN_COUNT_CALL();
+  delete[] nodes;
+}
 
-void tableGenStringArrayFree(const char **str_array) { delete str_array; }
+void tableGenStringArrayFree(const char **str_array) {
+  TABLEGEN_COUNT_CALL();
+  delete[] str_array;
+}
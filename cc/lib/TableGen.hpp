@@ -11,7 +11,13 @@
 #ifndef _CTABLEGEN_TABLEGEN_HPP_
 #define _CTABLEGEN_TABLEGEN_HPP_
 
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
 #include <utility>
 
 #include <llvm/Support/CommandLine.h>
@@ -34,30 +40,685 @@ typedef std::map<std::string, std::unique_ptr<Record>, std::less<>> RecordMap;
 typedef std::vector<Record *> RecordVector;
 typedef std::pair<std::string, TypedInit *> DagPair;
 
+/// Process-wide counters and trace events of the C API, see
+/// `tableGenStatsSetEnabled`.
+///
+/// Both are disabled by default, in which case every instrumented entry point
+/// only pays for a relaxed atomic load: call counters are constant-initialized,
+/// so their function-local statics need no initialization guard.
+class Stats {
+public:
+  enum AllocationKind {
+    IteratorAllocation,
+    VectorAllocation,
+    LocationAllocation,
+    StringAllocation,
+    OtherAllocation,
+    NumAllocationKinds
+  };
+
+  /// Counts the calls of a single entry point, see `TABLEGEN_COUNT_CALL`.
+  ///
+  /// Counters are registered on the first call of their entry point while
+  /// counters are enabled, and live until the process exits.
+  class CallCounter {
+  public:
+    constexpr explicit CallCounter(const char *name) : name(name) {}
+    void count() {
+      if (countersEnabled())
+        countSlow();
+    }
+
+  private:
+    friend class Stats;
+    void countSlow();
+
+    const char *name;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<bool> registered{false};
+    CallCounter *next = nullptr;
+  };
+
+  /// Adds a trace event covering the lifetime of the scope if tracing is
+  /// enabled, and adds its duration to `totalNanos` if that is not null.
+  class TraceScope {
+  public:
+    TraceScope(const char *name, uint64_t *totalNanos = nullptr,
+               StringRef detail = StringRef());
+    ~TraceScope();
+
+  private:
+    const char *name;
+    uint64_t *totalNanos;
+    std::string detail;
+    bool traced;
+    int64_t start = 0;
+  };
+
+  static bool countersEnabled() {
+    return counters.load(std::memory_order_relaxed);
+  }
+  static bool traceEnabled() { return trace.load(std::memory_order_relaxed); }
+  static void setEnabled(bool counters, bool trace);
+
+  static void countAllocation(AllocationKind kind) {
+    if (countersEnabled())
+      allocations[kind].fetch_add(1, std::memory_order_relaxed);
+  }
+  static uint64_t getAllocations(AllocationKind kind) {
+    return allocations[kind].load(std::memory_order_relaxed);
+  }
+
+  /// Calls `callback` with the name and call count of every entry point
+  /// that was called at least once since the last reset.
+  static void forEachCallCount(TableGenCallCountCallback callback,
+                               void *userData);
+  /// Writes all trace events as Chrome trace event JSON. Events beyond
+  /// `maxTraceEvents` are counted as `droppedEvents` in `otherData`.
+  static void writeTrace(raw_ostream &os);
+  /// Clears all counters and trace events.
+  static void reset();
+
+  /// Nanoseconds since an arbitrary, fixed point in time.
+  static int64_t now();
+
+private:
+  struct TraceEvent {
+    const char *name;
+    std::string detail;
+    int64_t start;
+    int64_t duration;
+    unsigned thread;
+  };
+
+  /// Tracing stops recording events after this many, so that a trace left
+  /// enabled does not grow without bound.
+  static constexpr size_t maxTraceEvents = 1 << 20;
+
+  static std::atomic<bool> counters;
+  static std::atomic<bool> trace;
+  static std::atomic<uint64_t> allocations[NumAllocationKinds];
+  static std::atomic<CallCounter *> callCounters;
+  static std::mutex traceMutex;
+  static std::vector<TraceEvent> traceEvents;
+  static uint64_t droppedTraceEvents;
+};
+
+/// Counts a call of the enclosing C API entry point while counters are
+/// enabled.
+#define TABLEGEN_COUNT_CALL()                                                  \
+  static ctablegen::Stats::CallCounter callCounter(__func__);                  \
+  callCounter.count()
+
+/// Computes structural hashes of records, see `tableGenRecordHash`.
+///
+/// Inits and types are uniqued and shared by many records, so their hashes
+/// are memoized along with the hashes of records. A hasher must only be used
+/// from one thread at a time.
+class RecordHasher {
+public:
+  uint64_t hashRecord(const Record *record);
+  /// Hashes the name, template arguments and superclasses of a record.
+  uint64_t hashHeader(const Record *record);
+  /// Hashes the name, type and value of a field.
+  uint64_t hashField(const RecordVal &value);
+
+  /// Returns the bytes held by the caches of computed hashes.
+  size_t getMemorySize() const;
+
+private:
+  uint64_t hashInit(const Init *init);
+  uint64_t hashType(const RecTy *type);
+
+  DenseMap<const Record *, uint64_t> recordHashes;
+  DenseMap<const Init *, uint64_t> initHashes;
+  DenseMap<const RecTy *, uint64_t> typeHashes;
+  /// Anonymous records being hashed, to break reference cycles.
+  SmallVector<const Record *, 4> hashingRecords;
+};
+
+/// The RecordKeeper created by `TableGenParser::parse`, extended with lazily
+/// built indices over its records.
+///
+/// Once parsing is done the keeper is never modified, so every index is built
+/// at most once and then only read.
+class TableGenRecordKeeper : public RecordKeeper {
+public:
+  /// Returns the keeper that owns the given record.
+  static TableGenRecordKeeper &of(const Record &record) {
+    return static_cast<TableGenRecordKeeper &>(record.getRecords());
+  }
+
+  /// Returns all defs that derive from the given class, in the same order as
+  /// `getDefs()`. The result stays valid as long as the keeper.
+  ArrayRef<Record *> getDerivedDefinitions(const Record *cls);
+
+  /// Returns all defs that derive from every one of the given classes.
+  RecordVector getDerivedDefinitions(ArrayRef<const Record *> classes);
+
+  /// Returns the id of the field with the given name, or 0 if no record has
+  /// such a field.
+  unsigned getFieldId(StringRef name);
+
+  /// Returns the name of the field with the given id.
+  StringRef getFieldName(unsigned id);
+
+  /// Equivalent to `record->getValue(getFieldName(id))`, without comparing
+  /// any strings.
+  const RecordVal *getValue(const Record *record, unsigned id);
+
+  /// Returns the id of the class with the given name, or 0 if there is no
+  /// such class.
+  unsigned getClassId(StringRef name);
+
+  /// Equivalent to `record->isSubClassOf(cls)` for the class with the given
+  /// id, with a single bit test.
+  bool isSubClassOf(const Record *record, unsigned classId);
+
+  /// Sets `result[i]` (if `result` is not null) to whether `records[i]`
+  /// derives from all of the given classes, and returns the number of such
+  /// records.
+  size_t areSubClassesOf(ArrayRef<const Record *> records,
+                         ArrayRef<unsigned> classIds, uint8_t *result);
+
+  /// Returns the id of a class or def, or 0 if it does not belong to this
+  /// keeper. Classes are numbered from 1 in the order of `getClasses()`,
+  /// followed by the defs in the order of `getDefs()`, so the record id of a
+  /// class is its class id.
+  unsigned getRecordId(const Record *record);
+
+  /// Returns all classes and defs indexed by record id, with nullptr at 0.
+  ArrayRef<Record *> getRecordTable();
+
+  /// Returns the names of all classes and defs indexed by record id.
+  ArrayRef<StringRef> getRecordNames();
+
+  /// Returns the names of all fields indexed by field id.
+  ArrayRef<StringRef> getFieldNames();
+
+  /// Returns the class with the given id, or nullptr.
+  Record *getClassById(unsigned classId);
+
+  /// Returns a structural hash of a record of this keeper, see
+  /// `tableGenRecordHash`.
+  uint64_t getHash(const Record *record);
+
+  /// Returns a structural hash of all classes and defs, see
+  /// `tableGenRecordKeeperHash`.
+  uint64_t getHash();
+
+  /// Returns `init` with the references to fields and template arguments of
+  /// `record` resolved and operators folded, see
+  /// `tableGenRecordGetResolvedValue`. Results are cached per record and
+  /// init.
+  Init *resolve(const Record *record, Init *init);
+
+  /// If set, freeing the keeper through the C API does nothing, leaving its
+  /// memory to be reclaimed when the process exits.
+  bool leaksOnFree() const { return leakOnFree; }
+  void setLeakOnFree(bool leak) { leakOnFree = leak; }
+
+  /// Adds the estimated memory held by this keeper to `usage`, see
+  /// `tableGenRecordKeeperMemoryUsage`.
+  void addMemoryUsage(TableGenMemoryUsage &usage);
+
+  /// Drops the caches of `resolve` and `getHash`, see
+  /// `TableGenCompactCaches`.
+  void dropCaches();
+
+private:
+  void buildDerivedDefinitions();
+  void buildFieldIndex();
+  void buildClassIndex();
+  void buildRecordIndex();
+  /// Returns the superclass bitset of the record, or nullptr if it does not
+  /// belong to this keeper.
+  const uint64_t *getSuperClassBits(const Record *record);
+  void addFieldEntries(const Record *record);
+
+  bool leakOnFree = false;
+
+  /// Indices that are fully built, so that `addMemoryUsage` only reads
+  /// indices that are no longer written to.
+  enum IndexKind : unsigned {
+    ClassIndex = 1 << 0,
+    RecordIndex = 1 << 1,
+    DerivedDefsIndex = 1 << 2,
+    FieldIndex = 1 << 3,
+  };
+  std::atomic<unsigned> builtIndices{0};
+
+  std::mutex hashMutex;
+  RecordHasher hasher;
+  std::optional<uint64_t> keeperHash;
+
+  std::mutex resolveMutex;
+  DenseMap<std::pair<const Record *, Init *>, Init *> resolvedInits;
+
+  /// Classes are numbered from 1 in the order of `getClasses()`, and every
+  /// class and def has a bitset of `classWords` words in `superClassBits`
+  /// with bit `id` set for each of its superclasses.
+  std::once_flag classIndexFlag;
+  DenseMap<const Record *, unsigned> classIds;
+  size_t classWords = 0;
+  std::vector<uint64_t> superClassBits;
+  DenseMap<const Record *, unsigned> superClassOffsets;
+
+  /// Record ids index `recordTable` and `recordNames`, with an empty entry
+  /// for id 0.
+  std::once_flag recordIndexFlag;
+  std::vector<Record *> recordTable;
+  std::vector<StringRef> recordNames;
+  DenseMap<const Record *, unsigned> recordIds;
+
+  /// The derived defs of every class are stored back to back in
+  /// `derivedDefRecords`, so the index consists of a few large allocations.
+  std::once_flag derivedDefsFlag;
+  std::vector<Record *> derivedDefRecords;
+  DenseMap<const Record *, std::pair<unsigned, unsigned>> derivedDefRanges;
+  DenseMap<const Record *, unsigned> defIndices;
+
+  /// Field ids of a record, sorted by id, with their index in `getValues()`.
+  struct FieldEntry {
+    unsigned id;
+    unsigned index;
+  };
+
+  std::once_flag fieldIndexFlag;
+  StringMap<unsigned> fieldIds;
+  std::vector<StringRef> fieldNames;
+  std::vector<FieldEntry> fieldEntries;
+  DenseMap<const Record *, std::pair<unsigned, unsigned>> fieldRanges;
+};
+
 class TableGenParser {
 public:
   TableGenParser() {}
   bool addSource(const char *source);
+  bool addSource(StringRef source);
   bool addSourceFile(const StringRef source);
+  /// Same as `addSourceFile`, but shares the file contents with every other
+  /// parser that adds the same unchanged file, see `SharedBufferCache`.
+  bool addSharedSourceFile(const StringRef source);
   void addIncludePath(const StringRef include);
-  RecordKeeper *parse();
+  TableGenRecordKeeper *parse();
+
+  /// Parses all given parsers one after another while holding the parse
+  /// lock, storing the resulting keepers (or nullptr on failure) in
+  /// `keepers`. Lexing happens inside `TableGenParseFile` and cannot be moved
+  /// out of the lock.
+  static bool parseBatch(TableGenParser **parsers, size_t count,
+                         TableGenRecordKeeper **keepers);
+
+  const std::vector<std::string> &getIncludeDirs() const {
+    return includeDirs;
+  }
+  /// Number of leading buffers in `sourceMgr` that were added directly
+  /// rather than through an `include`.
+  unsigned getNumInputBuffers() const { return inputFiles.size(); }
+
+  /// Returns true if any file read by this parser, including files pulled in
+  /// through `include`, no longer matches its contents on disk.
+  bool sourcesChanged() const;
+
+  /// Returns a new parser with the same include paths and inputs, where
+  /// input files are read again from disk and input strings are copied.
+  /// Returns nullptr if an input file can no longer be read, or if input
+  /// strings were dropped.
+  TableGenParser *reload() const;
+
+  /// Replaces every buffer of `sourceMgr` with an empty buffer of the same
+  /// name, keeping the size and hash of its contents for `sourcesChanged`,
+  /// see `TableGenCompactSources`.
+  void dropSources();
+  bool sourcesDropped() const { return hasDroppedSources; }
+
+  /// Adds the size of the source buffers to `usage`, see
+  /// `tableGenRecordKeeperMemoryUsage`.
+  void addMemoryUsage(TableGenMemoryUsage &usage);
+
+  /// Timings and record counts of this parser, see `tableGenStatsGet`.
+  struct ParseStats {
+    uint64_t readNanos = 0;
+    uint64_t parseNanos = 0;
+    uint64_t numParses = 0;
+    uint64_t numClasses = 0;
+    uint64_t numDefs = 0;
+    uint64_t numValues = 0;
+  };
+  const ParseStats &getParseStats() const { return parseStats; }
 
   SourceMgr sourceMgr;
+  /// `SourceMgr` builds its line caches lazily, so line lookups are
+  /// serialized to allow printing diagnostics from several threads.
+  std::mutex sourceMgrMutex;
+
 private:
+  TableGenRecordKeeper *parseLocked();
+  void countRecords(const RecordKeeper &keeper);
+
+  /// Path of each input buffer, or an empty string for input strings.
+  std::vector<std::string> inputFiles;
   std::vector<std::string> includeDirs;
+  /// Keeps the buffers referenced by `addSharedSourceFile` alive.
+  std::vector<std::shared_ptr<const MemoryBuffer>> sharedBuffers;
+  ParseStats parseStats;
+
+  /// Size and hash of every buffer before `dropSources`, indexed by buffer
+  /// id - 1.
+  struct DroppedBuffer {
+    uint64_t size;
+    uint64_t hash;
+  };
+  std::vector<DroppedBuffer> droppedBuffers;
+  bool hasDroppedSources = false;
+};
+
+/// Process-wide cache of file buffers shared between parsers.
+///
+/// Files are opened through `MemoryBuffer::getFile`, which maps them into
+/// memory when they are large enough, and are reused for as long as any
+/// parser holds on to them and their size and modification time do not
+/// change. Entries are only added for files that were read, and the entries
+/// of files no longer held by any parser are dropped on the next miss.
+class SharedBufferCache {
+public:
+  static std::shared_ptr<const MemoryBuffer> get(StringRef path);
+
+private:
+  struct Entry {
+    std::weak_ptr<const MemoryBuffer> buffer;
+    sys::TimePoint<> modificationTime;
+    uint64_t size;
+  };
+
+  static std::mutex mutex;
+  static StringMap<Entry> entries;
+};
+
+/// A keeper that only parses the records that are looked up, together with
+/// everything they depend on, see `tableGenParseLazy`.
+///
+/// The main buffer of the parser and every file it includes are split into
+/// top-level statements, which are indexed by the name of the class, def or
+/// defm they declare. Looking up a record parses a slice of the sources made
+/// of the statements declaring it, the statements declaring every name they
+/// mention, transitively, and every statement that cannot be attributed to a
+/// single name, such as `foreach`, anonymous defs and asserts. If a record
+/// cannot be found this way, or a slice fails to parse, all sources are
+/// parsed instead.
+class LazyRecordKeeper {
+public:
+  /// The parser must outlive the keeper.
+  explicit LazyRecordKeeper(const TableGenParser &parser);
+
+  Record *getDef(StringRef name);
+  Record *getClass(StringRef name);
+  /// Parses the records with the given names in a single slice. Returns false
+  /// if the sources are invalid.
+  bool load(ArrayRef<StringRef> names);
+
+  size_t getNumStatements() const { return statements.size(); }
+  size_t getNumParses();
+  /// Returns true if all sources were parsed.
+  bool isComplete();
+
+private:
+  friend class LazyScanner;
+
+  enum StatementKind : uint8_t {
+    ClassStatement,
+    DefStatement,
+    DefmStatement,
+    /// A `defvar`, `deftype` or `defset`.
+    GlobalStatement,
+    /// Kept in every slice, such as `foreach`, anonymous defs and asserts.
+    AlwaysStatement,
+    /// A preprocessor directive, kept in every slice.
+    DirectiveStatement,
+    /// The header of a `let` block and its closing brace, kept if any
+    /// statement in the block is kept.
+    LetBeginStatement,
+    LetEndStatement,
+  };
+
+  struct Statement {
+    StatementKind kind;
+    /// Set if the statement refers to records through computed names, or
+    /// otherwise requires all sources to be parsed, such as `dump`.
+    bool dynamic;
+    /// Index of the enclosing `let` block, or -1.
+    int32_t parent;
+    StringRef text;
+    unsigned firstIdentifier;
+    unsigned numIdentifiers;
+  };
+
+  bool isIndexed(StringRef name, bool isClass) const;
+  /// Returns the slice of the sources declaring the given names, or an empty
+  /// string if the slice refers to records through computed names.
+  std::string buildSlice(ArrayRef<StringRef> names) const;
+  bool loadLocked(ArrayRef<StringRef> names);
+  bool parseSlice(StringRef source);
+  bool parseAll();
+  void addRecords(std::unique_ptr<TableGenParser> parser,
+                  TableGenRecordKeeper *keeper);
+  Record *lookup(StringMap<Record *> &records, StringRef name, bool isClass);
+
+  const TableGenParser &parser;
+  std::vector<std::unique_ptr<MemoryBuffer>> files;
+  std::vector<Statement> statements;
+  std::vector<StringRef> identifiers;
+  /// Statements declaring a class, multiclass, def or global of the given
+  /// name.
+  StringMap<SmallVector<unsigned, 1>> namedStatements;
+  StringMap<SmallVector<unsigned, 1>> defmStatements;
+  /// Set if the sources may define records that are not in the index, in
+  /// which case looking up an unknown name parses all sources.
+  bool unindexedRecords = false;
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<TableGenParser>> parsers;
+  std::vector<std::unique_ptr<TableGenRecordKeeper>> keepers;
+  StringMap<Record *> defs;
+  StringMap<Record *> classes;
+  bool complete = false;
+  /// Set if parsing all sources failed, which is not retried.
+  bool failed = false;
+};
+
+/// Record-level differences between two keepers, see
+/// `tableGenRecordKeeperDiff`.
+struct RecordDiff {
+  std::vector<TableGenRecordChange> changes;
+  /// Field changes of all modified records, referenced by `changes`.
+  std::vector<TableGenFieldChange> fieldChanges;
+};
+
+/// A loaded snapshot, see `tableGenLoadSnapshot`.
+struct Snapshot {
+  std::unique_ptr<MemoryBuffer> buffer;
 };
 
 // Utility
 TableGenRecTyKind tableGenFromRecType(RecTy *rt);
+/// Returns the kind of an init, which unlike its type distinguishes code from
+/// strings, or TableGenInvalidRecTyKind if it is not typed.
+TableGenRecTyKind tableGenInitKind(const Init *init);
+/// Returns the type of a field, or TableGenCodeRecTyKind for a string field
+/// holding code.
+TableGenRecTyKind tableGenRecordValKind(const RecordVal &value);
+/// Implements `tableGenInitDecode`.
+TableGenInitValue tableGenDecodeInit(Init *init);
+
+static_assert(sizeof(SMLoc) == sizeof(TableGenSMLoc),
+              "TableGenSMLoc must be layout-compatible with SMLoc");
+
+inline TableGenSourceLocationSpan toLocationSpan(ArrayRef<SMLoc> locs) {
+  return TableGenSourceLocationSpan{
+      .locs = reinterpret_cast<const TableGenSMLoc *>(locs.data()),
+      .len = locs.size()};
+}
+
+inline ArrayRef<SMLoc> fromLocationSpan(TableGenSourceLocationSpan span) {
+  return ArrayRef<SMLoc>(reinterpret_cast<const SMLoc *>(span.locs), span.len);
+}
+
+/// Resolves the line and column of every location, see
+/// `tableGenResolveLocations`.
+void resolveLocations(const SourceMgr &sourceMgr, ArrayRef<SMLoc> locs,
+                      TableGenLineColumn *resolved);
+
+/// Diagnostics that are printed together, see `tableGenDiagnosticsCreate`.
+///
+/// The batch refers to the `SourceMgr` of a parser, which must outlive it.
+class DiagnosticBatch {
+public:
+  DiagnosticBatch(const SourceMgr &sourceMgr, std::mutex &sourceMgrMutex)
+      : sourceMgr(sourceMgr), sourceMgrMutex(sourceMgrMutex) {}
+
+  /// Adds a diagnostic at the first location; the remaining locations are
+  /// the multiclass instantiations it was initiated from.
+  void add(ArrayRef<SMLoc> locs, SourceMgr::DiagKind kind, StringRef message);
+  size_t size() const { return diagnostics.size(); }
+  /// Prints all diagnostics sorted by buffer and offset and clears the
+  /// batch. Returns the number of diagnostics printed.
+  size_t flush(raw_ostream &os);
+
+private:
+  struct Diagnostic {
+    SourceMgr::DiagKind kind;
+    std::string message;
+    unsigned firstLoc;
+    unsigned numLocs;
+  };
+
+  /// Buffer, line and start of the line of a location. `buffer` is 0 if
+  /// the location is not in any buffer.
+  struct ResolvedLoc {
+    unsigned buffer;
+    unsigned line;
+    const char *lineStart;
+  };
+
+  void print(raw_ostream &os, SMLoc loc, const ResolvedLoc &resolved,
+             SourceMgr::DiagKind kind, StringRef message);
+  const std::string &getIncludeStack(unsigned buffer);
+
+  const SourceMgr &sourceMgr;
+  std::mutex &sourceMgrMutex;
+  std::vector<Diagnostic> diagnostics;
+  std::vector<SMLoc> locs;
+  DenseMap<unsigned, std::string> includeStacks;
+};
+
+/// A filter over the records of a keeper, see `tableGenPredicateCreate`.
+///
+/// Nodes are stored in the order they were added, and the operands of `And`,
+/// `Or` and `Not` nodes, which always precede them, in a shared array.
+class Predicate {
+public:
+  enum Kind : uint8_t {
+    SubclassOf,
+    HasField,
+    CompareInt,
+    CompareString,
+    DefSubclassOf,
+    And,
+    Or,
+    Not,
+  };
+
+  struct Node {
+    explicit Node(Kind kind, TableGenPredicateOp op = TableGenPredicateEq)
+        : kind(kind), op(op) {}
+
+    Kind kind;
+    TableGenPredicateOp op;
+    /// The field id, or the class id of `SubclassOf`.
+    unsigned id = 0;
+    unsigned classId = 0;
+    int64_t integer = 0;
+    std::string string;
+    unsigned firstOperand = 0;
+    unsigned numOperands = 0;
+  };
+
+  explicit Predicate(TableGenRecordKeeper &keeper) : keeper(keeper) {}
+
+  TableGenRecordKeeper &getRecords() const { return keeper; }
+
+  /// Adds a node and returns its index. Operands that are not added yet
+  /// never match.
+  unsigned add(Node node, ArrayRef<unsigned> operands = {});
+
+  bool matches(unsigned node, const Record *record) const;
+  RecordVector filter(unsigned node, ArrayRef<Record *> records,
+                      size_t numThreads) const;
+
+private:
+  const Init *getFieldValue(const Record *record, unsigned id) const;
+
+  TableGenRecordKeeper &keeper;
+  std::vector<Node> nodes;
+  std::vector<unsigned> operands;
+};
+
+/// Calls `fn(i)` for every `i` in `[0, count)` from up to `numThreads`
+/// threads, or one per hardware thread if `numThreads` is 0.
+///
+/// Indices are handed out in small chunks from a shared counter, so threads
+/// that finish their work early pick up the remaining chunks instead of
+/// waiting for a fixed partition of slower threads.
+template <typename Fn>
+void parallelFor(size_t count, size_t numThreads, const Fn &fn) {
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+  numThreads = std::min(numThreads, count);
+  if (numThreads <= 1) {
+    for (size_t i = 0; i < count; i++)
+      fn(i);
+    return;
+  }
+
+  size_t chunk = std::max<size_t>(1, count / (numThreads * 16));
+  std::atomic<size_t> next{0};
+  auto worker = [&] {
+    for (;;) {
+      size_t begin = next.fetch_add(chunk, std::memory_order_relaxed);
+      if (begin >= count)
+        return;
+      size_t end = std::min(count, begin + chunk);
+      for (size_t i = begin; i < end; i++)
+        fn(i);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (size_t i = 1; i < numThreads; i++)
+    threads.emplace_back(worker);
+  worker();
+  for (auto &thread : threads)
+    thread.join();
+}
 
 /// A simple raw ostream subclass that forwards write_impl calls to the
 /// user-supplied callback together with opaque user-supplied data.
+///
+/// With a non-zero `bufferSize`, output is collected and passed to the
+/// callback in chunks of up to that size instead of once per write.
 class CallbackOstream : public llvm::raw_ostream {
 public:
-  CallbackOstream(std::function<void(TableGenStringRef, void *)> callback,
-                  void *opaqueData)
-      : raw_ostream(/*unbuffered=*/true), callback(std::move(callback)),
-        opaqueData(opaqueData), pos(0u) {}
+  CallbackOstream(TableGenStringCallback callback, void *opaqueData,
+                  size_t bufferSize = 0)
+      : raw_ostream(/*unbuffered=*/bufferSize == 0), callback(callback),
+        opaqueData(opaqueData), pos(0u) {
+    if (bufferSize)
+      SetBufferSize(bufferSize);
+  }
+
+  ~CallbackOstream() override { flush(); }
 
   void write_impl(const char *ptr, size_t size) override {
     TableGenStringRef string = TableGenStringRef { .data = ptr, .len = size };
@@ -68,15 +729,51 @@ public:
   uint64_t current_pos() const override { return pos; }
 
 private:
-  std::function<void(TableGenStringRef, void *)> callback;
+  TableGenStringCallback callback;
   void *opaqueData;
   uint64_t pos;
 };
 
+/// A raw ostream that appends to a caller-owned TableGenBuffer, growing it
+/// through the user-supplied reserve callback.
+class BufferOstream : public llvm::raw_ostream {
+public:
+  BufferOstream(TableGenBuffer *buffer, TableGenBufferReserveCallback reserve,
+                void *opaqueData)
+      : raw_ostream(/*unbuffered=*/true), buffer(buffer), reserve(reserve),
+        opaqueData(opaqueData), pos(0u) {}
+
+  void write_impl(const char *ptr, size_t size) override {
+    pos += size;
+    if (failed)
+      return;
+    if (buffer->capacity - buffer->len < size &&
+        !reserve(buffer, size, opaqueData)) {
+      failed = true;
+      return;
+    }
+    std::memcpy(buffer->data + buffer->len, ptr, size);
+    buffer->len += size;
+  }
+
+  uint64_t current_pos() const override { return pos; }
+
+  /// Returns false if the buffer could not be grown.
+  bool succeeded() const { return !failed; }
+
+private:
+  TableGenBuffer *buffer;
+  TableGenBufferReserveCallback reserve;
+  void *opaqueData;
+  uint64_t pos;
+  bool failed = false;
+};
+
 } // namespace ctablegen
 
 DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::TableGenParser, TableGenParserRef);
-DEFINE_SIMPLE_CONVERSION_FUNCTIONS(RecordKeeper, TableGenRecordKeeperRef);
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::TableGenRecordKeeper,
+                                   TableGenRecordKeeperRef);
 
 DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::RecordMap, TableGenRecordMapRef);
 DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::RecordVector,
@@ -96,4 +793,12 @@ DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::RecordMap::const_iterator,
 
 DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ArrayRef<SMLoc>, TableGenSourceLocationRef);
 
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::Snapshot, TableGenSnapshotRef);
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::RecordDiff, TableGenRecordDiffRef);
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::DiagnosticBatch,
+                                   TableGenDiagnosticsRef);
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::LazyRecordKeeper,
+                                   TableGenLazyRecordKeeperRef);
+DEFINE_SIMPLE_CONVERSION_FUNCTIONS(ctablegen::Predicate, TableGenPredicateRef);
+
 #endif
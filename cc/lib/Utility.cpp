@@ -8,6 +8,8 @@
 // option. This file may not be copied, modified, or distributed
 // except according to those terms.
 
+#include <numeric>
+
 #include "TableGen.h"
 #include "TableGen.hpp"
 #include "Types.h"
@@ -37,18 +39,64 @@ TableGenRecTyKind tableGenFromRecType(RecTy *rt) {
   }
 }
 
+TableGenRecTyKind tableGenInitKind(const Init *init) {
+  auto typed_init = dyn_cast_or_null<TypedInit>(init);
+  if (!typed_init)
+    return TableGenInvalidRecTyKind;
+  // Code is a string with a different format since LLVM removed CodeRecTy.
+  if (auto string_init = dyn_cast<StringInit>(typed_init))
+    if (string_init->hasCodeFormat())
+      return TableGenCodeRecTyKind;
+  return tableGenFromRecType(typed_init->getType());
+}
+
+TableGenRecTyKind tableGenRecordValKind(const RecordVal &value) {
+  auto kind = tableGenFromRecType(value.getType());
+  if (kind == TableGenStringRecTyKind &&
+      tableGenInitKind(value.getValue()) == TableGenCodeRecTyKind)
+    return TableGenCodeRecTyKind;
+  return kind;
+}
+
+TableGenInitValue tableGenDecodeInit(Init *init) {
+  TableGenInitValue value{.kind = tableGenInitKind(init),
+                          .has_value = true,
+                          .payload = {.num_elements = 0}};
+  if (auto bit_init = dyn_cast_or_null<BitInit>(init)) {
+    value.payload.bit = bit_init->getValue();
+  } else if (auto bits_init = dyn_cast_or_null<BitsInit>(init)) {
+    value.payload.num_elements = bits_init->getNumBits();
+  } else if (auto int_init = dyn_cast_or_null<IntInit>(init)) {
+    value.payload.integer = int_init->getValue();
+  } else if (auto str_init = dyn_cast_or_null<StringInit>(init)) {
+    auto str = str_init->getValue();
+    value.payload.string = TableGenStringRef{.data = str.data(), .len = str.size()};
+  } else if (auto list_init = dyn_cast_or_null<ListInit>(init)) {
+    value.payload.num_elements = list_init->size();
+  } else if (auto dag_init = dyn_cast_or_null<DagInit>(init)) {
+    value.payload.num_elements = dag_init->getNumArgs();
+  } else if (auto def_init = dyn_cast_or_null<DefInit>(init)) {
+    value.payload.record = wrap(def_init->getDef());
+  } else {
+    value.has_value = false;
+  }
+  return value;
+}
+
 } // namespace ctablegen
 
 TableGenRecTyKind tableGenInitRecType(TableGenTypedInitRef ti) {
-  if (!ti)
-    return TableGenInvalidRecTyKind;
-  auto typed_init = dyn_cast<TypedInit>(unwrap(ti));
-  if (!typed_init)
-    return TableGenInvalidRecTyKind;
-  return ctablegen::tableGenFromRecType(typed_init->getType());
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::tableGenInitKind(unwrap(ti));
+}
+
+TableGenInitValue tableGenInitDecode(TableGenTypedInitRef ti) {
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::tableGenDecodeInit(unwrap(ti));
 }
 
 TableGenBool tableGenBitInitGetValue(TableGenTypedInitRef ti, int8_t *bit) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return false;
   auto bit_init = dyn_cast<BitInit>(unwrap(ti));
@@ -59,6 +107,7 @@ TableGenBool tableGenBitInitGetValue(TableGenTypedInitRef ti, int8_t *bit) {
 }
 
 int8_t *tableGenBitsInitGetValue(TableGenTypedInitRef ti, size_t *len) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return nullptr;
   auto bits_init = dyn_cast<BitsInit>(unwrap(ti));
@@ -66,16 +115,48 @@ int8_t *tableGenBitsInitGetValue(TableGenTypedInitRef ti, size_t *len) {
     return nullptr;
 
   *len = bits_init->getNumBits();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::VectorAllocation);
   auto bits = new int8_t[*len];
 
   for (size_t i = 0; i < *len; i++) {
-    bits[i] = reinterpret_cast<BitInit *>(bits_init->getBit(i))->getValue();
+    auto bit = dyn_cast<BitInit>(bits_init->getBit(i));
+    bits[i] = bit ? bit->getValue() : -1;
   }
 
   return bits;
 }
 
+TableGenBool tableGenBitsInitGetPacked(TableGenTypedInitRef ti, uint64_t *words,
+                                       uint64_t *known, size_t num_words) {
+  TABLEGEN_COUNT_CALL();
+  if (!ti)
+    return false;
+  auto bits_init = dyn_cast<BitsInit>(unwrap(ti));
+  if (!bits_init)
+    return false;
+
+  size_t num_bits = bits_init->getNumBits();
+  if (num_words < (num_bits + 63) / 64)
+    return false;
+
+  std::fill(words, words + num_words, 0);
+  if (known)
+    std::fill(known, known + num_words, 0);
+  for (size_t i = 0; i < num_bits; i++) {
+    auto bit = dyn_cast<BitInit>(bits_init->getBit(i));
+    if (!bit)
+      continue;
+    uint64_t mask = uint64_t(1) << (i % 64);
+    if (bit->getValue())
+      words[i / 64] |= mask;
+    if (known)
+      known[i / 64] |= mask;
+  }
+  return true;
+}
+
 TableGenBool tableGenBitsInitGetNumBits(TableGenTypedInitRef ti, size_t *len) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return false;
   auto bits_init = dyn_cast<BitsInit>(unwrap(ti));
@@ -88,6 +169,7 @@ TableGenBool tableGenBitsInitGetNumBits(TableGenTypedInitRef ti, size_t *len) {
 
 TableGenTypedInitRef tableGenBitsInitGetBitInit(TableGenTypedInitRef ti,
                                                 size_t index) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return nullptr;
   auto bits_init = dyn_cast<BitsInit>(unwrap(ti));
@@ -99,6 +181,7 @@ TableGenTypedInitRef tableGenBitsInitGetBitInit(TableGenTypedInitRef ti,
 
 TableGenBool tableGenIntInitGetValue(TableGenTypedInitRef ti,
                                      int64_t *integer) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return false;
   auto int_init = dyn_cast<IntInit>(unwrap(ti));
@@ -110,6 +193,7 @@ TableGenBool tableGenIntInitGetValue(TableGenTypedInitRef ti,
 }
 
 TableGenStringRef tableGenStringInitGetValue(TableGenTypedInitRef ti) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return TableGenStringRef{.data = nullptr, .len = 0};
   auto str_init = dyn_cast<StringInit>(unwrap(ti));
@@ -120,6 +204,7 @@ TableGenStringRef tableGenStringInitGetValue(TableGenTypedInitRef ti) {
 }
 
 char *tableGenStringInitGetValueNewString(TableGenTypedInitRef ti) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return nullptr;
   auto str_init = dyn_cast<StringInit>(unwrap(ti));
@@ -128,6 +213,7 @@ char *tableGenStringInitGetValueNewString(TableGenTypedInitRef ti) {
 
   auto val = str_init->getValue();
   auto sz = val.size();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::StringAllocation);
   auto str = new char[sz + 1];
   std::copy(val.begin(), val.end(), str);
   str[sz] = '\0';
@@ -135,6 +221,7 @@ char *tableGenStringInitGetValueNewString(TableGenTypedInitRef ti) {
 }
 
 TableGenRecordRef tableGenDefInitGetValue(TableGenTypedInitRef ti) {
+  TABLEGEN_COUNT_CALL();
   if (!ti)
     return nullptr;
   auto def_init = dyn_cast<DefInit>(unwrap(ti));
@@ -145,22 +232,57 @@ TableGenRecordRef tableGenDefInitGetValue(TableGenTypedInitRef ti) {
 
 void tableGenInitPrint(TableGenTypedInitRef ti, TableGenStringCallback callback,
                        void *userData) {
+  TABLEGEN_COUNT_CALL();
   ctablegen::CallbackOstream stream(callback, userData);
   stream << *unwrap(ti);
 }
 
-void tableGenInitDump(TableGenTypedInitRef ti) { unwrap(ti)->dump(); }
+void tableGenInitPrintBuffered(TableGenTypedInitRef ti,
+                               TableGenStringCallback callback, void *userData,
+                               size_t bufferSize) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream stream(callback, userData, bufferSize);
+  stream << *unwrap(ti);
+}
+
+TableGenBool tableGenInitPrintToBuffer(TableGenTypedInitRef ti,
+                                       TableGenBuffer *buffer,
+                                       TableGenBufferReserveCallback reserve,
+                                       void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream stream(buffer, reserve, userData);
+  stream << *unwrap(ti);
+  return stream.succeeded();
+}
+
+void tableGenInitDump(TableGenTypedInitRef ti) {
+  TABLEGEN_COUNT_CALL();
+  unwrap(ti)->dump();
+}
 
 TableGenBool tableGenPrintError(TableGenParserRef ref, TableGenSourceLocationRef loc_ref, TableGenDiagKind dk,
                         TableGenStringRef message,
                         TableGenStringCallback callback, void *userData) {
+  TABLEGEN_COUNT_CALL();
+  return tableGenPrintErrorSpan(ref, ctablegen::toLocationSpan(*unwrap(loc_ref)),
+                                dk, message, callback, userData);
+}
+
+TableGenBool tableGenPrintErrorSpan(TableGenParserRef ref,
+                                    TableGenSourceLocationSpan loc,
+                                    TableGenDiagKind dk,
+                                    TableGenStringRef message,
+                                    TableGenStringCallback callback,
+                                    void *userData) {
+  TABLEGEN_COUNT_CALL();
   ctablegen::CallbackOstream stream(callback, userData);
-  ArrayRef<SMLoc> Loc = *unwrap(loc_ref);
+  ArrayRef<SMLoc> Loc = ctablegen::fromLocationSpan(loc);
 
   SMLoc NullLoc;
   if (Loc.empty())
     Loc = NullLoc;
   auto &SrcMgr = unwrap(ref)->sourceMgr;
+  std::lock_guard<std::mutex> guard(unwrap(ref)->sourceMgrMutex);
 
   if (!SrcMgr.FindBufferContainingLoc(Loc.front()))
     return false;
@@ -178,14 +300,272 @@ TableGenBool tableGenPrintError(TableGenParserRef ref, TableGenSourceLocationRef
   return true;
 }
 
+namespace {
+
+struct BufferRange {
+  const char *start;
+  const char *end;
+  unsigned id;
+};
+
+/// Returns the buffers of `sourceMgr` sorted by address, so that the buffer
+/// of a location can be found with a binary search instead of the linear
+/// scan done by `FindBufferContainingLoc`.
+SmallVector<BufferRange, 16> getSortedBuffers(const SourceMgr &sourceMgr) {
+  SmallVector<BufferRange, 16> buffers;
+  for (unsigned id = 1; id <= sourceMgr.getNumBuffers(); id++) {
+    auto *buffer = sourceMgr.getMemoryBuffer(id);
+    buffers.push_back(
+        BufferRange{buffer->getBufferStart(), buffer->getBufferEnd(), id});
+  }
+  llvm::sort(buffers, [](const BufferRange &a, const BufferRange &b) {
+    return a.start < b.start;
+  });
+  return buffers;
+}
+
+} // namespace
+
+void ctablegen::resolveLocations(const SourceMgr &sourceMgr,
+                                 ArrayRef<SMLoc> locs,
+                                 TableGenLineColumn *resolved) {
+  ctablegen::Stats::TraceScope scope("resolveLocations");
+  auto buffers = getSortedBuffers(sourceMgr);
+  for (size_t i = 0; i < locs.size(); i++) {
+    const char *ptr = locs[i].getPointer();
+    resolved[i] = TableGenLineColumn{0, 0, 0};
+    auto next = llvm::upper_bound(buffers, ptr,
+                                  [](const char *ptr, const BufferRange &b) {
+                                    return ptr < b.start;
+                                  });
+    if (!ptr || next == buffers.begin() || ptr > std::prev(next)->end)
+      continue;
+    unsigned id = std::prev(next)->id;
+    auto lineAndColumn = sourceMgr.getLineAndColumn(locs[i], id);
+    resolved[i] = TableGenLineColumn{id, lineAndColumn.first,
+                                     lineAndColumn.second};
+  }
+}
+
+void ctablegen::DiagnosticBatch::add(ArrayRef<SMLoc> diagLocs,
+                                     SourceMgr::DiagKind kind,
+                                     StringRef message) {
+  SMLoc nullLoc;
+  if (diagLocs.empty())
+    diagLocs = nullLoc;
+  diagnostics.push_back(Diagnostic{kind, message.str(),
+                                   static_cast<unsigned>(locs.size()),
+                                   static_cast<unsigned>(diagLocs.size())});
+  locs.insert(locs.end(), diagLocs.begin(), diagLocs.end());
+}
+
+const std::string &
+ctablegen::DiagnosticBatch::getIncludeStack(unsigned buffer) {
+  auto it = includeStacks.find(buffer);
+  if (it != includeStacks.end())
+    return it->second;
+
+  // Same output as SourceMgr::PrintIncludeLoc, computed once per buffer.
+  std::string stack;
+  SMLoc includeLoc = sourceMgr.getBufferInfo(buffer).IncludeLoc;
+  if (includeLoc.isValid()) {
+    unsigned parent = sourceMgr.FindBufferContainingLoc(includeLoc);
+    raw_string_ostream os(stack);
+    os << getIncludeStack(parent) << "Included from "
+       << sourceMgr.getMemoryBuffer(parent)->getBufferIdentifier() << ":"
+       << sourceMgr.FindLineNumber(includeLoc, parent) << ":\n";
+  }
+  return includeStacks[buffer] = std::move(stack);
+}
+
+void ctablegen::DiagnosticBatch::print(raw_ostream &os, SMLoc loc,
+                                       const ResolvedLoc &resolved,
+                                       SourceMgr::DiagKind kind,
+                                       StringRef message) {
+  if (!resolved.buffer) {
+    SMDiagnostic(/*filename=*/"", kind, message).print(nullptr, os);
+    return;
+  }
+
+  auto *buffer = sourceMgr.getMemoryBuffer(resolved.buffer);
+  const char *lineEnd = resolved.lineStart;
+  while (lineEnd != buffer->getBufferEnd() && *lineEnd != '\n' &&
+         *lineEnd != '\r')
+    ++lineEnd;
+  SMDiagnostic diagnostic(
+      sourceMgr, loc, buffer->getBufferIdentifier(), resolved.line,
+      loc.getPointer() - resolved.lineStart, kind, message,
+      StringRef(resolved.lineStart, lineEnd - resolved.lineStart), {});
+  os << getIncludeStack(resolved.buffer);
+  diagnostic.print(nullptr, os);
+}
+
+size_t ctablegen::DiagnosticBatch::flush(raw_ostream &os) {
+  ctablegen::Stats::TraceScope scope("flushDiagnostics");
+  std::lock_guard<std::mutex> guard(sourceMgrMutex);
+
+  // Resolve all locations in address order, so that every buffer is scanned
+  // for line breaks at most once.
+  std::vector<ResolvedLoc> resolved(locs.size(), ResolvedLoc{0, 0, nullptr});
+  std::vector<unsigned> order(locs.size());
+  std::iota(order.begin(), order.end(), 0);
+  llvm::sort(order, [&](unsigned a, unsigned b) {
+    return locs[a].getPointer() < locs[b].getPointer();
+  });
+
+  auto buffers = getSortedBuffers(sourceMgr);
+  auto buffer = buffers.begin();
+  const char *cursor = nullptr;
+  const char *lineStart = nullptr;
+  unsigned line = 0;
+  for (unsigned i : order) {
+    const char *ptr = locs[i].getPointer();
+    if (!ptr)
+      continue;
+    while (buffer != buffers.end() && ptr > buffer->end) {
+      ++buffer;
+      cursor = nullptr;
+    }
+    if (buffer == buffers.end())
+      break;
+    if (ptr < buffer->start)
+      continue;
+    if (!cursor) {
+      cursor = lineStart = buffer->start;
+      line = 1;
+    }
+    for (; cursor < ptr; ++cursor) {
+      if (*cursor == '\n') {
+        line++;
+        lineStart = cursor + 1;
+      }
+    }
+    resolved[i] = ResolvedLoc{buffer->id, line, lineStart};
+  }
+
+  // Diagnostics without a valid location go last.
+  auto key = [&](const Diagnostic &d) {
+    const ResolvedLoc &loc = resolved[d.firstLoc];
+    return std::make_pair(loc.buffer ? loc.buffer : ~0u,
+                          locs[d.firstLoc].getPointer());
+  };
+  std::stable_sort(diagnostics.begin(), diagnostics.end(),
+                   [&](const Diagnostic &a, const Diagnostic &b) {
+                     return key(a) < key(b);
+                   });
+
+  auto notesOf = [&](const Diagnostic &d) {
+    return ArrayRef<SMLoc>(locs).slice(d.firstLoc + 1, d.numLocs - 1);
+  };
+  auto isDuplicate = [&](const Diagnostic &a, const Diagnostic &b) {
+    return a.kind == b.kind && a.message == b.message &&
+           locs[a.firstLoc] == locs[b.firstLoc] && notesOf(a) == notesOf(b);
+  };
+
+  size_t printed = 0;
+  for (size_t i = 0; i < diagnostics.size(); i++) {
+    const Diagnostic &diagnostic = diagnostics[i];
+    if (i > 0 && isDuplicate(diagnostics[i - 1], diagnostic))
+      continue;
+    print(os, locs[diagnostic.firstLoc], resolved[diagnostic.firstLoc],
+          diagnostic.kind, diagnostic.message);
+    printed++;
+
+    // Notes shared with the next diagnostic are printed after it instead.
+    auto notes = notesOf(diagnostic);
+    size_t next = i + 1;
+    while (next < diagnostics.size() &&
+           isDuplicate(diagnostic, diagnostics[next]))
+      next++;
+    if (next < diagnostics.size() && !notes.empty() &&
+        notesOf(diagnostics[next]) == notes)
+      continue;
+    for (unsigned j = 1; j < diagnostic.numLocs; j++) {
+      unsigned note = diagnostic.firstLoc + j;
+      if (!resolved[note].buffer)
+        continue;
+      print(os, locs[note], resolved[note], SourceMgr::DK_Note,
+            "initiated from multiclass");
+    }
+  }
+
+  diagnostics.clear();
+  locs.clear();
+  return printed;
+}
+
+void tableGenResolveLocations(TableGenParserRef ref, const TableGenSMLoc *locs,
+                              size_t len, TableGenLineColumn *resolved) {
+  TABLEGEN_COUNT_CALL();
+  std::lock_guard<std::mutex> guard(unwrap(ref)->sourceMgrMutex);
+  ctablegen::resolveLocations(
+      unwrap(ref)->sourceMgr,
+      ArrayRef<SMLoc>(reinterpret_cast<const SMLoc *>(locs), len), resolved);
+}
+
+TableGenDiagnosticsRef tableGenDiagnosticsCreate(TableGenParserRef ref) {
+  TABLEGEN_COUNT_CALL();
+  auto parser = unwrap(ref);
+  ctablegen::Stats::countAllocation(ctablegen::Stats::OtherAllocation);
+  return wrap(
+      new ctablegen::DiagnosticBatch(parser->sourceMgr, parser->sourceMgrMutex));
+}
+
+void tableGenDiagnosticsAdd(TableGenDiagnosticsRef diag_ref,
+                            TableGenSourceLocationSpan loc,
+                            TableGenDiagKind dk, TableGenStringRef message) {
+  TABLEGEN_COUNT_CALL();
+  unwrap(diag_ref)->add(ctablegen::fromLocationSpan(loc),
+                        static_cast<SourceMgr::DiagKind>(dk),
+                        StringRef(message.data, message.len));
+}
+
+size_t tableGenDiagnosticsGetNumDiagnostics(TableGenDiagnosticsRef diag_ref) {
+  TABLEGEN_COUNT_CALL();
+  return unwrap(diag_ref)->size();
+}
+
+size_t tableGenDiagnosticsFlush(TableGenDiagnosticsRef diag_ref,
+                                TableGenStringCallback callback,
+                                void *userData, size_t bufferSize) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::CallbackOstream stream(callback, userData, bufferSize);
+  return unwrap(diag_ref)->flush(stream);
+}
+
+TableGenBool tableGenDiagnosticsFlushToBuffer(
+    TableGenDiagnosticsRef diag_ref, TableGenBuffer *buffer,
+    TableGenBufferReserveCallback reserve, void *userData) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::BufferOstream stream(buffer, reserve, userData);
+  unwrap(diag_ref)->flush(stream);
+  return stream.succeeded();
+}
+
+void tableGenDiagnosticsFree(TableGenDiagnosticsRef diag_ref) {
+  TABLEGEN_COUNT_CALL();
+  delete unwrap(diag_ref);
+}
+
+TableGenSourceLocationSpan
+tableGenSourceLocationGetSpan(TableGenSourceLocationRef loc_ref) {
+  TABLEGEN_COUNT_CALL();
+  return ctablegen::toLocationSpan(*unwrap(loc_ref));
+}
+
 TableGenSourceLocationRef tableGenSourceLocationNull() {
-  return wrap(new ArrayRef(SMLoc()));
+  TABLEGEN_COUNT_CALL();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::LocationAllocation);
+  return wrap(new ArrayRef<SMLoc>());
 }
 
 TableGenSourceLocationRef tableGenSourceLocationClone(TableGenSourceLocationRef loc_ref) {
+  TABLEGEN_COUNT_CALL();
+  ctablegen::Stats::countAllocation(ctablegen::Stats::LocationAllocation);
   return wrap(new ArrayRef(*unwrap(loc_ref)));
 }
 
 void tableGenSourceLocationFree(TableGenSourceLocationRef loc_ref) {
+  TABLEGEN_COUNT_CALL();
   delete unwrap(loc_ref);
 }
@@ -0,0 +1,315 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! This module contains record-level differences between two
+//! [`RecordKeeper`](crate::RecordKeeper)s.
+//!
+//! Together with [`RecordKeeper::sources_changed`] and
+//! [`RecordKeeper::reparse`], a diff tells which records are affected by an
+//! edit to the sources.
+//!
+//! [`RecordKeeper::sources_changed`]: crate::RecordKeeper::sources_changed
+//! [`RecordKeeper::reparse`]: crate::RecordKeeper::reparse
+
+use std::marker::PhantomData;
+
+use crate::raw::{
+    tableGenRecordDiffFree, tableGenRecordDiffGetChanges, tableGenRecordDiffGetNumChanges,
+    TableGenFieldChange, TableGenRecordChange, TableGenRecordChangeKind, TableGenRecordDiffRef,
+    TableGenRecordRef, TableGenRecordValRef,
+};
+use crate::record::{Record, RecordValue};
+use crate::string_ref::StringRef;
+
+/// Kind of a [`RecordChange`] or [`FieldChange`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RecordChangeKind {
+    Added,
+    Removed,
+    Modified,
+}
+
+impl RecordChangeKind {
+    fn from_raw(kind: TableGenRecordChangeKind::Type) -> Self {
+        match kind {
+            TableGenRecordChangeKind::TableGenRecordAdded => Self::Added,
+            TableGenRecordChangeKind::TableGenRecordRemoved => Self::Removed,
+            _ => Self::Modified,
+        }
+    }
+}
+
+/// A field that differs between the old and new version of a modified
+/// record.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct FieldChange<'a> {
+    pub kind: RecordChangeKind,
+    pub name: &'a str,
+    /// The field in the old record, or `None` if it was added.
+    pub old: Option<RecordValue<'a>>,
+    /// The field in the new record, or `None` if it was removed.
+    pub new: Option<RecordValue<'a>>,
+}
+
+impl<'a> FieldChange<'a> {
+    unsafe fn from_raw(change: &TableGenFieldChange) -> Self {
+        let value =
+            |raw: TableGenRecordValRef| (!raw.is_null()).then(|| RecordValue::from_raw(raw));
+        Self {
+            kind: RecordChangeKind::from_raw(change.kind),
+            name: StringRef::from_raw(change.name)
+                .try_into()
+                .unwrap_or_default(),
+            old: value(change.old_value),
+            new: value(change.new_value),
+        }
+    }
+}
+
+/// A class or definition that differs between two keepers.
+///
+/// The change borrows the [`RecordDiff`] it was read from for `'d`, and the
+/// keepers for `'a`.
+#[derive(Debug, Clone, Copy)]
+pub struct RecordChange<'d, 'a: 'd> {
+    pub kind: RecordChangeKind,
+    pub is_class: bool,
+    /// The record in the old keeper, or `None` if it was added.
+    pub old: Option<Record<'a>>,
+    /// The record in the new keeper, or `None` if it was removed.
+    pub new: Option<Record<'a>>,
+    field_changes: &'d [TableGenFieldChange],
+}
+
+// Field changes are read-only views into the diff, like records.
+unsafe impl Send for RecordChange<'_, '_> {}
+unsafe impl Sync for RecordChange<'_, '_> {}
+
+impl PartialEq for RecordChange<'_, '_> {
+    fn eq(&self, other: &Self) -> bool {
+        self.kind == other.kind
+            && self.is_class == other.is_class
+            && self.old == other.old
+            && self.new == other.new
+    }
+}
+
+impl Eq for RecordChange<'_, '_> {}
+
+impl<'d, 'a: 'd> RecordChange<'d, 'a> {
+    unsafe fn from_raw(change: &'d TableGenRecordChange) -> Self {
+        let record = |raw: TableGenRecordRef| (!raw.is_null()).then(|| Record::from_raw(raw));
+        Self {
+            kind: RecordChangeKind::from_raw(change.kind),
+            is_class: change.is_class > 0,
+            old: record(change.old_record),
+            new: record(change.new_record),
+            field_changes: if change.num_field_changes == 0 {
+                &[]
+            } else {
+                std::slice::from_raw_parts(change.field_changes, change.num_field_changes)
+            },
+        }
+    }
+
+    /// Returns the name of the changed record.
+    pub fn name(self) -> &'a str {
+        self.new
+            .or(self.old)
+            .and_then(|record| record.name().ok())
+            .unwrap_or_default()
+    }
+
+    /// Returns an iterator over the fields that differ if the record was
+    /// modified: removed and modified fields in the order of the old record,
+    /// then added fields in the order of the new record.
+    ///
+    /// The iterator is empty if only the superclasses or template arguments
+    /// of the record changed. Field changes cannot outlive the diff.
+    pub fn field_changes(self) -> impl ExactSizeIterator<Item = FieldChange<'d>> {
+        self.field_changes
+            .iter()
+            .map(|change| unsafe { FieldChange::from_raw(change) })
+    }
+}
+
+/// Differences between the classes and definitions of two keepers, created
+/// with [`RecordKeeper::diff`](crate::RecordKeeper::diff).
+///
+/// Records are compared by name and structural hash, see
+/// [`Record::fingerprint`]. Changes are ordered as classes, then definitions,
+/// each sorted by name. Records present in both keepers are compared in
+/// parallel.
+#[derive(Debug)]
+pub struct RecordDiff<'a> {
+    raw: TableGenRecordDiffRef,
+    _reference: PhantomData<&'a ()>,
+}
+
+impl<'a> RecordDiff<'a> {
+    pub(crate) unsafe fn from_raw(raw: TableGenRecordDiffRef) -> Self {
+        Self {
+            raw,
+            _reference: PhantomData,
+        }
+    }
+
+    fn raw_changes(&self) -> &[TableGenRecordChange] {
+        unsafe {
+            let len = tableGenRecordDiffGetNumChanges(self.raw);
+            if len == 0 {
+                &[]
+            } else {
+                std::slice::from_raw_parts(tableGenRecordDiffGetChanges(self.raw), len)
+            }
+        }
+    }
+
+    /// Returns true if both keepers have the same records.
+    pub fn is_empty(&self) -> bool {
+        self.raw_changes().is_empty()
+    }
+
+    /// Returns the number of changed records.
+    pub fn len(&self) -> usize {
+        self.raw_changes().len()
+    }
+
+    /// Returns an iterator over all changed records. The changes borrow the
+    /// diff, which owns their field changes.
+    pub fn changes(&self) -> impl ExactSizeIterator<Item = RecordChange<'_, 'a>> {
+        self.raw_changes()
+            .iter()
+            .map(|change| unsafe { RecordChange::from_raw(change) })
+    }
+}
+
+impl<'a> Drop for RecordDiff<'a> {
+    fn drop(&mut self) {
+        unsafe { tableGenRecordDiffFree(self.raw) }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::TableGenParser;
+
+    #[test]
+    fn diff() {
+        let old = TableGenParser::new()
+            .add_source("class A { int i = 1; } def B : A; def C : A; def D;")
+            .unwrap()
+            .parse()
+            .unwrap();
+        let new = TableGenParser::new()
+            .add_source("class A { int i = 1; } def B : A { let i = 2; } def D; def E;")
+            .unwrap()
+            .parse()
+            .unwrap();
+        assert!(old.diff(&old).is_empty());
+
+        let diff = old.diff(&new);
+        let changes: Vec<_> = diff.changes().map(|c| (c.kind, c.name())).collect();
+        assert_eq!(
+            changes,
+            [
+                (RecordChangeKind::Modified, "B"),
+                (RecordChangeKind::Removed, "C"),
+                (RecordChangeKind::Added, "E"),
+            ]
+        );
+        let modified = diff.changes().next().unwrap();
+        assert!(!modified.is_class);
+        assert_eq!(modified.old.unwrap().int_value("i"), Ok(1));
+        assert_eq!(modified.new.unwrap().int_value("i"), Ok(2));
+        let fields: Vec<_> = modified
+            .field_changes()
+            .map(|field| (field.kind, field.name))
+            .collect();
+        assert_eq!(fields, [(RecordChangeKind::Modified, "i")]);
+        assert!(diff.changes().nth(1).unwrap().field_changes().len() == 0);
+    }
+
+    #[test]
+    fn field_changes() {
+        let old = TableGenParser::new()
+            .add_source("def A { int i = 1; int j = 2; string s = \"x\"; }")
+            .unwrap()
+            .parse()
+            .unwrap();
+        let new = TableGenParser::new()
+            .add_source("def A { int j = 2; string s = \"y\"; bit b = 1; }")
+            .unwrap()
+            .parse()
+            .unwrap();
+        let diff = old.diff(&new);
+        assert_eq!(diff.len(), 1);
+        let fields: Vec<_> = diff
+            .changes()
+            .next()
+            .unwrap()
+            .field_changes()
+            .map(|field| {
+                (
+                    field.kind,
+                    field.name,
+                    field.old.is_some(),
+                    field.new.is_some(),
+                )
+            })
+            .collect();
+        assert_eq!(
+            fields,
+            [
+                (RecordChangeKind::Removed, "i", true, false),
+                (RecordChangeKind::Modified, "s", true, true),
+                (RecordChangeKind::Added, "b", false, true),
+            ]
+        );
+    }
+
+    #[test]
+    fn reparse() {
+        let dir = std::env::temp_dir().join(format!("tblgen-reparse-{}", std::process::id()));
+        std::fs::create_dir_all(&dir).unwrap();
+        let main = dir.join("main.td");
+        let leaf = dir.join("leaf.td");
+        std::fs::write(&main, "include \"leaf.td\"\ndef M : L;").unwrap();
+        std::fs::write(&leaf, "class L { int i = 1; }").unwrap();
+
+        let old = TableGenParser::new()
+            .add_source_file(main.to_str().unwrap())
+            .unwrap()
+            .add_include_path(dir.to_str().unwrap())
+            .parse()
+            .unwrap();
+        assert!(!old.sources_changed());
+
+        std::fs::write(&leaf, "class L { int i = 2; }").unwrap();
+        assert!(old.sources_changed());
+        let new = old.reparse().unwrap();
+        assert!(!new.sources_changed());
+        assert_eq!(new.def("M").unwrap().int_value("i"), Ok(2));
+
+        let diff = old.diff(&new);
+        let changes: Vec<_> = diff
+            .changes()
+            .map(|c| (c.kind, c.is_class, c.name()))
+            .collect();
+        assert_eq!(
+            changes,
+            [
+                (RecordChangeKind::Modified, true, "L"),
+                (RecordChangeKind::Modified, false, "M"),
+            ]
+        );
+        std::fs::remove_dir_all(dir).unwrap();
+    }
+}
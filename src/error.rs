@@ -62,17 +62,23 @@ use std::{
     convert::Infallible,
     ffi::{c_void, NulError},
     fmt::{self, Display, Formatter},
+    marker::PhantomData,
     str::Utf8Error,
     string::FromUtf8Error,
 };
 
 use crate::{
     raw::{
-        tableGenPrintError, tableGenSourceLocationClone, tableGenSourceLocationFree,
-        tableGenSourceLocationNull, TableGenDiagKind::TABLEGEN_DK_ERROR, TableGenSourceLocationRef,
+        tableGenDiagnosticsAdd, tableGenDiagnosticsCreate, tableGenDiagnosticsFlushToBuffer,
+        tableGenDiagnosticsFree, tableGenDiagnosticsGetNumDiagnostics, tableGenPrintErrorSpan,
+        tableGenSourceLocationFree, tableGenSourceLocationGetSpan, TableGenDiagKind,
+        TableGenDiagKind::TABLEGEN_DK_ERROR,
+        TableGenDiagKind::{TABLEGEN_DK_NOTE, TABLEGEN_DK_REMARK, TABLEGEN_DK_WARNING},
+        TableGenDiagnosticsRef, TableGenLineColumn, TableGenSMLoc, TableGenSourceLocationRef,
+        TableGenSourceLocationSpan,
     },
     string_ref::StringRef,
-    util::print_string_callback,
+    util::{print_string_callback, print_to_vec},
     SourceInfo, TableGenParser,
 };
 
@@ -103,47 +109,75 @@ pub enum TableGenError {
     },
     #[error("invalid source location")]
     InvalidSourceLocation,
+    #[error("failed to write snapshot")]
+    Snapshot,
     #[error("infallible")]
     Infallible(#[from] Infallible),
 }
 
 /// A location in a TableGen source file.
-#[derive(Debug, PartialEq, Eq)]
+///
+/// This is a plain view of the locations stored in a record or record value,
+/// which is cheap to copy and does not need to be freed.
+#[derive(Debug, Clone, Copy)]
 pub struct SourceLocation {
-    raw: TableGenSourceLocationRef,
+    raw: TableGenSourceLocationSpan,
 }
 
-// SourceLocation is a read-only llvm::ArrayRef, which should be thread-safe.
+// SourceLocation is a read-only view of immutable locations, which is
+// thread-safe.
 unsafe impl Sync for SourceLocation {}
 unsafe impl Send for SourceLocation {}
 
+impl PartialEq for SourceLocation {
+    fn eq(&self, other: &Self) -> bool {
+        self.raw.locs == other.raw.locs && self.raw.len == other.raw.len
+    }
+}
+
+impl Eq for SourceLocation {}
+
+/// The buffer, line and column of a location, see [`SourceInfo::resolve`].
+/// `buffer` is 0 for locations that are not in any buffer of the parser.
+pub type LineColumn = TableGenLineColumn;
+
 impl SourceLocation {
+    /// Creates a source location from a raw object, taking ownership of it.
+    ///
     /// # Safety
     /// The passed pointer should be a valid table gen source location.
     pub unsafe fn from_raw(raw: TableGenSourceLocationRef) -> Self {
+        let span = tableGenSourceLocationGetSpan(raw);
+        tableGenSourceLocationFree(raw);
+        Self::from_raw_span(span)
+    }
+
+    /// # Safety
+    /// The span should point to locations that outlive the returned value.
+    pub(crate) unsafe fn from_raw_span(raw: TableGenSourceLocationSpan) -> Self {
         Self { raw }
     }
 
     /// Returns a [`SourceLocation`] for an undetermined location in the
     /// TableGen source file.
     pub fn none() -> Self {
-        unsafe {
-            Self {
-                raw: tableGenSourceLocationNull(),
-            }
+        Self {
+            raw: TableGenSourceLocationSpan {
+                locs: std::ptr::null(),
+                len: 0,
+            },
         }
     }
-}
-
-impl Clone for SourceLocation {
-    fn clone(&self) -> Self {
-        unsafe { Self::from_raw(tableGenSourceLocationClone(self.raw)) }
-    }
-}
 
-impl Drop for SourceLocation {
-    fn drop(&mut self) {
-        unsafe { tableGenSourceLocationFree(self.raw) }
+    /// Returns the primary location, or a null location if there is none.
+    pub(crate) fn primary(&self) -> TableGenSMLoc {
+        if self.raw.len == 0 {
+            TableGenSMLoc {
+                ptr: std::ptr::null(),
+            }
+        } else {
+            unsafe { *self.raw.locs }
+        }
     }
 }
 
@@ -216,7 +250,7 @@ impl<E: std::error::Error> SourceError<E> {
     fn create_message(parser: &TableGenParser, location: &SourceLocation, message: &str) -> String {
         let mut data: (_, Result<_, TableGenError>) = (String::new(), Ok(()));
         let res = unsafe {
-            tableGenPrintError(
+            tableGenPrintErrorSpan(
                 parser.raw,
                 location.raw,
                 TABLEGEN_DK_ERROR,
@@ -279,3 +313,160 @@ impl SourceLoc for SourceLocation {
 
 /// Main error type.
 pub type Error = SourceError<TableGenError>;
+
+/// Kind of a diagnostic added to [`Diagnostics`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum DiagKind {
+    Error,
+    Warning,
+    Remark,
+    Note,
+}
+
+impl From<DiagKind> for TableGenDiagKind::Type {
+    fn from(kind: DiagKind) -> Self {
+        match kind {
+            DiagKind::Error => TABLEGEN_DK_ERROR,
+            DiagKind::Warning => TABLEGEN_DK_WARNING,
+            DiagKind::Remark => TABLEGEN_DK_REMARK,
+            DiagKind::Note => TABLEGEN_DK_NOTE,
+        }
+    }
+}
+
+/// A batch of diagnostics for the TableGen source files of one parser.
+///
+/// Printing many diagnostics through a batch is much faster than calling
+/// [`SourceError::add_source_info`] for each of them: the batch is printed
+/// in one go, sorted by location, and identical diagnostics are only printed
+/// once.
+///
+/// ```rust
+/// use tblgen_alt::{error::Diagnostics, TableGenParser, RecordKeeper};
+///
+/// # fn main() -> Result<(), Box<dyn std::error::Error>> {
+/// let keeper: RecordKeeper = TableGenParser::new()
+///     .add_source("def A { int i = 5; }")?
+///     .parse()?;
+/// let mut diagnostics = Diagnostics::new(keeper.source_info());
+/// for (_, def) in keeper.defs() {
+///     if let Err(e) = def.string_value("i") {
+///         diagnostics.add(&e);
+///     }
+/// }
+/// print!("{}", diagnostics.emit()?);
+/// # Ok(())
+/// # }
+/// ```
+pub struct Diagnostics<'a> {
+    raw: TableGenDiagnosticsRef,
+    _reference: PhantomData<SourceInfo<'a>>,
+}
+
+impl<'a> Diagnostics<'a> {
+    /// Creates an empty batch for the source files of the given parser.
+    pub fn new(info: SourceInfo<'a>) -> Self {
+        Self {
+            raw: unsafe { tableGenDiagnosticsCreate(info.0.raw) },
+            _reference: PhantomData,
+        }
+    }
+
+    /// Adds an error diagnostic for the given error at its location.
+    pub fn add<E: std::error::Error>(&mut self, error: &SourceError<E>) {
+        self.add_message(error.location, DiagKind::Error, &error.error.to_string());
+    }
+
+    /// Adds a diagnostic with the given kind and message.
+    pub fn add_message(&mut self, location: impl SourceLoc, kind: DiagKind, message: &str) {
+        unsafe {
+            tableGenDiagnosticsAdd(
+                self.raw,
+                location.source_location().raw,
+                kind.into(),
+                StringRef::from(message).to_raw(),
+            )
+        }
+    }
+
+    /// Returns the number of diagnostics that have not been emitted yet.
+    pub fn len(&self) -> usize {
+        unsafe { tableGenDiagnosticsGetNumDiagnostics(self.raw) }
+    }
+
+    /// Returns true if there are no diagnostics to emit.
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Formats all diagnostics, sorted by location, and clears the batch.
+    pub fn emit(&mut self) -> Result<String, Error> {
+        let bytes = print_to_vec(|buffer, reserve, data| unsafe {
+            tableGenDiagnosticsFlushToBuffer(self.raw, buffer, reserve, data)
+        })
+        .unwrap_or_default();
+        Ok(String::from_utf8(bytes).map_err(TableGenError::from)?)
+    }
+}
+
+impl Drop for Diagnostics<'_> {
+    fn drop(&mut self) {
+        unsafe { tableGenDiagnosticsFree(self.raw) }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{RecordKeeper, TableGenParser};
+
+    #[test]
+    fn diagnostics() {
+        let rk: RecordKeeper = TableGenParser::new()
+            .add_source(
+                r#"
+multiclass M {
+  def _a;
+  def _b;
+}
+defm X : M;
+def B;
+def A;
+"#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let mut diagnostics = Diagnostics::new(rk.source_info());
+        for name in ["A", "B", "A", "X_a", "X_b"] {
+            let def = rk.def(name).expect("def exists");
+            diagnostics.add_message(def, DiagKind::Error, &format!("bad {}", name));
+        }
+        diagnostics.add_message(SourceLocation::none(), DiagKind::Warning, "no location");
+        assert_eq!(diagnostics.len(), 6);
+
+        let output = diagnostics.emit().unwrap();
+        assert!(diagnostics.is_empty());
+        let lines: Vec<_> = output
+            .lines()
+            .filter(|line| line.contains(": error: ") || line.contains(": note: "))
+            .collect();
+        let expected = [
+            ":3:3: error: bad X_a",
+            ":4:3: error: bad X_b",
+            ":6:1: note: initiated from multiclass",
+            ":7:1: error: bad B",
+            ":8:1: error: bad A",
+        ];
+        assert_eq!(lines.len(), expected.len());
+        for (line, expected) in lines.iter().zip(expected) {
+            assert!(
+                line.ends_with(expected),
+                "{} should end with {}",
+                line,
+                expected
+            );
+        }
+        assert!(output.ends_with("warning: no location\n"));
+    }
+}
@@ -18,19 +18,21 @@
 use crate::{
     raw::{
         tableGenBitInitGetValue, tableGenBitsInitGetBitInit, tableGenBitsInitGetNumBits,
-        tableGenDagRecordArgName, tableGenDagRecordGet, tableGenDagRecordNumArgs,
-        tableGenDagRecordOperator, tableGenDefInitGetValue, tableGenInitPrint, tableGenInitRecType,
-        tableGenIntInitGetValue, tableGenListRecordGet, tableGenListRecordNumElements,
-        tableGenStringInitGetValue, TableGenRecTyKind, TableGenTypedInitRef,
+        tableGenBitsInitGetPacked, tableGenDagRecordArgName, tableGenDagRecordGet,
+        tableGenDagRecordGetArgs, tableGenDagRecordNumArgs, tableGenDagRecordOperator,
+        tableGenDefInitGetValue, tableGenInitDecode, tableGenInitFlatten,
+        tableGenInitNodeArrayFree, tableGenInitPrintToBuffer, tableGenInitRecType,
+        tableGenIntInitGetValue, tableGenListRecordGet, tableGenListRecordGetElements,
+        tableGenListRecordNumElements, tableGenStringInitGetValue, TableGenInitValue,
+        TableGenRecTyKind, TableGenStringRef, TableGenTypedInitRef,
     },
     string_ref::StringRef,
-    util::print_callback,
+    util::print_to_formatter,
 };
 use paste::paste;
 
 use crate::{error::Error, error::TableGenError, record::Record};
 use std::{
-    ffi::c_void,
     fmt::{self, Debug, Display, Formatter},
     marker::PhantomData,
     str::Utf8Error,
@@ -195,14 +197,26 @@ impl<'a> TypedInit<'a> {
     /// # Safety
     ///
     /// The raw object must be valid.
-    #[allow(non_upper_case_globals)]
     pub unsafe fn from_raw(init: TableGenTypedInitRef) -> Self {
-        let t = tableGenInitRecType(init);
+        Self::from_raw_kind(init, tableGenInitRecType(init))
+    }
+
+    /// Same as [`TypedInit::from_raw`], with the type of the init already
+    /// known.
+    #[allow(non_upper_case_globals)]
+    pub(crate) unsafe fn from_raw_kind(
+        init: TableGenTypedInitRef,
+        kind: TableGenRecTyKind::Type,
+    ) -> Self {
+        if init.is_null() {
+            return Self::Invalid;
+        }
 
         use TableGenRecTyKind::*;
-        match t {
+        match kind {
             TableGenBitRecTyKind => Self::Bit(BitInit::from_raw(init)),
             TableGenBitsRecTyKind => Self::Bits(BitsInit::from_raw(init)),
+            TableGenCodeRecTyKind => Self::Code(StringInit::from_raw(init)),
             TableGenDagRecTyKind => TypedInit::Dag(DagInit::from_raw(init)),
             TableGenIntRecTyKind => TypedInit::Int(IntInit::from_raw(init)),
             TableGenListRecTyKind => TypedInit::List(ListInit::from_raw(init)),
@@ -213,6 +227,83 @@ impl<'a> TypedInit<'a> {
     }
 }
 
+impl<'a> TypedInit<'a> {
+    fn raw(self) -> TableGenTypedInitRef {
+        match self {
+            Self::Bit(init) => init.raw,
+            Self::Bits(init) => init.raw,
+            Self::Code(init) | Self::String(init) => init.raw,
+            Self::Int(init) => init.raw,
+            Self::List(init) => init.raw,
+            Self::Dag(init) => init.raw,
+            Self::Def(init) => init.raw,
+            Self::Invalid => std::ptr::null_mut(),
+        }
+    }
+
+    /// Returns the value of the init, read with a single call.
+    pub fn decode(self) -> InitValue<'a> {
+        self.decoded(unsafe { tableGenInitDecode(self.raw()) })
+    }
+
+    /// Converts the result of decoding this init on the C side.
+    #[allow(non_upper_case_globals)]
+    pub(crate) fn decoded(self, value: TableGenInitValue) -> InitValue<'a> {
+        if value.has_value == 0 {
+            return match self {
+                Self::Invalid => InitValue::Invalid,
+                init => InitValue::Unresolved(init),
+            };
+        }
+
+        use TableGenRecTyKind::*;
+        unsafe {
+            let payload = value.payload;
+            match (value.kind, self) {
+                (TableGenBitRecTyKind, _) => InitValue::Bit(payload.bit != 0),
+                (TableGenIntRecTyKind, _) => InitValue::Int(payload.integer),
+                (TableGenStringRecTyKind, _) => {
+                    InitValue::String(StringRef::from_raw(payload.string).into())
+                }
+                (TableGenCodeRecTyKind, _) => {
+                    InitValue::Code(StringRef::from_raw(payload.string).into())
+                }
+                (TableGenRecordRecTyKind, _) => InitValue::Def(Record::from_raw(payload.record)),
+                (TableGenBitsRecTyKind, Self::Bits(init)) => {
+                    InitValue::Bits(init, payload.num_elements)
+                }
+                (TableGenListRecTyKind, Self::List(init)) => {
+                    InitValue::List(init, payload.num_elements)
+                }
+                (TableGenDagRecTyKind, Self::Dag(init)) => {
+                    InitValue::Dag(init, payload.num_elements)
+                }
+                _ => InitValue::Invalid,
+            }
+        }
+    }
+}
+
+/// Value of a [`TypedInit`], see [`TypedInit::decode`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum InitValue<'a> {
+    Bit(bool),
+    /// The init and its number of bits.
+    Bits(BitsInit<'a>, usize),
+    Code(&'a [u8]),
+    Int(i64),
+    String(&'a [u8]),
+    /// The init and its number of elements.
+    List(ListInit<'a>, usize),
+    /// The init and its number of arguments.
+    Dag(DagInit<'a>, usize),
+    Def(Record<'a>),
+    /// An init that is no concrete value yet, such as a reference to a
+    /// template argument of a class.
+    Unresolved(TypedInit<'a>),
+    Invalid,
+}
+
 macro_rules! init {
     ($name:ident) => {
         #[derive(Clone, Copy, PartialEq, Eq)]
@@ -235,19 +326,16 @@ macro_rules! init {
             }
         }
 
+        // Inits are immutable and uniqued by LLVM, so they can be read
+        // from several threads.
+        unsafe impl Send for $name<'_> {}
+        unsafe impl Sync for $name<'_> {}
+
         impl<'a> Display for $name<'a> {
             fn fmt(&self, formatter: &mut Formatter) -> fmt::Result {
-                let mut data = (formatter, Ok(()));
-
-                unsafe {
-                    tableGenInitPrint(
-                        self.raw,
-                        Some(print_callback),
-                        &mut data as *mut _ as *mut c_void,
-                    );
-                }
-
-                data.1
+                print_to_formatter(formatter, |buffer, reserve, data| unsafe {
+                    tableGenInitPrintToBuffer(self.raw, buffer, reserve, data)
+                })
             }
         }
 
@@ -284,8 +372,16 @@ impl<'a> From<BitsInit<'a>> for Vec<BitInit<'a>> {
 
 impl<'a> From<BitsInit<'a>> for Vec<bool> {
     fn from(value: BitsInit<'a>) -> Self {
-        (0..value.num_bits())
-            .map(|i| value.bit(i).expect("index within range").into())
+        let num_bits = value.num_bits();
+        let mut words = vec![0; num_bits.div_ceil(64)];
+        let mut known = vec![0; words.len()];
+        value.to_packed(&mut words, Some(&mut known));
+        (0..num_bits)
+            .map(|i| {
+                let mask = 1 << (i % 64);
+                assert!(known[i / 64] & mask != 0, "bit {i} is not resolved");
+                words[i / 64] & mask != 0
+            })
             .collect()
     }
 }
@@ -307,6 +403,28 @@ impl<'a> BitsInit<'a> {
         unsafe { tableGenBitsInitGetNumBits(self.raw, &mut len) };
         len
     }
+
+    /// Packs the bits into `words` without allocating, with bit `i` stored at
+    /// `(words[i / 64] >> (i % 64)) & 1`.
+    ///
+    /// If given, `known` receives a mask of the bits that are set to 0 or 1.
+    /// Unresolved bits, such as references to variables, are 0 in `words`.
+    ///
+    /// Returns false if `words` is shorter than `num_bits().div_ceil(64)`.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `known` differs in length from `words`.
+    pub fn to_packed(self, words: &mut [u64], known: Option<&mut [u64]>) -> bool {
+        let known = match known {
+            Some(known) => {
+                assert_eq!(known.len(), words.len());
+                known.as_mut_ptr()
+            }
+            None => std::ptr::null_mut(),
+        };
+        unsafe { tableGenBitsInitGetPacked(self.raw, words.as_mut_ptr(), known, words.len()) > 0 }
+    }
 }
 
 init!(IntInit);
@@ -402,6 +520,46 @@ impl<'a> DagInit<'a> {
     }
 }
 
+impl<'a> DagInit<'a> {
+    /// Returns all arguments of the dag with their names, fetched in a single
+    /// call. Unlike [`DagInit::args`], this includes unnamed arguments (with
+    /// an empty name) and untyped arguments (as [`TypedInit::Invalid`]).
+    pub fn to_vec(self) -> Vec<(&'a str, TypedInit<'a>)> {
+        let len = self.num_args();
+        let mut args = Vec::with_capacity(len);
+        let mut names = Vec::with_capacity(len);
+        let mut kinds = Vec::with_capacity(len);
+        unsafe {
+            tableGenDagRecordGetArgs(
+                self.raw,
+                args.as_mut_ptr(),
+                names.as_mut_ptr(),
+                kinds.as_mut_ptr(),
+                len,
+            );
+            args.set_len(len);
+            names.set_len(len);
+            kinds.set_len(len);
+        }
+        args.into_iter()
+            .zip(names)
+            .zip(kinds)
+            .map(|((arg, name), kind)| unsafe {
+                (
+                    node_name(name).unwrap_or_default(),
+                    TypedInit::from_raw_kind(arg, kind),
+                )
+            })
+            .collect()
+    }
+
+    /// Flattens the dag and all dags and lists nested in it into a table of
+    /// nodes in preorder, see [`InitNode`]. The dag itself is the first node.
+    pub fn flatten(self) -> Vec<InitNode<'a>> {
+        unsafe { flatten(self.raw) }
+    }
+}
+
 #[derive(Debug, Clone)]
 pub struct DagIter<'a> {
     dag: DagInit<'a>,
@@ -457,6 +615,30 @@ impl<'a> ListInit<'a> {
     }
 }
 
+impl<'a> ListInit<'a> {
+    /// Returns all elements of the list, fetched in a single call.
+    pub fn to_vec(self) -> Vec<TypedInit<'a>> {
+        let len = self.len();
+        let mut elements = Vec::with_capacity(len);
+        let mut kinds = Vec::with_capacity(len);
+        unsafe {
+            tableGenListRecordGetElements(self.raw, elements.as_mut_ptr(), kinds.as_mut_ptr(), len);
+            elements.set_len(len);
+            kinds.set_len(len);
+        }
+        elements
+            .into_iter()
+            .zip(kinds)
+            .map(|(element, kind)| unsafe { TypedInit::from_raw_kind(element, kind) })
+            .collect()
+    }
+
+    /// Same as [`DagInit::flatten`], for a list.
+    pub fn flatten(self) -> Vec<InitNode<'a>> {
+        unsafe { flatten(self.raw) }
+    }
+}
+
 #[derive(Debug, Clone)]
 pub struct ListIter<'a> {
     list: ListInit<'a>,
@@ -477,6 +659,51 @@ impl<'a> Iterator for ListIter<'a> {
     }
 }
 
+/// A node of a flattened dag or list, see [`DagInit::flatten`].
+///
+/// The children of a node directly follow it, and the nodes at indices
+/// `index + 1..end` form its subtree.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct InitNode<'a> {
+    pub init: TypedInit<'a>,
+    /// The operator of a dag or the record of a def.
+    pub record: Option<Record<'a>>,
+    /// The name of the argument if the parent is a dag.
+    pub name: Option<&'a str>,
+    /// The index of the parent node, `None` for the root.
+    pub parent: Option<usize>,
+    pub num_children: usize,
+    pub end: usize,
+}
+
+unsafe fn node_name<'a>(name: TableGenStringRef) -> Option<&'a str> {
+    if name.len == 0 {
+        return None;
+    }
+    StringRef::from_raw(name).try_into().ok()
+}
+
+unsafe fn flatten<'a>(raw: TableGenTypedInitRef) -> Vec<InitNode<'a>> {
+    let mut len = 0;
+    let nodes = tableGenInitFlatten(raw, &mut len);
+    if nodes.is_null() {
+        return Vec::new();
+    }
+    let result = std::slice::from_raw_parts(nodes, len)
+        .iter()
+        .map(|node| InitNode {
+            init: TypedInit::from_raw_kind(node.init, node.kind),
+            record: (!node.record.is_null()).then(|| Record::from_raw(node.record)),
+            name: node_name(node.name),
+            parent: (node.parent != u32::MAX).then_some(node.parent as usize),
+            num_children: node.num_children as usize,
+            end: node.end as usize,
+        })
+        .collect();
+    tableGenInitNodeArrayFree(nodes);
+    result
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -515,6 +742,41 @@ mod tests {
         vec![false, true, false, false]
     );
     test_init!(int, "int a = 42;", 42);
+
+    #[test]
+    fn packed_bits() {
+        let rk = TableGenParser::new()
+            .add_source(
+                "
+                class I<bits<2> op> {
+                    bits<70> Inst;
+                    let Inst{69} = 1;
+                    let Inst{65-64} = op;
+                    let Inst{3-0} = 0b1010;
+                    bits<2> x;
+                    let Inst{5-4} = x;
+                }
+                def A : I<0b10>;
+                ",
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let inst: BitsInit = rk
+            .def("A")
+            .expect("def A exists")
+            .value("Inst")
+            .expect("field Inst exists")
+            .init
+            .as_bits()
+            .expect("is bits init");
+        let mut words = [u64::MAX; 2];
+        let mut known = [0; 2];
+        assert!(inst.to_packed(&mut words, Some(&mut known)));
+        assert_eq!(words, [0b1010, 0b10_0010]);
+        assert_eq!(known, [0b1111, 0b10_0011]);
+        assert!(!inst.to_packed(&mut words[..1], None));
+    }
     test_init!(string, "string a = \"hi\";", "hi");
 
     #[test]
@@ -591,4 +853,108 @@ mod tests {
         assert_eq!(iter.clone().nth(2).unwrap().try_into(), Ok(2));
         assert_eq!(iter.clone().nth(3).unwrap().try_into(), Ok(3));
     }
+
+    #[test]
+    fn flatten() {
+        let rk = TableGenParser::new()
+            .add_source(
+                "
+                def ins;
+                def out;
+                def X;
+                def A {
+                    dag d = (ins X:$a, (out 1, ?), [1, 2]:$l, \"s\");
+                }
+                ",
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let d: DagInit = rk
+            .def("A")
+            .expect("def A exists")
+            .value("d")
+            .expect("field d exists")
+            .try_into()
+            .expect("is dag init");
+
+        let args = d.to_vec();
+        assert_eq!(args.len(), 4);
+        assert_eq!(args[0].0, "a");
+        assert_eq!(Record::try_from(args[0].1).map(|r| r.name()), Ok(Ok("X")));
+        assert_eq!(args[1].0, "");
+        assert_eq!(args[2].1.as_list().map(|l| l.to_vec().len()), Ok(2));
+
+        let nodes = d.flatten();
+        let summary: Vec<_> = nodes
+            .iter()
+            .map(|node| (node.parent, node.num_children, node.end, node.name))
+            .collect();
+        assert_eq!(
+            summary,
+            [
+                (None, 4, 9, None),
+                (Some(0), 0, 2, Some("a")),
+                (Some(0), 2, 5, None),
+                (Some(2), 0, 4, None),
+                (Some(2), 0, 5, None),
+                (Some(0), 2, 8, Some("l")),
+                (Some(5), 0, 7, None),
+                (Some(5), 0, 8, None),
+                (Some(0), 0, 9, None),
+            ]
+        );
+        assert_eq!(nodes[0].record.map(|r| r.name()), Some(Ok("ins")));
+        assert_eq!(nodes[1].record.map(|r| r.name()), Some(Ok("X")));
+        assert_eq!(nodes[2].record.map(|r| r.name()), Some(Ok("out")));
+        assert_eq!(nodes[3].init.try_into(), Ok(1));
+        assert_eq!(nodes[4].init, TypedInit::Invalid);
+        assert_eq!(nodes[8].init.try_into(), Ok("s"));
+    }
+
+    #[test]
+    fn decode() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class C<int n> {
+                    int i = n;
+                }
+                class K;
+                def X : K;
+                def A : C<3> {
+                    bit b = 1;
+                    bits<3> bs = 0b101;
+                    string s = "str";
+                    code c = [{ x }];
+                    list<int> l = [1, 2];
+                    dag d = (X 1, 2, 3);
+                    K x = X;
+                }
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let a = rk.def("A").expect("def A exists");
+        let value = |name| a.value(name).expect("field exists").init.decode();
+        assert_eq!(value("i"), InitValue::Int(3));
+        assert_eq!(value("b"), InitValue::Bit(true));
+        assert!(matches!(value("bs"), InitValue::Bits(_, 3)));
+        assert_eq!(value("s"), InitValue::String(b"str"));
+        assert_eq!(value("c"), InitValue::Code(b" x "));
+        assert!(matches!(value("l"), InitValue::List(_, 2)));
+        assert!(matches!(value("d"), InitValue::Dag(_, 3)));
+        assert_eq!(value("x"), InitValue::Def(rk.def("X").unwrap()));
+        assert!(matches!(a.value("c").unwrap().init, TypedInit::Code(_)));
+        for field in a.values() {
+            assert_eq!(field.decode(), field.init.decode());
+        }
+
+        let class = rk.class("C").expect("class C exists");
+        assert!(matches!(
+            class.value("i").unwrap().init.decode(),
+            InitValue::Unresolved(TypedInit::Int(_))
+        ));
+    }
 }
@@ -0,0 +1,253 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! This module contains a record keeper that only parses the records that are
+//! looked up.
+//!
+//! [`TableGenParser::parse_lazy`](crate::TableGenParser::parse_lazy) splits
+//! the sources into top-level statements without parsing them. Looking up a
+//! record parses the statements that define it, together with the classes,
+//! defs and `let` blocks they refer to. When a record cannot be found this
+//! way, for example because its name is computed by a multiclass, all sources
+//! are parsed once, so lookups find the same records as
+//! [`TableGenParser::parse`](crate::TableGenParser::parse). Looking up a name
+//! that no statement declares parses all sources as well, unless the sources
+//! contain no `foreach`, `if`, `defset`, anonymous or computed names, or
+//! multiclass referring to `NAME`. A failed full parse is not retried.
+//! Statements without a name of their own, such as `foreach`, anonymous defs
+//! and asserts, are part of every parse. Anonymous records are numbered per
+//! parse, so their names may differ from a full parse.
+//!
+//! Records found in different parses are distinct, so records returned by a
+//! [`LazyRecordKeeper`] should be compared by name.
+//!
+//! ```rust
+//! use tblgen_alt::TableGenParser;
+//!
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let keeper = TableGenParser::new()
+//!     .add_source("class A { int i = 4; } def D: A; def E: A;")?
+//!     .parse_lazy()?;
+//! assert_eq!(keeper.def("D")?.int_value("i"), Ok(4));
+//! assert!(!keeper.is_complete());
+//! # Ok(())
+//! # }
+//! ```
+
+use crate::{
+    error::TableGenError,
+    raw::{
+        tableGenLazyRecordKeeperFree, tableGenLazyRecordKeeperGetClass,
+        tableGenLazyRecordKeeperGetDef, tableGenLazyRecordKeeperGetNumParses,
+        tableGenLazyRecordKeeperIsComplete, tableGenLazyRecordKeeperLoad, tableGenParseLazy,
+        TableGenLazyRecordKeeperRef,
+    },
+    string_ref::StringRef,
+    Error, Record, TableGenParser,
+};
+
+/// Record keeper that parses records on first use, see the
+/// [module documentation](self).
+#[derive(Debug)]
+pub struct LazyRecordKeeper<'s> {
+    raw: TableGenLazyRecordKeeperRef,
+    parser: TableGenParser<'s>,
+}
+
+// Lookups and loads are serialized by the C API.
+unsafe impl Send for LazyRecordKeeper<'_> {}
+unsafe impl Sync for LazyRecordKeeper<'_> {}
+
+impl<'s> LazyRecordKeeper<'s> {
+    pub(crate) fn new(parser: TableGenParser<'s>) -> Result<Self, Error> {
+        let raw = unsafe { tableGenParseLazy(parser.raw) };
+        if raw.is_null() {
+            Err(TableGenError::InvalidSource.into())
+        } else {
+            Ok(Self { raw, parser })
+        }
+    }
+
+    /// Returns the class with the given name, parsing it if needed.
+    pub fn class(&self, name: &str) -> Result<Record, Error> {
+        unsafe {
+            let class = tableGenLazyRecordKeeperGetClass(self.raw, StringRef::from(name).to_raw());
+            if class.is_null() {
+                Err(TableGenError::MissingClass(name.into()).into())
+            } else {
+                Ok(Record::from_raw(class))
+            }
+        }
+    }
+
+    /// Returns the definition with the given name, parsing it if needed.
+    pub fn def(&self, name: &str) -> Result<Record, Error> {
+        unsafe {
+            let def = tableGenLazyRecordKeeperGetDef(self.raw, StringRef::from(name).to_raw());
+            if def.is_null() {
+                Err(TableGenError::MissingDef(name.into()).into())
+            } else {
+                Ok(Record::from_raw(def))
+            }
+        }
+    }
+
+    /// Parses the records with the given names in a single parse, which is
+    /// faster than looking them up one by one.
+    pub fn load(&self, names: &[&str]) -> Result<(), Error> {
+        let names: Vec<_> = names
+            .iter()
+            .map(|&name| unsafe { StringRef::from(name).to_raw() })
+            .collect();
+        if unsafe { tableGenLazyRecordKeeperLoad(self.raw, names.as_ptr(), names.len()) > 0 } {
+            Ok(())
+        } else {
+            Err(TableGenError::Parse.into())
+        }
+    }
+
+    /// Returns the number of times (part of) the sources were parsed.
+    pub fn num_parses(&self) -> usize {
+        unsafe { tableGenLazyRecordKeeperGetNumParses(self.raw) }
+    }
+
+    /// Returns true if all sources were parsed.
+    pub fn is_complete(&self) -> bool {
+        unsafe { tableGenLazyRecordKeeperIsComplete(self.raw) > 0 }
+    }
+
+    /// Returns the parser this keeper was created from.
+    pub fn parser(&self) -> &TableGenParser<'s> {
+        &self.parser
+    }
+}
+
+impl Drop for LazyRecordKeeper<'_> {
+    fn drop(&mut self) {
+        unsafe {
+            tableGenLazyRecordKeeperFree(self.raw);
+        }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+
+    const SOURCE: &str = r#"
+        class A<int v> { int x = v; }
+        class B : A<2>;
+        def U : A<1>;
+        let x = 5 in {
+            def V : B;
+        }
+        multiclass M { def _a : A<3>; }
+        defm W : M;
+        foreach i = 0...1 in
+            def F#i : A<i>;
+    "#;
+
+    #[test]
+    fn lazy() {
+        let keeper = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .parse_lazy()
+            .expect("valid tablegen");
+        assert_eq!(keeper.num_parses(), 0);
+
+        let u = keeper.def("U").unwrap();
+        assert_eq!(u.int_value("x"), Ok(1));
+        assert!(u.subclass_of("A"));
+        assert_eq!(keeper.num_parses(), 1);
+        assert_eq!(keeper.def("U"), Ok(u));
+        assert_eq!(keeper.num_parses(), 1);
+
+        assert_eq!(keeper.def("V").unwrap().int_value("x"), Ok(5));
+        assert_eq!(keeper.def("W_a").unwrap().int_value("x"), Ok(3));
+        assert_eq!(keeper.class("B").unwrap().name(), Ok("B"));
+        assert!(!keeper.is_complete());
+
+        // Statements without a fixed name are part of every parse.
+        assert_eq!(keeper.def("F1").unwrap().int_value("x"), Ok(1));
+        assert!(!keeper.is_complete());
+
+        // Names that cannot be found cause a full parse.
+        assert!(keeper.def("G").is_err());
+        assert!(keeper.is_complete());
+        assert!(keeper.load(&["U", "G"]).is_ok());
+
+        assert!(TableGenParser::new().parse_lazy().is_err());
+    }
+
+    #[test]
+    fn assert() {
+        let keeper = TableGenParser::new()
+            .add_source("class A<int v> { assert !gt(v, 0), \"v\"; } def B : A<1>; def : A<0>;")
+            .unwrap()
+            .parse_lazy()
+            .unwrap();
+        assert!(keeper.def("B").is_err());
+        assert!(keeper.load(&["B"]).is_err());
+    }
+
+    #[test]
+    fn unknown() {
+        let keeper = TableGenParser::new()
+            .add_source("class A; def B : A; multiclass M { def _a : A; } defm C : M;")
+            .unwrap()
+            .parse_lazy()
+            .unwrap();
+        // No statement can define a record that is not in the index.
+        assert!(keeper.def("D").is_err());
+        assert!(keeper.class("B").is_err());
+        assert_eq!(keeper.num_parses(), 0);
+        assert!(keeper.def("C_a").is_ok());
+        assert!(!keeper.is_complete());
+    }
+
+    #[test]
+    fn exists() {
+        let source = r#"
+            class A;
+            def X : A;
+            def Y { int e = !exists<A>("X"); }
+            def Z { int e = !exists<A>("X" # ""); }
+        "#;
+        let full = TableGenParser::new()
+            .add_source(source)
+            .unwrap()
+            .parse()
+            .unwrap();
+        let keeper = TableGenParser::new()
+            .add_source(source)
+            .unwrap()
+            .parse_lazy()
+            .unwrap();
+        for name in ["Y", "Z"] {
+            let value = keeper.def(name).unwrap().int_value("e");
+            assert_eq!(value, full.def(name).unwrap().int_value("e"));
+            assert_eq!(value, Ok(1));
+        }
+    }
+
+    #[test]
+    fn load() {
+        let keeper = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .parse_lazy()
+            .unwrap();
+        assert!(keeper.load(&["U", "V"]).is_ok());
+        assert_eq!(keeper.num_parses(), 1);
+        assert!(keeper.def("U").is_ok());
+        assert!(keeper.def("V").is_ok());
+        assert_eq!(keeper.num_parses(), 1);
+    }
+}
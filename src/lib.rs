@@ -77,12 +77,18 @@
 //! this crate is not stable. Furthermore, the safe wrapper does not provide a
 //! stable interface either, since this crate is still in early development.
 
+pub mod diff;
 pub mod error;
 pub mod init;
+pub mod lazy;
+pub mod parallel;
+pub mod predicate;
 /// TableGen records and record values.
 pub mod record;
 /// TableGen record keeper.
 pub mod record_keeper;
+pub mod snapshot;
+pub mod stats;
 mod string_ref;
 mod util;
 
@@ -96,34 +102,30 @@ pub mod raw {
 }
 
 use std::ffi::CStr;
-use std::ffi::CString;
 use std::marker::PhantomData;
-use std::sync::Mutex;
 
 pub use error::Error;
-use error::TableGenError;
+use error::{LineColumn, SourceLocation, TableGenError};
 pub use init::TypedInit;
+pub use lazy::LazyRecordKeeper;
 pub use record::Record;
 pub use record::RecordValue;
 pub use record_keeper::RecordKeeper;
+pub use snapshot::Snapshot;
+pub use stats::Stats;
 
 use raw::{
-    tableGenAddIncludePath, tableGenAddSource, tableGenAddSourceFile, tableGenFree, tableGenGet,
-    tableGenParse, TableGenParserRef,
+    tableGenAddIncludePath, tableGenAddSharedSourceFile, tableGenAddSource, tableGenAddSourceFile,
+    tableGenAddSourceRef, tableGenFree, tableGenGet, tableGenLoadSnapshot, tableGenParse,
+    tableGenParseBatch, tableGenReload, tableGenResolveLocations, TableGenParserRef,
 };
 use string_ref::StringRef;
 
-// TableGen only exposes `TableGenParseFile` in its API.
-// However, this function uses global state and therefore it is not thread safe.
-// Until they remove this hack, we have to deal with it ourselves.
-static TABLEGEN_PARSE_LOCK: Mutex<()> = Mutex::new(());
-
 /// Builder struct that parses TableGen source files and builds a
 /// [`RecordKeeper`].
 #[derive(Debug, PartialEq, Eq)]
 pub struct TableGenParser<'s> {
     raw: TableGenParserRef,
-    source_strings: Vec<CString>,
     _source_ref: PhantomData<&'s str>,
 }
 
@@ -138,7 +140,6 @@ impl<'s> TableGenParser<'s> {
     pub fn new() -> Self {
         Self {
             raw: unsafe { tableGenGet() },
-            source_strings: Vec::new(),
             _source_ref: PhantomData,
         }
     }
@@ -158,6 +159,20 @@ impl<'s> TableGenParser<'s> {
         }
     }
 
+    /// Reads TableGen source code from the file at the given path through a
+    /// process-wide cache.
+    ///
+    /// Parsers that add the same file share a single, memory-mapped copy of
+    /// it as long as the file does not change. Files pulled in through
+    /// `include` are read as usual.
+    pub fn add_shared_source_file(self, source: &str) -> Result<Self, Error> {
+        if unsafe { tableGenAddSharedSourceFile(self.raw, StringRef::from(source).to_raw()) > 0 } {
+            Ok(self)
+        } else {
+            Err(TableGenError::InvalidSource.into())
+        }
+    }
+
     /// Adds the given TableGen source string.
     ///
     /// The string must be null-terminated and is not copied, hence it is
@@ -172,16 +187,9 @@ impl<'s> TableGenParser<'s> {
 
     /// Adds the given TableGen source string.
     ///
-    /// The string is copied into a null-terminated [`CString`].
-    pub fn add_source(mut self, source: &str) -> Result<Self, Error> {
-        let string = CString::new(source).map_err(TableGenError::from)?;
-        self.source_strings.push(string);
-        if unsafe {
-            tableGenAddSource(
-                self.raw,
-                self.source_strings.last().expect("not empty").as_ptr(),
-            ) > 0
-        } {
+    /// The string is copied once by the parser.
+    pub fn add_source(self, source: &str) -> Result<Self, Error> {
+        if unsafe { tableGenAddSourceRef(self.raw, StringRef::from(source).to_raw()) > 0 } {
             Ok(self)
         } else {
             Err(TableGenError::InvalidSource.into())
@@ -192,24 +200,87 @@ impl<'s> TableGenParser<'s> {
         SourceInfo(self)
     }
 
+    /// Returns the timings and record counts of this parser, see
+    /// [`stats`](crate::stats).
+    pub fn stats(&self) -> Stats {
+        Stats::get(self.raw)
+    }
+
+    /// Loads a [`Snapshot`] previously saved with
+    /// [`RecordKeeper::save_snapshot`].
+    ///
+    /// Returns `None` if there is no valid snapshot at the given path, or if
+    /// it was saved from different sources or include paths than the ones
+    /// added to this parser, or if any included file changed since.
+    pub fn load_snapshot(&self, path: &str) -> Option<Snapshot> {
+        unsafe {
+            Snapshot::from_raw(tableGenLoadSnapshot(
+                self.raw,
+                StringRef::from(path).to_raw(),
+            ))
+        }
+    }
+
+    /// Returns a new parser with the same include paths and sources, with
+    /// source files read again from disk.
+    pub(crate) fn reload(&self) -> Result<TableGenParser<'static>, Error> {
+        let raw = unsafe { tableGenReload(self.raw) };
+        if raw.is_null() {
+            Err(TableGenError::InvalidSource.into())
+        } else {
+            Ok(TableGenParser {
+                raw,
+                _source_ref: PhantomData,
+            })
+        }
+    }
+
     /// Parses the TableGen source files and returns a [`RecordKeeper`].
     ///
     /// Due to limitations of TableGen, parsing TableGen is not thread-safe.
-    /// In order to provide thread-safety, this method ensures that any
+    /// In order to provide thread-safety, the C API ensures that any
     /// concurrent parse operations are executed sequentially.
     pub fn parse(self) -> Result<RecordKeeper<'s>, Error> {
         unsafe {
-            let guard = TABLEGEN_PARSE_LOCK.lock().unwrap();
             let keeper = tableGenParse(self.raw);
-            let res = if !keeper.is_null() {
+            if !keeper.is_null() {
                 Ok(RecordKeeper::from_raw(keeper, self))
             } else {
                 Err(TableGenError::Parse.into())
-            };
-            drop(guard);
-            res
+            }
         }
     }
+
+    /// Splits the TableGen sources into statements without parsing them, and
+    /// returns a [`LazyRecordKeeper`] that only parses the records that are
+    /// looked up, see [`lazy`](crate::lazy). Fails if there are no sources.
+    pub fn parse_lazy(self) -> Result<LazyRecordKeeper<'s>, Error> {
+        LazyRecordKeeper::new(self)
+    }
+
+    /// Parses several independent parsers in one call and returns a
+    /// [`RecordKeeper`] (or error) for each of them, in the same order.
+    ///
+    /// This is a convenience wrapper: the parsers are still parsed one after
+    /// another under the same lock as [`parse`](Self::parse), so it is not
+    /// faster than parsing them in a loop. Source files are read when they are
+    /// added, not while the lock is held.
+    pub fn parse_batch(parsers: Vec<Self>) -> Vec<Result<RecordKeeper<'s>, Error>> {
+        let mut raw: Vec<_> = parsers.iter().map(|parser| parser.raw).collect();
+        let mut keepers = vec![std::ptr::null_mut(); raw.len()];
+        unsafe { tableGenParseBatch(raw.as_mut_ptr(), raw.len(), keepers.as_mut_ptr()) };
+        parsers
+            .into_iter()
+            .zip(keepers)
+            .map(|(parser, keeper)| {
+                if !keeper.is_null() {
+                    Ok(unsafe { RecordKeeper::from_raw(keeper, parser) })
+                } else {
+                    Err(TableGenError::Parse.into())
+                }
+            })
+            .collect()
+    }
 }
 
 impl<'s> Drop for TableGenParser<'s> {
@@ -226,3 +297,17 @@ impl<'s> Drop for TableGenParser<'s> {
 /// [`RecordKeeper::source_info`](RecordKeeper::source_info).
 #[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub struct SourceInfo<'a>(pub(crate) &'a TableGenParser<'a>);
+
+impl<'a> SourceInfo<'a> {
+    /// Resolves the buffer, line and column of the primary location of each
+    /// given [`SourceLocation`] in a single call.
+    pub fn resolve(&self, locations: &[SourceLocation]) -> Vec<LineColumn> {
+        let locs: Vec<_> = locations.iter().map(SourceLocation::primary).collect();
+        let mut resolved = Vec::with_capacity(locs.len());
+        unsafe {
+            tableGenResolveLocations(self.0.raw, locs.as_ptr(), locs.len(), resolved.as_mut_ptr());
+            resolved.set_len(locs.len());
+        }
+        resolved
+    }
+}
@@ -0,0 +1,210 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! Parallel queries over records.
+//!
+//! A parsed [`RecordKeeper`](crate::RecordKeeper) is never modified, so its
+//! records, record values and inits can be read from several threads at
+//! once. The functions in this module call a closure for every record of a
+//! slice from one thread per hardware thread, balancing uneven per-record
+//! work between them.
+//!
+//! ```rust
+//! use tblgen_alt::{parallel, RecordKeeper, TableGenParser};
+//!
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let keeper: RecordKeeper = TableGenParser::new()
+//!     .add_source(
+//!         r#"
+//!         class Reg<int size> { int Size = size; }
+//!         def R0 : Reg<32>;
+//!         def R1 : Reg<64>;
+//!         "#,
+//!     )?
+//!     .parse()?;
+//! let regs = keeper.all_derived_definitions("Reg");
+//! let sizes = parallel::map(regs.as_slice(), |def| def.int_value("Size").unwrap());
+//! assert_eq!(sizes, [32, 64]);
+//! # Ok(())
+//! # }
+//! ```
+
+use std::{
+    any::Any,
+    ffi::c_void,
+    mem::MaybeUninit,
+    panic::{self, AssertUnwindSafe},
+    sync::{
+        atomic::{AtomicBool, Ordering},
+        Mutex,
+    },
+};
+
+use crate::{
+    raw::{tableGenRecordsParallelForEach, TableGenRecordRef},
+    record::Record,
+};
+
+struct Context<'f, F> {
+    f: &'f F,
+    panicked: AtomicBool,
+    panic: Mutex<Option<Box<dyn Any + Send>>>,
+}
+
+unsafe extern "C" fn for_each_callback<'a, F: Fn(usize, Record<'a>) + Sync>(
+    record: TableGenRecordRef,
+    index: usize,
+    data: *mut c_void,
+) {
+    let context = &*(data as *const Context<F>);
+    if context.panicked.load(Ordering::Relaxed) {
+        return;
+    }
+    // Unwinding into C++ is not allowed, so a panic is stored and resumed
+    // once all threads have finished.
+    let result = panic::catch_unwind(AssertUnwindSafe(|| {
+        (context.f)(index, Record::from_raw(record))
+    }));
+    if let Err(payload) = result {
+        context.panicked.store(true, Ordering::Relaxed);
+        *context.panic.lock().unwrap_or_else(|e| e.into_inner()) = Some(payload);
+    }
+}
+
+fn for_each_index<'a, F: Fn(usize, Record<'a>) + Sync>(records: &[Record<'a>], f: F) {
+    let context = Context {
+        f: &f,
+        panicked: AtomicBool::new(false),
+        panic: Mutex::new(None),
+    };
+    unsafe {
+        tableGenRecordsParallelForEach(
+            records.as_ptr() as *const TableGenRecordRef,
+            records.len(),
+            Some(for_each_callback::<'a, F>),
+            &context as *const _ as *mut c_void,
+            0,
+        )
+    };
+    if let Some(payload) = context
+        .panic
+        .into_inner()
+        .unwrap_or_else(|e| e.into_inner())
+    {
+        panic::resume_unwind(payload);
+    }
+}
+
+/// Calls `f` for every record, in no particular order.
+///
+/// If `f` panics, the remaining records are skipped and the panic is resumed
+/// on the calling thread.
+pub fn for_each<'a>(records: &[Record<'a>], f: impl Fn(Record<'a>) + Sync) {
+    for_each_index(records, |_, record| f(record))
+}
+
+struct Slots<T>(*mut MaybeUninit<T>);
+
+// Every slot is written by exactly one thread.
+unsafe impl<T: Send> Sync for Slots<T> {}
+
+impl<T> Slots<T> {
+    unsafe fn write(&self, index: usize, value: T) {
+        (*self.0.add(index)).write(value);
+    }
+}
+
+/// Returns the result of `f` for every record, in the order of the records.
+pub fn map<'a, T: Send>(records: &[Record<'a>], f: impl Fn(Record<'a>) -> T + Sync) -> Vec<T> {
+    let mut results = Vec::<MaybeUninit<T>>::with_capacity(records.len());
+    let slots = Slots(results.as_mut_ptr());
+    // If `f` panics, the results computed so far are leaked.
+    for_each_index(records, |index, record| unsafe {
+        slots.write(index, f(record))
+    });
+    unsafe { results.set_len(records.len()) };
+    results
+        .into_iter()
+        .map(|result| unsafe { result.assume_init() })
+        .collect()
+}
+
+/// Returns the records for which `f` returns true, in their original order.
+pub fn filter<'a>(
+    records: &[Record<'a>],
+    f: impl Fn(Record<'a>) -> bool + Sync,
+) -> Vec<Record<'a>> {
+    map(records, f)
+        .into_iter()
+        .zip(records)
+        .filter_map(|(keep, &record)| keep.then_some(record))
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{RecordKeeper, TableGenParser};
+
+    fn keeper() -> RecordKeeper<'static> {
+        let source: String = (0..500)
+            .map(|i| format!("def D{} : A<{}>;\n", i, i))
+            .collect();
+        TableGenParser::new()
+            .add_source(&format!("class A<int v> {{ int V = v; }}\n{}", source))
+            .unwrap()
+            .parse()
+            .expect("valid tablegen")
+    }
+
+    #[test]
+    fn send_sync() {
+        fn assert_send_sync<T: Send + Sync>() {}
+        assert_send_sync::<RecordKeeper>();
+        assert_send_sync::<Record>();
+        assert_send_sync::<crate::RecordValue>();
+        assert_send_sync::<crate::TypedInit>();
+    }
+
+    #[test]
+    fn map_filter() {
+        let rk = keeper();
+        let defs = rk.all_derived_definitions("A");
+        let records = defs.as_slice();
+        assert_eq!(records.len(), 500);
+
+        let values = map(records, |def| def.int_value("V").unwrap());
+        let expected: Vec<_> = records
+            .iter()
+            .map(|def| def.int_value("V").unwrap())
+            .collect();
+        assert_eq!(values, expected);
+
+        let even = filter(records, |def| def.int_value("V").unwrap() % 2 == 0);
+        assert_eq!(even.len(), 250);
+        assert!(even.iter().all(|def| def.int_value("V").unwrap() % 2 == 0));
+
+        let total = std::sync::atomic::AtomicI64::new(0);
+        rk.par_for_each_def(|def| {
+            total.fetch_add(def.int_value("V").unwrap(), Ordering::Relaxed);
+        });
+        assert_eq!(total.into_inner(), (0..500).sum());
+    }
+
+    #[test]
+    #[should_panic(expected = "failed on D7")]
+    fn panic() {
+        let rk = keeper();
+        for_each(rk.all_derived_definitions("A").as_slice(), |def| {
+            if def.name() == Ok("D7") {
+                panic!("failed on D7");
+            }
+        });
+    }
+}
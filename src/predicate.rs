@@ -0,0 +1,275 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! This module contains filters over records that are evaluated by the C++
+//! layer.
+//!
+//! A [`Predicate`] is built once from conditions on the classes and fields of
+//! records. Filtering records with it evaluates the conditions natively and
+//! in parallel, so that only the matching records cross the FFI boundary,
+//! instead of several calls per record.
+//!
+//! ```rust
+//! use tblgen_alt::predicate::{Op, Predicate};
+//! use tblgen_alt::{RecordKeeper, TableGenParser};
+//!
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let keeper: RecordKeeper = TableGenParser::new()
+//!     .add_source(
+//!         r#"
+//!         class Instruction<int size, bit branch> {
+//!             int Size = size;
+//!             bit isBranch = branch;
+//!         }
+//!         def JMP : Instruction<2, 1>;
+//!         def JMPL : Instruction<8, 1>;
+//!         def ADD : Instruction<8, 0>;
+//!         "#,
+//!     )?
+//!     .parse()?;
+//! let mut predicate = Predicate::new(&keeper);
+//! let conditions = [
+//!     predicate.subclass_of("Instruction"),
+//!     predicate.int("isBranch", Op::Eq, 1),
+//!     predicate.int("Size", Op::Gt, 4),
+//! ];
+//! let long_branch = predicate.and(&conditions);
+//! let names: Vec<_> = predicate
+//!     .filter_defs(long_branch)
+//!     .map(|def| def.name().unwrap())
+//!     .collect();
+//! assert_eq!(names, ["JMPL"]);
+//! # Ok(())
+//! # }
+//! ```
+
+use crate::{
+    raw::{
+        tableGenPredicateAnd, tableGenPredicateCompareInt, tableGenPredicateCompareString,
+        tableGenPredicateCreate, tableGenPredicateDefSubclassOf, tableGenPredicateFilter,
+        tableGenPredicateFilterDefs, tableGenPredicateFree, tableGenPredicateHasField,
+        tableGenPredicateMatches, tableGenPredicateNot, tableGenPredicateOr,
+        tableGenPredicateSubclassOf, TableGenPredicateNode, TableGenPredicateOp,
+        TableGenPredicateRef, TableGenRecordRef,
+    },
+    record_keeper::RecordIter,
+    string_ref::StringRef,
+    Record, RecordKeeper,
+};
+
+/// Comparison of a field with a constant.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Op {
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+}
+
+impl Op {
+    fn to_raw(self) -> TableGenPredicateOp::Type {
+        match self {
+            Self::Eq => TableGenPredicateOp::TableGenPredicateEq,
+            Self::Ne => TableGenPredicateOp::TableGenPredicateNe,
+            Self::Lt => TableGenPredicateOp::TableGenPredicateLt,
+            Self::Le => TableGenPredicateOp::TableGenPredicateLe,
+            Self::Gt => TableGenPredicateOp::TableGenPredicateGt,
+            Self::Ge => TableGenPredicateOp::TableGenPredicateGe,
+        }
+    }
+}
+
+/// A condition of a [`Predicate`], which is only meaningful for the
+/// predicate that created it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Node(TableGenPredicateNode);
+
+/// Filter over the records of a [`RecordKeeper`], see the
+/// [module documentation](self).
+///
+/// Conditions on fields or classes that do not exist in the keeper never
+/// match. Fields that refer to other fields are resolved, as by
+/// [`Record::resolved_value`].
+#[derive(Debug)]
+pub struct Predicate<'a> {
+    raw: TableGenPredicateRef,
+    keeper: &'a RecordKeeper<'a>,
+}
+
+// Building requires a mutable reference, and evaluation does not modify the
+// predicate.
+unsafe impl Send for Predicate<'_> {}
+unsafe impl Sync for Predicate<'_> {}
+
+impl<'a> Predicate<'a> {
+    /// Creates a predicate over the records of the given keeper.
+    pub fn new(keeper: &'a RecordKeeper<'a>) -> Self {
+        Self {
+            raw: unsafe { tableGenPredicateCreate(keeper.raw) },
+            keeper,
+        }
+    }
+
+    fn field(&self, name: &str) -> u32 {
+        self.keeper.field_id(name).map_or(0, |id| id.0)
+    }
+
+    fn class(&self, name: &str) -> u32 {
+        self.keeper.class_id(name).map_or(0, |id| id.0)
+    }
+
+    /// Matches records deriving from the given class.
+    pub fn subclass_of(&mut self, class: &str) -> Node {
+        Node(unsafe { tableGenPredicateSubclassOf(self.raw, self.class(class)) })
+    }
+
+    /// Matches records with the given field.
+    pub fn has_field(&mut self, field: &str) -> Node {
+        Node(unsafe { tableGenPredicateHasField(self.raw, self.field(field)) })
+    }
+
+    /// Matches records with a bit, int or bits field for which
+    /// `field op value` holds. Bits are read as an unsigned integer.
+    pub fn int(&mut self, field: &str, op: Op, value: i64) -> Node {
+        Node(unsafe {
+            tableGenPredicateCompareInt(self.raw, self.field(field), op.to_raw(), value)
+        })
+    }
+
+    /// Matches records with a string or code field for which
+    /// `field op value` holds.
+    pub fn string(&mut self, field: &str, op: Op, value: &str) -> Node {
+        Node(unsafe {
+            tableGenPredicateCompareString(
+                self.raw,
+                self.field(field),
+                op.to_raw(),
+                StringRef::from(value).to_raw(),
+            )
+        })
+    }
+
+    /// Matches records with a field referring to a def deriving from the
+    /// given class.
+    pub fn def_subclass_of(&mut self, field: &str, class: &str) -> Node {
+        Node(unsafe {
+            tableGenPredicateDefSubclassOf(self.raw, self.field(field), self.class(class))
+        })
+    }
+
+    /// Matches records matching all given nodes.
+    pub fn and(&mut self, nodes: &[Node]) -> Node {
+        Node(unsafe { tableGenPredicateAnd(self.raw, nodes.as_ptr() as *const u32, nodes.len()) })
+    }
+
+    /// Matches records matching any of the given nodes.
+    pub fn or(&mut self, nodes: &[Node]) -> Node {
+        Node(unsafe { tableGenPredicateOr(self.raw, nodes.as_ptr() as *const u32, nodes.len()) })
+    }
+
+    /// Matches records not matching the given node.
+    pub fn not(&mut self, node: Node) -> Node {
+        Node(unsafe { tableGenPredicateNot(self.raw, node.0) })
+    }
+
+    /// Returns true if the record, which must belong to the keeper of the
+    /// predicate, matches the node.
+    pub fn matches(&self, node: Node, record: Record<'a>) -> bool {
+        unsafe { tableGenPredicateMatches(self.raw, node.0, record.raw) > 0 }
+    }
+
+    /// Returns the given records that match the node, in order.
+    pub fn filter(&self, node: Node, records: &[Record<'a>]) -> RecordIter<'a> {
+        unsafe {
+            RecordIter::from_raw_vector(tableGenPredicateFilter(
+                self.raw,
+                node.0,
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                0,
+            ))
+        }
+    }
+
+    /// Returns the defs of the keeper that match the node, in order.
+    pub fn filter_defs(&self, node: Node) -> RecordIter<'a> {
+        unsafe { RecordIter::from_raw_vector(tableGenPredicateFilterDefs(self.raw, node.0, 0)) }
+    }
+}
+
+impl Drop for Predicate<'_> {
+    fn drop(&mut self) {
+        unsafe { tableGenPredicateFree(self.raw) }
+    }
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::TableGenParser;
+
+    #[test]
+    fn predicate() {
+        let keeper = TableGenParser::new()
+            .add_source(
+                r#"
+                class Unit;
+                def ALU : Unit;
+                class Inst<string name, bits<4> size, Unit unit> {
+                    string Name = name;
+                    bits<4> Size = size;
+                    int Double = !mul(Size, 2);
+                    Unit U = unit;
+                }
+                def A : Inst<"add", 2, ALU>;
+                def B : Inst<"br", 8, ALU>;
+                def C;
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .unwrap();
+        let names = |records: RecordIter| -> Vec<_> {
+            records
+                .map(|record| record.name().unwrap().to_string())
+                .collect()
+        };
+        let mut predicate = Predicate::new(&keeper);
+        let inst = predicate.subclass_of("Inst");
+        let large = predicate.int("Size", Op::Ge, 4);
+        let add = predicate.string("Name", Op::Eq, "add");
+        let either = predicate.or(&[large, add]);
+        let neither = predicate.not(either);
+        let alu = predicate.def_subclass_of("U", "Unit");
+        let missing = predicate.int("Missing", Op::Eq, 0);
+
+        assert_eq!(names(predicate.filter_defs(inst)), ["A", "B"]);
+        assert_eq!(names(predicate.filter_defs(large)), ["B"]);
+        assert_eq!(names(predicate.filter_defs(either)), ["A", "B"]);
+        assert_eq!(names(predicate.filter_defs(neither)), ["ALU", "C"]);
+        assert_eq!(names(predicate.filter_defs(alu)), ["A", "B"]);
+        assert_eq!(predicate.filter_defs(missing).len(), 0);
+        let and = predicate.and(&[]);
+        assert_eq!(predicate.filter_defs(and).len(), 4);
+
+        let a = keeper.def("A").unwrap();
+        assert!(predicate.matches(add, a));
+        assert!(!predicate.matches(large, a));
+        let defs = keeper.all_derived_definitions("Inst");
+        assert_eq!(names(predicate.filter(add, defs.as_slice())), ["A"]);
+
+        // Fields of classes are resolved before they are compared.
+        let class = keeper.class("Inst").unwrap();
+        let double = predicate.int("Double", Op::Eq, 4);
+        assert!(!predicate.matches(double, class));
+        assert!(predicate.matches(double, a));
+    }
+}
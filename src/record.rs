@@ -9,21 +9,25 @@
 // except according to those terms.
 
 use paste::paste;
-use std::ffi::c_void;
 use std::marker::PhantomData;
 
 use crate::raw::{
-    tableGenRecordGetFirstValue, tableGenRecordGetLoc, tableGenRecordGetName,
-    tableGenRecordGetValue, tableGenRecordIsAnonymous, tableGenRecordIsSubclassOf,
-    tableGenRecordPrint, tableGenRecordValGetLoc, tableGenRecordValGetNameInit,
-    tableGenRecordValGetValue, tableGenRecordValNext, tableGenRecordValPrint, TableGenRecordRef,
-    TableGenRecordValRef,
+    tableGenRecordGetFirstValue, tableGenRecordGetLocSpan, tableGenRecordGetName,
+    tableGenRecordGetRecords, tableGenRecordGetResolvedValue, tableGenRecordGetValue,
+    tableGenRecordGetValueById, tableGenRecordHash, tableGenRecordIsAnonymous,
+    tableGenRecordIsSubclassOf, tableGenRecordIsSubclassOfId, tableGenRecordKeeperGetFieldName,
+    tableGenRecordPrintToBuffer, tableGenRecordValDecode, tableGenRecordValGetLocSpan,
+    tableGenRecordValGetNameInit, tableGenRecordValGetValue, tableGenRecordValNext,
+    tableGenRecordValPrintToBuffer, tableGenRecordsAreSubclassesOf, tableGenRecordsGetBitColumn,
+    tableGenRecordsGetDefColumn, tableGenRecordsGetDefIdColumn, tableGenRecordsGetIntColumn,
+    tableGenRecordsGetStringColumn, TableGenClassId, TableGenFieldId, TableGenRecordId,
+    TableGenRecordRef, TableGenRecordValRef,
 };
 
 use crate::error::{Error, SourceLoc, SourceLocation, TableGenError, WithLocation};
-use crate::init::{BitInit, DagInit, ListInit, StringInit, TypedInit};
+use crate::init::{BitInit, DagInit, InitValue, ListInit, StringInit, TypedInit};
 use crate::string_ref::StringRef;
-use crate::util::print_callback;
+use crate::util::print_to_formatter;
 use std::fmt::{self, Debug, Display, Formatter};
 
 /// An immutable reference to a TableGen record.
@@ -32,24 +36,22 @@ use std::fmt::{self, Debug, Display, Formatter};
 /// [`RecordKeeper`](crate::record_keeper::RecordKeeper) from which it is
 /// borrowed.
 #[derive(Clone, Copy, PartialEq, Eq)]
+#[repr(transparent)]
 pub struct Record<'a> {
-    raw: TableGenRecordRef,
+    pub(crate) raw: TableGenRecordRef,
     _reference: PhantomData<&'a TableGenRecordRef>,
 }
 
+// Records are never modified after parsing, so they can be read from several
+// threads, see [`parallel`](crate::parallel).
+unsafe impl Send for Record<'_> {}
+unsafe impl Sync for Record<'_> {}
+
 impl<'a> Display for Record<'a> {
     fn fmt(&self, formatter: &mut Formatter) -> fmt::Result {
-        let mut data = (formatter, Ok(()));
-
-        unsafe {
-            tableGenRecordPrint(
-                self.raw,
-                Some(print_callback),
-                &mut data as *mut _ as *mut c_void,
-            );
-        }
-
-        data.1
+        print_to_formatter(formatter, |buffer, reserve, data| unsafe {
+            tableGenRecordPrintToBuffer(self.raw, buffer, reserve, data)
+        })
     }
 }
 
@@ -61,6 +63,227 @@ impl<'a> Debug for Record<'a> {
     }
 }
 
+/// Interned name of a field, obtained with
+/// [`RecordKeeper::field_id`](crate::record_keeper::RecordKeeper::field_id).
+///
+/// Looking up a field by id avoids comparing field names. An id is only
+/// meaningful for records of the keeper that created it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+#[repr(transparent)]
+pub struct FieldId(pub(crate) TableGenFieldId);
+
+/// Interned class, obtained with
+/// [`RecordKeeper::class_id`](crate::record_keeper::RecordKeeper::class_id).
+///
+/// Testing whether a record derives from a class by id is a single bit test.
+/// An id is only meaningful for records of the keeper that created it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+#[repr(transparent)]
+pub struct ClassId(pub(crate) TableGenClassId);
+
+/// Dense id of a class or definition, obtained with
+/// [`RecordKeeper::record_id`](crate::record_keeper::RecordKeeper::record_id).
+///
+/// Classes are numbered before definitions, each in order, so tables of
+/// records can be vectors indexed by [`RecordId::index`] instead of maps
+/// keyed by name. An id is only meaningful for records of the keeper that
+/// created it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, PartialOrd, Ord, Hash)]
+#[repr(transparent)]
+pub struct RecordId(pub(crate) TableGenRecordId);
+
+impl RecordId {
+    /// Returns the position of the record in
+    /// [`RecordKeeper::record_table`](crate::record_keeper::RecordKeeper::record_table).
+    pub fn index(self) -> usize {
+        self.0 as usize - 1
+    }
+}
+
+impl ClassId {
+    /// Tests for all given records, which must belong to the same keeper,
+    /// whether they derive from this class in a single call.
+    ///
+    /// If given, `matches[i]` is set to whether `records[i]` derives from
+    /// the class. Returns the number of such records.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `matches` differs in length from `records`.
+    pub fn subclass_column(self, records: &[Record], matches: Option<&mut [bool]>) -> usize {
+        Self::all_subclass_column(&[self], records, matches)
+    }
+
+    /// Same as [`ClassId::subclass_column`], testing whether the records
+    /// derive from every one of the given classes.
+    pub fn all_subclass_column(
+        classes: &[ClassId],
+        records: &[Record],
+        matches: Option<&mut [bool]>,
+    ) -> usize {
+        let matches = valid_ptr(records.len(), matches);
+        // Every match is written as 0 or 1, both valid bools.
+        unsafe {
+            tableGenRecordsAreSubclassesOf(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                classes.as_ptr() as *const TableGenClassId,
+                classes.len(),
+                matches,
+            )
+        }
+    }
+}
+
+fn valid_ptr(len: usize, valid: Option<&mut [bool]>) -> *mut u8 {
+    match valid {
+        Some(valid) => {
+            assert_eq!(valid.len(), len);
+            valid.as_mut_ptr() as *mut u8
+        }
+        None => std::ptr::null_mut(),
+    }
+}
+
+impl FieldId {
+    /// Reads this field of all given records, which must belong to the same
+    /// keeper, as bits in a single call.
+    ///
+    /// If given, `valid[i]` is set to whether `records[i]` has this field
+    /// with type `bit`; otherwise `values[i]` is set to `false`. Returns the
+    /// number of valid values.
+    ///
+    /// # Panics
+    ///
+    /// Panics if `values` or `valid` differ in length from `records`.
+    pub fn bit_column(
+        self,
+        records: &[Record],
+        values: &mut [bool],
+        valid: Option<&mut [bool]>,
+    ) -> usize {
+        assert_eq!(values.len(), records.len());
+        let valid = valid_ptr(records.len(), valid);
+        // Every value is written as 0 or 1, both valid bools.
+        unsafe {
+            tableGenRecordsGetBitColumn(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                self.0,
+                values.as_mut_ptr() as *mut i8,
+                valid,
+            )
+        }
+    }
+
+    /// Reads this field of all given records as integers, see
+    /// [`bit_column`](Self::bit_column).
+    pub fn int_column(
+        self,
+        records: &[Record],
+        values: &mut [i64],
+        valid: Option<&mut [bool]>,
+    ) -> usize {
+        assert_eq!(values.len(), records.len());
+        let valid = valid_ptr(records.len(), valid);
+        unsafe {
+            tableGenRecordsGetIntColumn(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                self.0,
+                values.as_mut_ptr(),
+                valid,
+            )
+        }
+    }
+
+    /// Reads this field of all given records as strings, see
+    /// [`bit_column`](Self::bit_column). Strings that are not valid UTF-8
+    /// are reported as not valid.
+    pub fn str_column<'a>(
+        self,
+        records: &[Record<'a>],
+        values: &mut [&'a str],
+        mut valid: Option<&mut [bool]>,
+    ) -> usize {
+        assert_eq!(values.len(), records.len());
+        let mut raw = Vec::with_capacity(records.len());
+        let valid_raw = valid_ptr(records.len(), valid.as_deref_mut());
+        unsafe {
+            tableGenRecordsGetStringColumn(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                self.0,
+                raw.as_mut_ptr(),
+                valid_raw,
+            );
+            raw.set_len(records.len());
+        }
+        let mut count = 0;
+        for (i, string) in raw.into_iter().enumerate() {
+            let string = if string.data.is_null() {
+                None
+            } else {
+                unsafe { StringRef::from_raw(string) }.try_into().ok()
+            };
+            values[i] = string.unwrap_or_default();
+            if let Some(valid) = valid.as_deref_mut() {
+                valid[i] = valid[i] && string.is_some();
+            }
+            count += string.is_some() as usize;
+        }
+        count
+    }
+
+    /// Reads this field of all given records as definitions, see
+    /// [`bit_column`](Self::bit_column). Entries without a valid value are
+    /// set to `None`.
+    pub fn def_column<'a>(
+        self,
+        records: &[Record<'a>],
+        values: &mut [Option<Record<'a>>],
+    ) -> usize {
+        assert_eq!(values.len(), records.len());
+        let mut raw = Vec::with_capacity(records.len());
+        let count = unsafe {
+            let count = tableGenRecordsGetDefColumn(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                self.0,
+                raw.as_mut_ptr(),
+                std::ptr::null_mut(),
+            );
+            raw.set_len(records.len());
+            count
+        };
+        for (value, record) in values.iter_mut().zip(raw) {
+            *value = (!record.is_null()).then(|| unsafe { Record::from_raw(record) });
+        }
+        count
+    }
+
+    /// Reads this field of all given records as the ids of definitions, see
+    /// [`bit_column`](Self::bit_column). Entries without a valid value are
+    /// set to `None`.
+    pub fn def_id_column(self, records: &[Record], values: &mut [Option<RecordId>]) -> usize {
+        assert_eq!(values.len(), records.len());
+        let mut raw = vec![0; records.len()];
+        let count = unsafe {
+            tableGenRecordsGetDefIdColumn(
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                self.0,
+                raw.as_mut_ptr(),
+                std::ptr::null_mut(),
+            )
+        };
+        for (value, id) in values.iter_mut().zip(raw) {
+            *value = (id != 0).then_some(RecordId(id));
+        }
+        count
+    }
+}
+
 macro_rules! record_value {
     ($(#[$attr:meta])* $name:ident, $type:ty) => {
         paste! {
@@ -172,6 +395,37 @@ impl<'a> Record<'a> {
         }
     }
 
+    /// Returns a [`RecordValue`] for the field with the given id.
+    pub fn value_by_id(self, id: FieldId) -> Result<RecordValue<'a>, Error> {
+        let value = unsafe { tableGenRecordGetValueById(self.raw, id.0) };
+        if !value.is_null() {
+            Ok(unsafe { RecordValue::from_raw(value) })
+        } else {
+            let name = unsafe {
+                StringRef::from_raw(tableGenRecordKeeperGetFieldName(
+                    tableGenRecordGetRecords(self.raw),
+                    id.0,
+                ))
+            };
+            Err(
+                TableGenError::MissingValue(String::from_utf8_lossy(name.into()).into())
+                    .with_location(self),
+            )
+        }
+    }
+
+    /// Returns the value of the field with the given name, with references to
+    /// other fields and template arguments of the record resolved.
+    ///
+    /// The fields of definitions are always resolved, but the fields of
+    /// classes can refer to other fields, such as `int b = !add(a, 1);`, for
+    /// which [`RecordValue::init`] is not a concrete value. Resolved values are
+    /// cached by the [`RecordKeeper`](crate::RecordKeeper).
+    pub fn resolved_value(self, name: &str) -> Result<TypedInit<'a>, Error> {
+        let value = self.value(name)?;
+        Ok(unsafe { TypedInit::from_raw(tableGenRecordGetResolvedValue(self.raw, value.raw)) })
+    }
+
     /// Returns true if the record is anonymous.
     pub fn anonymous(self) -> bool {
         unsafe { tableGenRecordIsAnonymous(self.raw) > 0 }
@@ -183,6 +437,23 @@ impl<'a> Record<'a> {
         unsafe { tableGenRecordIsSubclassOf(self.raw, StringRef::from(class).to_raw()) > 0 }
     }
 
+    /// Same as [`Record::subclass_of`], with a class id of the keeper that
+    /// owns the record.
+    pub fn subclass_of_id(self, class: ClassId) -> bool {
+        unsafe { tableGenRecordIsSubclassOfId(self.raw, class.0) > 0 }
+    }
+
+    /// Returns a structural hash of the record's name, template arguments,
+    /// superclasses and fields, which can be used as a cache key for
+    /// outputs generated from the record.
+    ///
+    /// Referenced records only contribute their name, except for anonymous
+    /// records, which contribute their contents. Hashes are stable across
+    /// processes, but not across LLVM versions.
+    pub fn fingerprint(self) -> u64 {
+        unsafe { tableGenRecordHash(self.raw) }
+    }
+
     /// Returns an iterator over the fields of the record.
     ///
     /// The iterator yields [`RecordValue`] structs
@@ -193,7 +464,7 @@ impl<'a> Record<'a> {
 
 impl<'a> SourceLoc for Record<'a> {
     fn source_location(self) -> SourceLocation {
-        unsafe { SourceLocation::from_raw(tableGenRecordGetLoc(self.raw)) }
+        unsafe { SourceLocation::from_raw_span(tableGenRecordGetLocSpan(self.raw)) }
     }
 }
 
@@ -236,19 +507,14 @@ pub struct RecordValue<'a> {
     _reference: PhantomData<&'a TableGenRecordRef>,
 }
 
+unsafe impl Send for RecordValue<'_> {}
+unsafe impl Sync for RecordValue<'_> {}
+
 impl<'a> Display for RecordValue<'a> {
     fn fmt(&self, formatter: &mut Formatter) -> fmt::Result {
-        let mut data = (formatter, Ok(()));
-
-        unsafe {
-            tableGenRecordValPrint(
-                self.raw,
-                Some(print_callback),
-                &mut data as *mut _ as *mut c_void,
-            );
-        }
-
-        data.1
+        print_to_formatter(formatter, |buffer, reserve, data| unsafe {
+            tableGenRecordValPrintToBuffer(self.raw, buffer, reserve, data)
+        })
     }
 }
 
@@ -268,11 +534,18 @@ impl<'a> RecordValue<'a> {
             _reference: PhantomData,
         }
     }
+
+    /// Same as [`TypedInit::decode`] on [`init`](Self::init), read with a
+    /// single call on the field.
+    pub fn decode(self) -> InitValue<'a> {
+        self.init
+            .decoded(unsafe { tableGenRecordValDecode(self.raw) })
+    }
 }
 
 impl<'a> SourceLoc for RecordValue<'a> {
     fn source_location(self) -> SourceLocation {
-        unsafe { SourceLocation::from_raw(tableGenRecordValGetLoc(self.raw)) }
+        unsafe { SourceLocation::from_raw_span(tableGenRecordValGetLocSpan(self.raw)) }
     }
 }
 
@@ -373,6 +646,163 @@ mod tests {
         );
     }
 
+    #[test]
+    fn resolved_value() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class C<int v> {
+                    int a = v;
+                    int b = !add(a, 1);
+                    bits<2> x = 0b10;
+                    bits<4> c = { x, 1, 1 };
+                }
+                class D : C<2>;
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let d = rk.class("D").unwrap();
+        assert!(i64::try_from(d.value("b").unwrap().init).is_err());
+        assert_eq!(i64::try_from(d.resolved_value("b").unwrap()), Ok(3));
+        assert_eq!(
+            Vec::<bool>::try_from(d.resolved_value("c").unwrap()),
+            Ok(vec![true, true, false, true])
+        );
+        assert_eq!(d.resolved_value("b"), d.resolved_value("b"));
+        assert!(d.resolved_value("e").is_err());
+    }
+
+    #[test]
+    fn value_by_id() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class A<int s> {
+                    int size = s;
+                }
+                def B : A<4> {
+                    string name = "b";
+                }
+                def C : A<8>;
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let size = rk.field_id("size").expect("field exists");
+        let name = rk.field_id("name").expect("field exists");
+        assert_eq!(rk.field_id("other"), None);
+        let b = rk.def("B").expect("def B exists");
+        let c = rk.def("C").expect("def C exists");
+        assert_eq!(b.value_by_id(size).and_then(i64::try_from), Ok(4));
+        assert_eq!(c.value_by_id(size).and_then(i64::try_from), Ok(8));
+        assert_eq!(
+            b.value_by_id(name).and_then(String::try_from),
+            Ok("b".into())
+        );
+        assert!(c.value_by_id(name).is_err());
+    }
+
+    #[test]
+    fn class_ids() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class A;
+                class B;
+                class C : A;
+                def D1 : A;
+                def D2 : B, C;
+                def D3;
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let a = rk.class_id("A").expect("class A exists");
+        let b = rk.class_id("B").expect("class B exists");
+        let c = rk.class("C").expect("class C exists");
+        assert_eq!(rk.class_id("E"), None);
+        assert!(c.subclass_of_id(a));
+        assert!(!c.subclass_of_id(b));
+
+        let defs = [
+            rk.def("D1").unwrap(),
+            rk.def("D2").unwrap(),
+            rk.def("D3").unwrap(),
+        ];
+        for def in defs {
+            assert_eq!(def.subclass_of_id(a), def.subclass_of("A"));
+            assert_eq!(def.subclass_of_id(b), def.subclass_of("B"));
+        }
+        let mut matches = [false; 3];
+        assert_eq!(a.subclass_column(&defs, Some(&mut matches)), 2);
+        assert_eq!(matches, [true, true, false]);
+        assert_eq!(
+            ClassId::all_subclass_column(&[a, b], &defs, Some(&mut matches)),
+            1
+        );
+        assert_eq!(matches, [false, true, false]);
+        assert_eq!(ClassId::all_subclass_column(&[], &defs, None), 3);
+    }
+
+    #[test]
+    fn columns() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class Base;
+                def R : Base;
+                class A<int s, bit b, string n> {
+                    int size = s;
+                    bit flag = b;
+                    string name = n;
+                    Base base = R;
+                }
+                def B : A<4, 1, "b">;
+                def C : A<8, 0, "c">;
+                def D {
+                    string size = "none";
+                }
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let records: Vec<_> = ["B", "C", "D"]
+            .into_iter()
+            .map(|name| rk.def(name).expect("def exists"))
+            .collect();
+        let mut valid = [false; 3];
+
+        let mut sizes = [0; 3];
+        let size = rk.field_id("size").expect("field exists");
+        assert_eq!(size.int_column(&records, &mut sizes, Some(&mut valid)), 2);
+        assert_eq!(sizes, [4, 8, 0]);
+        assert_eq!(valid, [true, true, false]);
+
+        let mut flags = [true; 3];
+        let flag = rk.field_id("flag").expect("field exists");
+        assert_eq!(flag.bit_column(&records, &mut flags, None), 2);
+        assert_eq!(flags, [true, false, false]);
+
+        let mut names = [""; 3];
+        let name = rk.field_id("name").expect("field exists");
+        assert_eq!(name.str_column(&records, &mut names, Some(&mut valid)), 2);
+        assert_eq!(names, ["b", "c", ""]);
+        assert_eq!(valid, [true, true, false]);
+        assert_eq!(size.str_column(&records, &mut names, None), 1);
+        assert_eq!(names, ["", "", "none"]);
+
+        let mut defs = [None; 3];
+        let base = rk.field_id("base").expect("field exists");
+        let r = rk.def("R").ok();
+        assert_eq!(base.def_column(&records, &mut defs), 2);
+        assert_eq!(defs, [r, r, None]);
+    }
+
     #[test]
     fn values() {
         let rk = TableGenParser::new()
@@ -457,4 +887,38 @@ mod tests {
             panic!("expected error")
         }
     }
+
+    #[test]
+    fn resolve_locations() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+def A {
+  int size = 1;
+}
+def B;
+"#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let a = rk.def("A").expect("def A exists");
+        let b = rk.def("B").expect("def B exists");
+        let size = a.value("size").expect("size exists");
+        let locations = [
+            a.source_location(),
+            size.source_location(),
+            b.source_location(),
+            SourceLocation::none(),
+        ];
+        assert_eq!(a.source_location(), locations[0]);
+        let resolved = rk.source_info().resolve(&locations);
+        assert_eq!(
+            resolved
+                .iter()
+                .map(|l| (l.buffer, l.line, l.column))
+                .collect::<Vec<_>>(),
+            [(1, 2, 1), (1, 3, 7), (1, 5, 1), (0, 0, 0)]
+        );
+    }
 }
@@ -8,52 +8,104 @@
 // option. This file may not be copied, modified, or distributed
 // except according to those terms.
 
+use std::fmt::{self, Display, Formatter};
+use std::io::{self, Write};
 use std::marker::PhantomData;
+use std::sync::OnceLock;
 
+use crate::diff::RecordDiff;
 #[cfg(feature = "llvm18-0")]
 use crate::error::TableGenError;
 #[cfg(any(feature = "llvm16-0", feature = "llvm17-0"))]
 use crate::error::{SourceLocation, TableGenError, WithLocation};
 use crate::raw::{
-    tableGenRecordKeeperFree, tableGenRecordKeeperGetAllDerivedDefinitions,
-    tableGenRecordKeeperGetClass, tableGenRecordKeeperGetDef, tableGenRecordKeeperGetFirstClass,
-    tableGenRecordKeeperGetFirstDef, tableGenRecordKeeperGetNextClass,
-    tableGenRecordKeeperGetNextDef, tableGenRecordKeeperItemGetName,
-    tableGenRecordKeeperItemGetRecord, tableGenRecordKeeperIteratorClone,
-    tableGenRecordKeeperIteratorFree, tableGenRecordVectorFree, tableGenRecordVectorGet,
-    TableGenRecordKeeperIteratorRef, TableGenRecordKeeperRef, TableGenRecordVectorRef,
+    tableGenRecordKeeperCompact, tableGenRecordKeeperDiff, tableGenRecordKeeperEmitJson,
+    tableGenRecordKeeperExport, tableGenRecordKeeperFree,
+    tableGenRecordKeeperGetAllDerivedDefinitionsMulti,
+    tableGenRecordKeeperGetAllDerivedDefinitionsMultiById, tableGenRecordKeeperGetClass,
+    tableGenRecordKeeperGetClassId, tableGenRecordKeeperGetClassesArray,
+    tableGenRecordKeeperGetDef, tableGenRecordKeeperGetDefsArray,
+    tableGenRecordKeeperGetDerivedDefinitionsSpan,
+    tableGenRecordKeeperGetDerivedDefinitionsSpanById, tableGenRecordKeeperGetFieldId,
+    tableGenRecordKeeperGetNumClasses, tableGenRecordKeeperGetNumDefs,
+    tableGenRecordKeeperGetRecordById, tableGenRecordKeeperGetRecordId,
+    tableGenRecordKeeperGetRecordIds, tableGenRecordKeeperGetRecordTable, tableGenRecordKeeperHash,
+    tableGenRecordKeeperMemoryUsage, tableGenRecordKeeperPrintToBuffer,
+    tableGenRecordKeeperSaveSnapshot, tableGenRecordKeeperSetLeakOnFree, tableGenRecordVectorFree,
+    tableGenRecordVectorGetSpan, tableGenSourcesChanged, TableGenClassId, TableGenCompactFlags,
+    TableGenMemoryUsage, TableGenNamedRecord, TableGenRecordKeeperRef, TableGenRecordRef,
+    TableGenRecordSpan, TableGenRecordVectorRef,
 };
-use crate::record::Record;
+use crate::record::{ClassId, FieldId, Record, RecordId};
+use crate::stats::{MemoryUsage, Stats};
 use crate::string_ref::StringRef;
-use crate::{Error, SourceInfo, TableGenParser};
+use crate::util::{print_to_formatter, print_to_vec, write_to};
+use crate::{parallel, Error, SourceInfo, TableGenParser};
 
 /// Struct that holds all records from a TableGen file.
-#[derive(Debug, PartialEq, Eq)]
+#[derive(Debug)]
 pub struct RecordKeeper<'s> {
-    raw: TableGenRecordKeeperRef,
+    pub(crate) raw: TableGenRecordKeeperRef,
     pub(crate) parser: TableGenParser<'s>,
+    classes: OnceLock<Box<[TableGenNamedRecord]>>,
+    defs: OnceLock<Box<[TableGenNamedRecord]>>,
 }
 
+// The keeper is never modified after parsing, and its lazily built indices are
+// initialized at most once in a thread-safe way.
+unsafe impl Send for RecordKeeper<'_> {}
+unsafe impl Sync for RecordKeeper<'_> {}
+
+impl<'s> PartialEq for RecordKeeper<'s> {
+    fn eq(&self, other: &Self) -> bool {
+        self.raw == other.raw && self.parser == other.parser
+    }
+}
+
+impl<'s> Eq for RecordKeeper<'s> {}
+
 impl<'s> RecordKeeper<'s> {
     pub(crate) unsafe fn from_raw(
         raw: TableGenRecordKeeperRef,
         parser: TableGenParser<'s>,
     ) -> RecordKeeper<'s> {
-        RecordKeeper { raw, parser }
+        RecordKeeper {
+            raw,
+            parser,
+            classes: OnceLock::new(),
+            defs: OnceLock::new(),
+        }
     }
 
     /// Returns an iterator over all classes.
     ///
     /// The iterator yields tuples of type `(String, Record)`.
     pub fn classes(&self) -> NamedRecordIter<'_, IsClass> {
-        unsafe { NamedRecordIter::from_raw(tableGenRecordKeeperGetFirstClass(self.raw)) }
+        let classes = self.classes.get_or_init(|| unsafe {
+            let mut classes = Vec::with_capacity(tableGenRecordKeeperGetNumClasses(self.raw));
+            let len = tableGenRecordKeeperGetClassesArray(
+                self.raw,
+                classes.as_mut_ptr(),
+                classes.capacity(),
+            );
+            classes.set_len(len);
+            classes.into_boxed_slice()
+        });
+        NamedRecordIter::new(classes)
     }
 
     /// Returns an iterator over all definitions.
     ///
     /// The iterator yields tuples of type `(String, Record)`.
     pub fn defs(&self) -> NamedRecordIter<'_, IsDef> {
-        unsafe { NamedRecordIter::from_raw(tableGenRecordKeeperGetFirstDef(self.raw)) }
+        let defs = self.defs.get_or_init(|| unsafe {
+            let mut defs = Vec::with_capacity(tableGenRecordKeeperGetNumDefs(self.raw));
+            let len =
+                tableGenRecordKeeperGetDefsArray(self.raw, defs.as_mut_ptr(), defs.capacity());
+            defs.set_len(len);
+            defs.into_boxed_slice()
+        });
+        NamedRecordIter::new(defs)
     }
 
     /// Returns the class with the given name.
@@ -82,18 +134,298 @@ impl<'s> RecordKeeper<'s> {
 
     /// Returns an iterator over all definitions that derive from the class with
     /// the given name.
+    ///
+    /// The definitions of all classes are indexed the first time this is
+    /// called, after which lookups do not allocate.
     pub fn all_derived_definitions(&self, name: &str) -> RecordIter {
         unsafe {
-            RecordIter::from_raw_vector(tableGenRecordKeeperGetAllDerivedDefinitions(
+            RecordIter::from_raw_span(tableGenRecordKeeperGetDerivedDefinitionsSpan(
                 self.raw,
                 StringRef::from(name).to_raw(),
             ))
         }
     }
 
+    /// Returns an iterator over all definitions that derive from every one of
+    /// the classes with the given names.
+    pub fn all_derived_definitions_multi(&self, names: &[&str]) -> RecordIter {
+        let names: Vec<_> = names
+            .iter()
+            .map(|&name| unsafe { StringRef::from(name).to_raw() })
+            .collect();
+        unsafe {
+            RecordIter::from_raw_vector(tableGenRecordKeeperGetAllDerivedDefinitionsMulti(
+                self.raw,
+                names.as_ptr(),
+                names.len(),
+            ))
+        }
+    }
+
+    /// Returns the id of the field with the given name, or `None` if no
+    /// record has such a field.
+    ///
+    /// The fields of all records are indexed the first time this is called.
+    pub fn field_id(&self, name: &str) -> Option<FieldId> {
+        let id =
+            unsafe { tableGenRecordKeeperGetFieldId(self.raw, StringRef::from(name).to_raw()) };
+        (id != 0).then_some(FieldId(id))
+    }
+
+    /// Returns the id of the class with the given name, or `None` if there
+    /// is no such class.
+    ///
+    /// The superclasses of all records are indexed the first time this is
+    /// called.
+    pub fn class_id(&self, name: &str) -> Option<ClassId> {
+        let id =
+            unsafe { tableGenRecordKeeperGetClassId(self.raw, StringRef::from(name).to_raw()) };
+        (id != 0).then_some(ClassId(id))
+    }
+
+    /// Returns an iterator over all definitions that derive from the class
+    /// with the given id.
+    pub fn all_derived_definitions_by_id(&self, class: ClassId) -> RecordIter {
+        unsafe {
+            RecordIter::from_raw_span(tableGenRecordKeeperGetDerivedDefinitionsSpanById(
+                self.raw, class.0,
+            ))
+        }
+    }
+
+    /// Returns an iterator over all definitions that derive from every one of
+    /// the classes with the given ids.
+    pub fn all_derived_definitions_multi_by_id(&self, classes: &[ClassId]) -> RecordIter {
+        unsafe {
+            RecordIter::from_raw_vector(tableGenRecordKeeperGetAllDerivedDefinitionsMultiById(
+                self.raw,
+                // ClassId is a transparent wrapper around TableGenClassId.
+                classes.as_ptr() as *const TableGenClassId,
+                classes.len(),
+            ))
+        }
+    }
+
+    /// Returns the id of the given class or definition, or `None` if it
+    /// belongs to another keeper.
+    ///
+    /// All records are numbered the first time this is called. The record id
+    /// of a class is the same as its [`ClassId`].
+    pub fn record_id(&self, record: Record) -> Option<RecordId> {
+        let id = unsafe { tableGenRecordKeeperGetRecordId(self.raw, record.raw) };
+        (id != 0).then_some(RecordId(id))
+    }
+
+    /// Returns the ids of all given records in a single call, see
+    /// [`record_id`](Self::record_id).
+    pub fn record_ids(&self, records: &[Record]) -> Vec<Option<RecordId>> {
+        let mut ids = vec![0; records.len()];
+        unsafe {
+            tableGenRecordKeeperGetRecordIds(
+                self.raw,
+                records.as_ptr() as *const TableGenRecordRef,
+                records.len(),
+                ids.as_mut_ptr(),
+            )
+        };
+        ids.into_iter()
+            .map(|id| (id != 0).then_some(RecordId(id)))
+            .collect()
+    }
+
+    /// Returns the class or definition with the given id.
+    pub fn record_by_id(&self, id: RecordId) -> Option<Record> {
+        let record = unsafe { tableGenRecordKeeperGetRecordById(self.raw, id.0) };
+        (!record.is_null()).then(|| unsafe { Record::from_raw(record) })
+    }
+
+    /// Returns all classes followed by all definitions of this keeper, so that
+    /// the record with id `id` is at [`id.index()`](RecordId::index).
+    pub fn record_table(&self) -> &[Record] {
+        let table = unsafe { tableGenRecordKeeperGetRecordTable(self.raw) };
+        // The first entry is null, and Record is a transparent wrapper around
+        // TableGenRecordRef.
+        unsafe { std::slice::from_raw_parts(table.records.add(1) as *const Record, table.len - 1) }
+    }
+
+    /// Returns true if any file read while parsing, including files pulled
+    /// in through `include`, changed on disk since.
+    pub fn sources_changed(&self) -> bool {
+        unsafe { tableGenSourcesChanged(self.parser.raw) > 0 }
+    }
+
+    /// Parses the same sources and include paths again, reading source
+    /// files from disk, and returns the new keeper.
+    ///
+    /// TableGen cannot resume a parse, so everything is parsed again. Use
+    /// [`diff`](Self::diff) to find the records that changed.
+    pub fn reparse(&self) -> Result<RecordKeeper<'static>, Error> {
+        self.parser.reload()?.parse()
+    }
+
+    /// Returns the classes and definitions that were added, removed or
+    /// modified in `new` compared to this keeper.
+    pub fn diff<'a>(&'a self, new: &'a RecordKeeper) -> RecordDiff<'a> {
+        unsafe { RecordDiff::from_raw(tableGenRecordKeeperDiff(self.raw, new.raw, 0)) }
+    }
+
+    /// Returns a structural hash of all classes and definitions, see
+    /// [`Record::fingerprint`].
+    ///
+    /// Keepers with the same records have the same fingerprint, even if their
+    /// anonymous definitions are numbered differently.
+    pub fn fingerprint(&self) -> u64 {
+        unsafe { tableGenRecordKeeperHash(self.raw) }
+    }
+
+    /// Drops the keeper without destroying its records, leaving their memory
+    /// to be reclaimed when the process exits.
+    ///
+    /// Tearing down a large keeper takes a noticeable amount of time, which
+    /// short-lived tools that exit right after using it can skip this way.
+    pub fn leak(self) {
+        unsafe { tableGenRecordKeeperSetLeakOnFree(self.raw, 1) };
+    }
+
+    /// Calls `f` for every definition from several threads, see
+    /// [`parallel::for_each`].
+    pub fn par_for_each_def<'a>(&'a self, f: impl Fn(Record<'a>) + Sync) {
+        parallel::for_each(&self.def_records(), f)
+    }
+
+    /// Returns the result of `f` for every definition, computed on several
+    /// threads, in the same order as [`defs`](Self::defs).
+    pub fn par_map_defs<'a, T: Send>(&'a self, f: impl Fn(Record<'a>) -> T + Sync) -> Vec<T> {
+        parallel::map(&self.def_records(), f)
+    }
+
+    /// Returns the definitions for which `f` returns true, evaluated on
+    /// several threads, in the same order as [`defs`](Self::defs).
+    pub fn par_filter_defs<'a>(&'a self, f: impl Fn(Record<'a>) -> bool + Sync) -> Vec<Record<'a>> {
+        parallel::filter(&self.def_records(), f)
+    }
+
+    fn def_records(&self) -> Vec<Record> {
+        self.defs();
+        self.defs
+            .get()
+            .into_iter()
+            .flatten()
+            .map(|def| unsafe { Record::from_raw(def.record) })
+            .collect()
+    }
+
     pub fn source_info(&self) -> SourceInfo {
         SourceInfo(&self.parser)
     }
+
+    /// Returns the statistics of the parser this keeper was created by.
+    pub fn stats(&self) -> Stats {
+        self.parser.stats()
+    }
+
+    /// Returns an estimate of the memory held by this keeper and the source
+    /// buffers of its parser.
+    pub fn memory_usage(&self) -> MemoryUsage {
+        let mut raw = TableGenMemoryUsage {
+            records: 0,
+            values: 0,
+            inits: 0,
+            sources: 0,
+            mapped_sources: 0,
+            indices: 0,
+        };
+        unsafe { tableGenRecordKeeperMemoryUsage(self.parser.raw, self.raw, &mut raw) };
+        raw.into()
+    }
+
+    /// Frees caches of resolved values and fingerprints, which are rebuilt
+    /// when needed, and if `drop_sources` is set, the source buffers of the
+    /// parser.
+    ///
+    /// Without sources, locations of records can no longer be resolved and
+    /// errors are printed without source lines. [`sources_changed`] still
+    /// works, but [`reparse`] fails if the parser has source strings.
+    ///
+    /// [`sources_changed`]: RecordKeeper::sources_changed
+    /// [`reparse`]: RecordKeeper::reparse
+    pub fn compact(&mut self, drop_sources: bool) {
+        let mut flags = TableGenCompactFlags::TableGenCompactCaches;
+        if drop_sources {
+            flags |= TableGenCompactFlags::TableGenCompactSources;
+        }
+        unsafe { tableGenRecordKeeperCompact(self.parser.raw, self.raw, flags) };
+    }
+
+    /// Saves a [`Snapshot`](crate::Snapshot) of all classes and definitions
+    /// to the given path, which can be loaded again with
+    /// [`TableGenParser::load_snapshot`] as long as the sources do not change.
+    pub fn save_snapshot(&self, path: &str) -> Result<(), Error> {
+        if unsafe {
+            tableGenRecordKeeperSaveSnapshot(
+                self.parser.raw,
+                self.raw,
+                StringRef::from(path).to_raw(),
+            ) > 0
+        } {
+            Ok(())
+        } else {
+            Err(TableGenError::Snapshot.into())
+        }
+    }
+
+    /// Exports all classes and definitions in the
+    /// [`Snapshot`](crate::Snapshot) format to a byte vector.
+    ///
+    /// The result is a single flat block of memory without pointers, which
+    /// can be loaded with [`Snapshot::from_bytes`](crate::Snapshot::from_bytes)
+    /// in another process.
+    pub fn export(&self) -> Result<Vec<u8>, Error> {
+        print_to_vec(|buffer, reserve, data| unsafe {
+            tableGenRecordKeeperExport(self.parser.raw, self.raw, buffer, reserve, data)
+        })
+        .ok_or_else(|| TableGenError::Snapshot.into())
+    }
+
+    /// Writes the definitions as JSON to `writer`, in the same format as
+    /// `llvm-tblgen --dump-json`.
+    ///
+    /// If `classes` is not empty, only definitions that derive from all of
+    /// them are written. If `fields` is not empty, only these fields are
+    /// written. Definitions are encoded on up to `threads` threads, or one
+    /// per hardware thread if it is 0, and streamed to `writer` in chunks, so
+    /// the output is never held in memory as a whole.
+    pub fn write_json(
+        &self,
+        writer: impl Write,
+        classes: &[ClassId],
+        fields: &[FieldId],
+        threads: usize,
+    ) -> io::Result<()> {
+        write_to(writer, |callback, data| unsafe {
+            tableGenRecordKeeperEmitJson(
+                self.parser.raw,
+                self.raw,
+                classes.as_ptr() as *const _,
+                classes.len(),
+                fields.as_ptr() as *const _,
+                fields.len(),
+                callback,
+                data,
+                threads,
+            )
+        })
+    }
+}
+
+impl<'s> Display for RecordKeeper<'s> {
+    /// Prints all classes and definitions in the same format as
+    /// `llvm-tblgen --print-records`.
+    fn fmt(&self, formatter: &mut Formatter) -> fmt::Result {
+        print_to_formatter(formatter, |buffer, reserve, data| unsafe {
+            tableGenRecordKeeperPrintToBuffer(self.raw, buffer, reserve, data)
+        })
+    }
 }
 
 impl<'s> Drop for RecordKeeper<'s> {
@@ -109,101 +441,153 @@ pub struct IsClass;
 #[doc(hidden)]
 pub struct IsDef;
 
-trait NextRecord {
-    unsafe fn next(raw: &mut TableGenRecordKeeperIteratorRef);
-}
-
-impl NextRecord for IsClass {
-    unsafe fn next(raw: &mut TableGenRecordKeeperIteratorRef) {
-        tableGenRecordKeeperGetNextClass(raw);
-    }
-}
-
-impl NextRecord for IsDef {
-    unsafe fn next(raw: &mut TableGenRecordKeeperIteratorRef) {
-        tableGenRecordKeeperGetNextDef(raw);
-    }
-}
-
+/// Iterator over the classes or definitions of a [`RecordKeeper`].
+///
+/// The records are fetched in a single call the first time they are
+/// requested and cached by the keeper, so iterating does not allocate or
+/// cross the FFI boundary.
 #[derive(Debug)]
 pub struct NamedRecordIter<'a, T> {
-    raw: TableGenRecordKeeperIteratorRef,
+    records: std::slice::Iter<'a, TableGenNamedRecord>,
     _kind: PhantomData<&'a T>,
 }
 
 impl<'a, T> NamedRecordIter<'a, T> {
-    unsafe fn from_raw(raw: TableGenRecordKeeperIteratorRef) -> Self {
+    fn new(records: &'a [TableGenNamedRecord]) -> Self {
         NamedRecordIter {
-            raw,
+            records: records.iter(),
             _kind: PhantomData,
         }
     }
+
+    unsafe fn item(record: &TableGenNamedRecord) -> <Self as Iterator>::Item {
+        (
+            StringRef::from_raw(record.name).try_into(),
+            Record::from_raw(record.record),
+        )
+    }
 }
 
-impl<'a, T: NextRecord> Iterator for NamedRecordIter<'a, T> {
+impl<'a, T> Iterator for NamedRecordIter<'a, T> {
     type Item = (Result<&'a str, std::str::Utf8Error>, Record<'a>);
 
     fn next(&mut self) -> Option<Self::Item> {
-        let current = if self.raw.is_null() {
-            return None;
-        } else {
-            unsafe {
-                Some((
-                    StringRef::from_raw(tableGenRecordKeeperItemGetName(self.raw)).try_into(),
-                    Record::from_raw(tableGenRecordKeeperItemGetRecord(self.raw)),
-                ))
-            }
-        };
-        unsafe { T::next(&mut self.raw) };
-        current
+        self.records
+            .next()
+            .map(|record| unsafe { Self::item(record) })
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.records.size_hint()
+    }
+
+    fn nth(&mut self, n: usize) -> Option<Self::Item> {
+        self.records
+            .nth(n)
+            .map(|record| unsafe { Self::item(record) })
     }
 }
 
-impl<'a, T> Clone for NamedRecordIter<'a, T> {
-    fn clone(&self) -> Self {
-        unsafe { Self::from_raw(tableGenRecordKeeperIteratorClone(self.raw)) }
+impl<'a, T> DoubleEndedIterator for NamedRecordIter<'a, T> {
+    fn next_back(&mut self) -> Option<Self::Item> {
+        self.records
+            .next_back()
+            .map(|record| unsafe { Self::item(record) })
     }
 }
 
-impl<'a, T> Drop for NamedRecordIter<'a, T> {
-    fn drop(&mut self) {
-        unsafe { tableGenRecordKeeperIteratorFree(self.raw) }
+impl<'a, T> ExactSizeIterator for NamedRecordIter<'a, T> {}
+
+impl<'a, T> Clone for NamedRecordIter<'a, T> {
+    fn clone(&self) -> Self {
+        NamedRecordIter {
+            records: self.records.clone(),
+            _kind: PhantomData,
+        }
     }
 }
 
+/// Iterator over a list of records.
+///
+/// The records are either borrowed from an index owned by the
+/// [`RecordKeeper`] or from a vector owned by the iterator itself.
+#[derive(Debug)]
 pub struct RecordIter<'a> {
     raw: TableGenRecordVectorRef,
-    index: usize,
-    _reference: PhantomData<&'a ()>,
+    records: std::slice::Iter<'a, TableGenRecordRef>,
 }
 
 impl<'a> RecordIter<'a> {
-    unsafe fn from_raw_vector(ptr: TableGenRecordVectorRef) -> RecordIter<'a> {
+    unsafe fn from_raw_span(span: TableGenRecordSpan) -> RecordIter<'a> {
         RecordIter {
+            raw: std::ptr::null_mut(),
+            records: Self::slice(span).iter(),
+        }
+    }
+
+    pub(crate) unsafe fn from_raw_vector(ptr: TableGenRecordVectorRef) -> RecordIter<'a> {
+        RecordIter {
+            records: Self::slice(tableGenRecordVectorGetSpan(ptr)).iter(),
             raw: ptr,
-            index: 0,
-            _reference: PhantomData,
         }
     }
+
+    unsafe fn slice(span: TableGenRecordSpan) -> &'a [TableGenRecordRef] {
+        if span.len == 0 {
+            &[]
+        } else {
+            std::slice::from_raw_parts(span.records, span.len)
+        }
+    }
+}
+
+impl<'a> RecordIter<'a> {
+    /// Returns the remaining records as a slice, e.g. to query them in
+    /// parallel with the functions in [`parallel`].
+    ///
+    /// The slice borrows the iterator, which may own the records vector.
+    pub fn as_slice(&self) -> &[Record<'a>] {
+        let records = self.records.as_slice();
+        // Record is a transparent wrapper around TableGenRecordRef.
+        unsafe { std::slice::from_raw_parts(records.as_ptr() as *const Record<'a>, records.len()) }
+    }
 }
 
 impl<'a> Iterator for RecordIter<'a> {
     type Item = Record<'a>;
 
     fn next(&mut self) -> Option<Record<'a>> {
-        let next = unsafe { tableGenRecordVectorGet(self.raw, self.index) };
-        self.index += 1;
-        if next.is_null() {
-            None
-        } else {
-            unsafe { Some(Record::from_raw(next)) }
-        }
+        self.records
+            .next()
+            .map(|&record| unsafe { Record::from_raw(record) })
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.records.size_hint()
+    }
+
+    fn nth(&mut self, n: usize) -> Option<Record<'a>> {
+        self.records
+            .nth(n)
+            .map(|&record| unsafe { Record::from_raw(record) })
+    }
+}
+
+impl<'a> DoubleEndedIterator for RecordIter<'a> {
+    fn next_back(&mut self) -> Option<Record<'a>> {
+        self.records
+            .next_back()
+            .map(|&record| unsafe { Record::from_raw(record) })
     }
 }
 
+impl<'a> ExactSizeIterator for RecordIter<'a> {}
+
 impl<'a> Drop for RecordIter<'a> {
     fn drop(&mut self) {
-        unsafe { tableGenRecordVectorFree(self.raw) }
+        if !self.raw.is_null() {
+            unsafe { tableGenRecordVectorFree(self.raw) }
+        }
     }
 }
 
@@ -233,6 +617,11 @@ mod test {
             .for_each(|i| assert!(i.1.name().unwrap() == i.0.unwrap()));
         assert!(rk.classes().map(|i| i.0.unwrap()).eq(["A", "B", "C"]));
         assert!(rk.defs().map(|i| i.0.unwrap()).eq(["D1", "D2", "D3"]));
+        assert_eq!(rk.defs().len(), 3);
+        assert_eq!(rk.defs().next_back().unwrap().0, Ok("D3"));
+        let mut defs = rk.defs();
+        defs.next();
+        assert!(defs.clone().map(|i| i.0.unwrap()).eq(["D2", "D3"]));
     }
 
     #[test]
@@ -256,6 +645,119 @@ mod test {
         assert!(a.map(|i| i.name().unwrap().to_string()).eq(["D1", "D2"]));
         let b = rk.all_derived_definitions("B");
         assert!(b.map(|i| i.name().unwrap().to_string()).eq(["D2", "D3"]));
+        assert_eq!(rk.all_derived_definitions("C").len(), 1);
+        assert_eq!(rk.all_derived_definitions("E").len(), 0);
+        assert!(rk
+            .all_derived_definitions("A")
+            .rev()
+            .map(|i| i.name().unwrap())
+            .eq(["D2", "D1"]));
+        let ab = rk.all_derived_definitions_multi(&["B", "A"]);
+        assert!(ab.map(|i| i.name().unwrap().to_string()).eq(["D2"]));
+        assert_eq!(rk.all_derived_definitions_multi(&["A", "C"]).len(), 0);
+        assert_eq!(rk.all_derived_definitions_multi(&["A", "E"]).len(), 0);
+        let ids = [rk.class_id("B").unwrap(), rk.class_id("A").unwrap()];
+        let ab = rk.all_derived_definitions_multi_by_id(&ids);
+        assert!(ab.map(|i| i.name().unwrap().to_string()).eq(["D2"]));
+        assert_eq!(rk.all_derived_definitions_multi_by_id(&[]).len(), 0);
+    }
+
+    #[test]
+    fn parse_batch() {
+        let parsers = vec![
+            TableGenParser::new().add_source("def A;").unwrap(),
+            TableGenParser::new().add_source("def B").unwrap(),
+            TableGenParser::new()
+                .add_source("class C; def D: C;")
+                .unwrap(),
+        ];
+        let keepers = TableGenParser::parse_batch(parsers);
+        assert_eq!(keepers.len(), 3);
+        assert!(keepers[0].as_ref().unwrap().def("A").is_ok());
+        assert!(keepers[1].is_err());
+        let rk = keepers[2].as_ref().unwrap();
+        assert!(rk
+            .all_derived_definitions("C")
+            .map(|i| i.name().unwrap().to_string())
+            .eq(["D"]));
+    }
+
+    #[test]
+    fn record_ids() {
+        let rk = TableGenParser::new()
+            .add_source("class A { A next = ?; } def X : A; def Y : A { let next = X; }")
+            .unwrap()
+            .parse()
+            .unwrap();
+        let table = rk.record_table();
+        assert_eq!(table.len(), 3);
+        for (index, &record) in table.iter().enumerate() {
+            let id = rk.record_id(record).unwrap();
+            assert_eq!(id.index(), index);
+            assert_eq!(rk.record_by_id(id), Some(record));
+        }
+        let a = rk.class_id("A").unwrap();
+        assert_eq!(
+            rk.record_id(rk.class("A").unwrap()).map(|id| id.0),
+            Some(a.0)
+        );
+        assert_eq!(rk.all_derived_definitions_by_id(a).count(), 2);
+
+        let defs = rk.all_derived_definitions("A");
+        let ids = rk.record_ids(defs.as_slice());
+        assert_eq!(ids, [rk.record_id(table[1]), rk.record_id(table[2])]);
+        let mut next = [None; 2];
+        let next_id = rk.field_id("next").unwrap();
+        assert_eq!(next_id.def_id_column(defs.as_slice(), &mut next), 1);
+        assert_eq!(next, [None, ids[0]]);
+
+        let other = TableGenParser::new()
+            .add_source("def X;")
+            .unwrap()
+            .parse()
+            .unwrap();
+        assert_eq!(rk.record_id(other.def("X").unwrap()), None);
+    }
+
+    #[test]
+    fn shared_source_file() {
+        let path = std::env::temp_dir().join(format!("tblgen-shared-{}.td", std::process::id()));
+        std::fs::write(&path, "class A; def B : A;").unwrap();
+        let path = path.to_str().unwrap();
+        let keepers = TableGenParser::parse_batch(vec![
+            TableGenParser::new().add_shared_source_file(path).unwrap(),
+            TableGenParser::new().add_shared_source_file(path).unwrap(),
+        ]);
+        for keeper in &keepers {
+            assert!(keeper.as_ref().unwrap().def("B").unwrap().subclass_of("A"));
+        }
+        assert!(TableGenParser::new()
+            .add_shared_source_file("does-not-exist.td")
+            .is_err());
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn print() {
+        let rk = TableGenParser::new()
+            .add_source(
+                r#"
+                class A<int v> {
+                    int value = v;
+                }
+                def B : A<4>;
+                "#,
+            )
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        let printed = rk.to_string();
+        assert!(printed.contains("class A<int A:v = ?> {"));
+        assert!(printed.contains("def B {\t// A\n  int value = 4;\n}"));
+        assert_eq!(
+            rk.def("B").unwrap().to_string(),
+            "B {\t// A\n  int value = 4;\n}\n"
+        );
     }
 
     #[test]
@@ -273,4 +775,100 @@ mod test {
         assert_eq!(rk.class("A").expect("class exists").name().unwrap(), "A");
         assert_eq!(rk.def("D1").expect("def exists").name().unwrap(), "D1");
     }
+
+    #[test]
+    fn fingerprint() {
+        let parse = |source: &str| {
+            TableGenParser::new()
+                .add_source(source)
+                .unwrap()
+                .parse()
+                .expect("valid tablegen")
+        };
+        let a = parse("class A<int v> { int x = v; } def B : A<1>; def C : A<2>;");
+        let b = parse("class A<int v> { int x = v; }\n\ndef B : A<1>; def C : A<3>;");
+        assert_eq!(a.fingerprint(), a.fingerprint());
+        assert_eq!(
+            a.def("B").unwrap().fingerprint(),
+            b.def("B").unwrap().fingerprint()
+        );
+        assert_ne!(
+            a.def("C").unwrap().fingerprint(),
+            b.def("C").unwrap().fingerprint()
+        );
+        assert_ne!(
+            a.def("B").unwrap().fingerprint(),
+            a.def("C").unwrap().fingerprint()
+        );
+        assert_ne!(a.fingerprint(), b.fingerprint());
+
+        // Anonymous defs do not depend on their numbering.
+        let c = parse("class A { int x = 1; } def : A; def D { A a = A<>; }");
+        let d = parse("class A { int x = 1; } def : A; def : A; def D { A a = A<>; }");
+        assert_eq!(
+            c.def("D").unwrap().fingerprint(),
+            d.def("D").unwrap().fingerprint()
+        );
+        assert_ne!(c.fingerprint(), d.fingerprint());
+    }
+
+    #[test]
+    fn write_json() {
+        use crate::record::{ClassId, FieldId};
+
+        let rk = TableGenParser::new()
+            .add_source(
+                "class A<int v> { int x = v; bits<2> b = {1, ?}; } class B; class C;
+                def X : A<1>, B; def Y : A<2> { string s = \"q\\\"\"; }",
+            )
+            .unwrap()
+            .parse()
+            .unwrap();
+        let json = |classes: &[ClassId], fields: &[FieldId], threads| {
+            let mut bytes = Vec::new();
+            rk.write_json(&mut bytes, classes, fields, threads).unwrap();
+            String::from_utf8(bytes).unwrap()
+        };
+        let all = json(&[], &[], 1);
+        assert!(all.starts_with(
+            r#"{"!instanceof":{"A":["X","Y"],"B":["X"],"C":[]},"!tablegen_json_version":1,"X":{"#
+        ));
+        assert!(all.contains(r#""!name":"X","!superclasses":["A","B"],"b":[null,1],"x":1}"#));
+        assert!(all.contains(r#""s":"q\"","x":2}}"#));
+        assert!(all.ends_with("}\n"));
+        assert_eq!(json(&[], &[], 4), all);
+
+        let b = rk.class_id("B").unwrap();
+        let x = rk.field_id("x").unwrap();
+        let filtered = json(&[b], &[x], 0);
+        assert!(filtered.starts_with(r#"{"!instanceof":{"A":["X"],"B":["X"]},"#));
+        assert!(filtered.contains(r#""!superclasses":["A","B"],"x":1}}"#));
+        assert!(!filtered.contains(r#""Y""#));
+    }
+
+    #[test]
+    fn memory_usage() {
+        let mut rk = TableGenParser::new()
+            .add_source("class A<int v> { int x = v; string s = \"abc\"; } def B : A<1>;")
+            .unwrap()
+            .parse()
+            .unwrap();
+        let fingerprint = rk.fingerprint();
+        let usage = rk.memory_usage();
+        assert!(usage.records > 0 && usage.values > 0 && usage.inits > 0);
+        assert!(usage.sources > 0);
+        assert!(usage.indices > 0);
+
+        rk.compact(false);
+        let compacted = rk.memory_usage();
+        assert!(compacted.indices < usage.indices);
+        assert_eq!(compacted.sources, usage.sources);
+
+        rk.compact(true);
+        assert_eq!(rk.memory_usage().sources, 0);
+        assert_eq!(rk.fingerprint(), fingerprint);
+        assert_eq!(rk.def("B").unwrap().int_value("x"), Ok(1));
+        assert!(!rk.sources_changed());
+        assert!(rk.reparse().is_err());
+    }
 }
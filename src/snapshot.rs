@@ -0,0 +1,636 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! This module contains a read-only, memory-mapped view of a parsed
+//! [`RecordKeeper`](crate::RecordKeeper).
+//!
+//! A snapshot is saved with
+//! [`RecordKeeper::save_snapshot`](crate::RecordKeeper::save_snapshot) and
+//! loaded with [`TableGenParser::load_snapshot`](crate::TableGenParser::load_snapshot).
+//! Loading only succeeds if the parser has the same sources and include paths
+//! as the one that produced the snapshot, and none of the included files
+//! changed since. The snapshot file is mapped into memory and read in place.
+//!
+//! The same format can also be produced in memory with
+//! [`RecordKeeper::export`](crate::RecordKeeper::export), for example to send
+//! it to another process, and loaded with [`Snapshot::from_bytes`].
+//!
+//! ```rust
+//! use tblgen_alt::TableGenParser;
+//!
+//! # fn main() -> Result<(), Box<dyn std::error::Error>> {
+//! let source = "class A { int i = 4; } def D: A;";
+//! let path = std::env::temp_dir().join("tblgen-doctest.snapshot");
+//! let path = path.to_str().unwrap();
+//!
+//! let parser = TableGenParser::new().add_source(source)?;
+//! let snapshot = match parser.load_snapshot(path) {
+//!     Some(snapshot) => snapshot,
+//!     None => {
+//!         let keeper = parser.parse()?;
+//!         keeper.save_snapshot(path)?;
+//!         TableGenParser::new()
+//!             .add_source(source)?
+//!             .load_snapshot(path)
+//!             .expect("snapshot was just saved")
+//!     }
+//! };
+//! let d = snapshot.def("D").expect("has def D");
+//! assert!(d.subclass_of("A"));
+//! assert_eq!(d.value("i").map(|v| v.init()), Some(tblgen_alt::snapshot::SnapshotInit::Int(4)));
+//! # Ok(())
+//! # }
+//! ```
+
+use crate::raw::{
+    tableGenSnapshotFree, tableGenSnapshotFromBuffer, tableGenSnapshotGetHeader,
+    TableGenSnapshotHeader, TableGenSnapshotInit, TableGenSnapshotInitKind,
+    TableGenSnapshotLocation, TableGenSnapshotRecord, TableGenSnapshotRecordFlags,
+    TableGenSnapshotRef, TableGenSnapshotSection, TableGenSnapshotString, TableGenSnapshotValue,
+    TableGenStringRef,
+};
+
+/// A location in a TableGen source file, as stored in a [`Snapshot`].
+pub type SnapshotLocation = TableGenSnapshotLocation;
+
+/// A memory-mapped snapshot of the classes and defs of a
+/// [`RecordKeeper`](crate::RecordKeeper).
+#[derive(Debug)]
+pub struct Snapshot {
+    raw: TableGenSnapshotRef,
+    header: *const TableGenSnapshotHeader,
+    strings: *const str,
+}
+
+// A snapshot is an immutable block of memory, which is safe to share.
+unsafe impl Sync for Snapshot {}
+unsafe impl Send for Snapshot {}
+
+impl Snapshot {
+    /// Creates a snapshot from a raw object.
+    ///
+    /// Returns `None` if the raw object is null or the string table of the
+    /// snapshot is not valid UTF-8.
+    ///
+    /// # Safety
+    ///
+    /// The raw object must be valid or null.
+    pub unsafe fn from_raw(raw: TableGenSnapshotRef) -> Option<Self> {
+        if raw.is_null() {
+            return None;
+        }
+        let header = tableGenSnapshotGetHeader(raw);
+        let bytes = std::slice::from_raw_parts(
+            (header as *const u8).add((*header).strings.offset as usize),
+            (*header).strings.count as usize,
+        );
+        match std::str::from_utf8(bytes) {
+            Ok(strings) => Some(Self {
+                raw,
+                header,
+                strings,
+            }),
+            Err(_) => {
+                tableGenSnapshotFree(raw);
+                None
+            }
+        }
+    }
+
+    /// Loads a snapshot from memory, such as the output of
+    /// [`RecordKeeper::export`](crate::RecordKeeper::export), copying it
+    /// once.
+    ///
+    /// Returns `None` if the bytes are not a valid snapshot. Unlike
+    /// [`TableGenParser::load_snapshot`](crate::TableGenParser::load_snapshot),
+    /// this does not check whether the sources changed.
+    pub fn from_bytes(bytes: &[u8]) -> Option<Self> {
+        unsafe {
+            Self::from_raw(tableGenSnapshotFromBuffer(TableGenStringRef {
+                data: bytes.as_ptr() as *const _,
+                len: bytes.len(),
+            }))
+        }
+    }
+
+    fn header(&self) -> &TableGenSnapshotHeader {
+        unsafe { &*self.header }
+    }
+
+    fn section<T>(&self, section: TableGenSnapshotSection) -> &[T] {
+        // The C API checked that all sections are aligned and in bounds.
+        unsafe {
+            std::slice::from_raw_parts(
+                (self.header as *const u8).add(section.offset as usize) as *const T,
+                section.count as usize,
+            )
+        }
+    }
+
+    fn string(&self, string: TableGenSnapshotString) -> &str {
+        let start = string.offset as usize;
+        unsafe { &*self.strings }
+            .get(start..start + string.len as usize)
+            .unwrap_or_default()
+    }
+
+    fn records(&self) -> &[TableGenSnapshotRecord] {
+        self.section(self.header().records)
+    }
+
+    fn num_classes(&self) -> usize {
+        self.header().num_classes as usize
+    }
+
+    fn record(&self, index: usize) -> SnapshotRecord<'_> {
+        SnapshotRecord {
+            snapshot: self,
+            raw: &self.records()[index],
+        }
+    }
+
+    fn find(&self, range: std::ops::Range<usize>, name: &str) -> Option<SnapshotRecord<'_>> {
+        // Records are stored in the order of the keeper, which is sorted by name.
+        let records = &self.records()[range.clone()];
+        records
+            .binary_search_by(|record| self.string(record.name).cmp(name))
+            .ok()
+            .map(|index| self.record(range.start + index))
+    }
+
+    /// Returns an iterator over all classes.
+    pub fn classes(&self) -> SnapshotRecordIter<'_> {
+        SnapshotRecordIter {
+            snapshot: self,
+            range: 0..self.num_classes(),
+        }
+    }
+
+    /// Returns an iterator over all definitions.
+    pub fn defs(&self) -> SnapshotRecordIter<'_> {
+        SnapshotRecordIter {
+            snapshot: self,
+            range: self.num_classes()..self.records().len(),
+        }
+    }
+
+    /// Returns the class with the given name.
+    pub fn class(&self, name: &str) -> Option<SnapshotRecord<'_>> {
+        self.find(0..self.num_classes(), name)
+    }
+
+    /// Returns the definition with the given name.
+    pub fn def(&self, name: &str) -> Option<SnapshotRecord<'_>> {
+        self.find(self.num_classes()..self.records().len(), name)
+    }
+
+    /// Returns an iterator over all definitions that derive from the class
+    /// with the given name.
+    pub fn all_derived_definitions<'a>(
+        &'a self,
+        name: &'a str,
+    ) -> impl Iterator<Item = SnapshotRecord<'a>> + 'a {
+        self.defs().filter(move |def| def.subclass_of(name))
+    }
+}
+
+impl Drop for Snapshot {
+    fn drop(&mut self) {
+        unsafe { tableGenSnapshotFree(self.raw) }
+    }
+}
+
+/// A class or def stored in a [`Snapshot`].
+#[derive(Clone, Copy)]
+pub struct SnapshotRecord<'a> {
+    snapshot: &'a Snapshot,
+    raw: &'a TableGenSnapshotRecord,
+}
+
+impl<'a> std::fmt::Debug for SnapshotRecord<'a> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_tuple("SnapshotRecord").field(&self.name()).finish()
+    }
+}
+
+impl<'a> PartialEq for SnapshotRecord<'a> {
+    fn eq(&self, other: &Self) -> bool {
+        std::ptr::eq(self.raw, other.raw)
+    }
+}
+
+impl<'a> Eq for SnapshotRecord<'a> {}
+
+impl<'a> SnapshotRecord<'a> {
+    /// Returns the name of the record.
+    pub fn name(self) -> &'a str {
+        self.snapshot.string(self.raw.name)
+    }
+
+    /// Returns true if the record is a class.
+    pub fn is_class(self) -> bool {
+        self.raw.flags & TableGenSnapshotRecordFlags::TABLEGEN_SNAPSHOT_RECORD_CLASS != 0
+    }
+
+    /// Returns true if the record is anonymous.
+    pub fn anonymous(self) -> bool {
+        self.raw.flags & TableGenSnapshotRecordFlags::TABLEGEN_SNAPSHOT_RECORD_ANONYMOUS != 0
+    }
+
+    /// Returns the source locations of the record.
+    pub fn locations(self) -> &'a [SnapshotLocation] {
+        let start = self.raw.first_location as usize;
+        &self
+            .snapshot
+            .section::<SnapshotLocation>(self.snapshot.header().locations)
+            [start..start + self.raw.num_locations as usize]
+    }
+
+    /// Returns an iterator over all superclasses of the record.
+    pub fn superclasses(self) -> impl Iterator<Item = SnapshotRecord<'a>> + 'a {
+        let snapshot = self.snapshot;
+        let start = self.raw.first_superclass as usize;
+        snapshot.section::<u32>(snapshot.header().indices)
+            [start..start + self.raw.num_superclasses as usize]
+            .iter()
+            .map(move |&index| snapshot.record(index as usize))
+    }
+
+    /// Returns true if the record is a subclass of the class with the given
+    /// name.
+    pub fn subclass_of(self, class: &str) -> bool {
+        self.superclasses()
+            .any(|superclass| superclass.name() == class)
+    }
+
+    /// Returns an iterator over the fields of the record.
+    pub fn values(self) -> impl Iterator<Item = SnapshotValue<'a>> + Clone + 'a {
+        let snapshot = self.snapshot;
+        let start = self.raw.first_value as usize;
+        snapshot.section::<TableGenSnapshotValue>(snapshot.header().values)
+            [start..start + self.raw.num_values as usize]
+            .iter()
+            .map(move |raw| SnapshotValue { snapshot, raw })
+    }
+
+    /// Returns the field with the given name.
+    pub fn value(self, name: &str) -> Option<SnapshotValue<'a>> {
+        self.values().find(|value| value.name() == name)
+    }
+}
+
+/// A field of a [`SnapshotRecord`].
+#[derive(Clone, Copy)]
+pub struct SnapshotValue<'a> {
+    snapshot: &'a Snapshot,
+    raw: &'a TableGenSnapshotValue,
+}
+
+impl<'a> std::fmt::Debug for SnapshotValue<'a> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("SnapshotValue")
+            .field("name", &self.name())
+            .field("init", &self.init())
+            .finish()
+    }
+}
+
+impl<'a> SnapshotValue<'a> {
+    /// Returns the name of the field.
+    pub fn name(self) -> &'a str {
+        self.snapshot.string(self.raw.name)
+    }
+
+    /// Returns the type of the field as it would be written in TableGen,
+    /// e.g. `bits<4>`.
+    pub fn type_name(self) -> &'a str {
+        self.snapshot.string(self.raw.type_)
+    }
+
+    /// Returns the source location of the field.
+    pub fn location(self) -> SnapshotLocation {
+        self.snapshot
+            .section::<SnapshotLocation>(self.snapshot.header().locations)
+            [self.raw.location as usize]
+    }
+
+    /// Returns the value of the field.
+    pub fn init(self) -> SnapshotInit<'a> {
+        SnapshotInit::new(self.snapshot, self.raw.init)
+    }
+}
+
+/// A value stored in a [`Snapshot`].
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum SnapshotInit<'a> {
+    Unset,
+    Bit(bool),
+    Bits(SnapshotList<'a>),
+    Int(i64),
+    String(&'a str),
+    Code(&'a str),
+    List(SnapshotList<'a>),
+    Dag(SnapshotDag<'a>),
+    Def(SnapshotRecord<'a>),
+    /// A value that is not fully resolved, in its printed form.
+    Unresolved(&'a str),
+}
+
+impl<'a> SnapshotInit<'a> {
+    fn new(snapshot: &'a Snapshot, index: u32) -> Self {
+        let raw =
+            &snapshot.section::<TableGenSnapshotInit>(snapshot.header().inits)[index as usize];
+        let list = SnapshotList { snapshot, raw };
+
+        #[allow(non_upper_case_globals)]
+        match raw.kind {
+            TableGenSnapshotInitKind::TableGenSnapshotBitInitKind => Self::Bit(raw.value != 0),
+            TableGenSnapshotInitKind::TableGenSnapshotBitsInitKind => Self::Bits(list),
+            TableGenSnapshotInitKind::TableGenSnapshotIntInitKind => Self::Int(raw.value),
+            TableGenSnapshotInitKind::TableGenSnapshotStringInitKind => {
+                Self::String(snapshot.string(raw.string))
+            }
+            TableGenSnapshotInitKind::TableGenSnapshotCodeInitKind => {
+                Self::Code(snapshot.string(raw.string))
+            }
+            TableGenSnapshotInitKind::TableGenSnapshotListInitKind => Self::List(list),
+            TableGenSnapshotInitKind::TableGenSnapshotDagInitKind => {
+                Self::Dag(SnapshotDag { snapshot, raw })
+            }
+            TableGenSnapshotInitKind::TableGenSnapshotDefInitKind => {
+                Self::Def(snapshot.record(raw.value as usize))
+            }
+            TableGenSnapshotInitKind::TableGenSnapshotUnresolvedInitKind => {
+                Self::Unresolved(snapshot.string(raw.string))
+            }
+            _ => Self::Unset,
+        }
+    }
+}
+
+/// The elements of a list or the bits of a bits value in a [`Snapshot`].
+#[derive(Clone, Copy)]
+pub struct SnapshotList<'a> {
+    snapshot: &'a Snapshot,
+    raw: &'a TableGenSnapshotInit,
+}
+
+impl<'a> std::fmt::Debug for SnapshotList<'a> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_list().entries(self.iter()).finish()
+    }
+}
+
+impl<'a> PartialEq for SnapshotList<'a> {
+    fn eq(&self, other: &Self) -> bool {
+        std::ptr::eq(self.raw, other.raw)
+    }
+}
+
+impl<'a> Eq for SnapshotList<'a> {}
+
+impl<'a> SnapshotList<'a> {
+    fn indices(self) -> &'a [u32] {
+        let start = self.raw.first as usize;
+        &self.snapshot.section::<u32>(self.snapshot.header().indices)
+            [start..start + self.raw.count as usize]
+    }
+
+    /// Returns true if the list is empty.
+    pub fn is_empty(self) -> bool {
+        self.len() == 0
+    }
+
+    /// Returns the length of the list.
+    pub fn len(self) -> usize {
+        self.raw.count as usize
+    }
+
+    /// Returns the element at the given index in the list.
+    pub fn get(self, index: usize) -> Option<SnapshotInit<'a>> {
+        self.indices()
+            .get(index)
+            .map(|&init| SnapshotInit::new(self.snapshot, init))
+    }
+
+    /// Returns an iterator over the elements of the list.
+    pub fn iter(self) -> impl Iterator<Item = SnapshotInit<'a>> + Clone + 'a {
+        let snapshot = self.snapshot;
+        self.indices()
+            .iter()
+            .map(move |&init| SnapshotInit::new(snapshot, init))
+    }
+}
+
+/// A dag value in a [`Snapshot`].
+#[derive(Clone, Copy)]
+pub struct SnapshotDag<'a> {
+    snapshot: &'a Snapshot,
+    raw: &'a TableGenSnapshotInit,
+}
+
+impl<'a> std::fmt::Debug for SnapshotDag<'a> {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("SnapshotDag")
+            .field("operator", &self.operator())
+            .field("args", &self.args().collect::<Vec<_>>())
+            .finish()
+    }
+}
+
+impl<'a> PartialEq for SnapshotDag<'a> {
+    fn eq(&self, other: &Self) -> bool {
+        std::ptr::eq(self.raw, other.raw)
+    }
+}
+
+impl<'a> Eq for SnapshotDag<'a> {}
+
+impl<'a> SnapshotDag<'a> {
+    /// Returns the operator of the dag.
+    pub fn operator(self) -> SnapshotInit<'a> {
+        SnapshotInit::new(self.snapshot, self.raw.value as u32)
+    }
+
+    /// Returns the name of the dag, which is empty if it has none.
+    pub fn name(self) -> &'a str {
+        self.snapshot.string(self.raw.string)
+    }
+
+    /// Returns the number of arguments for this dag.
+    pub fn num_args(self) -> usize {
+        self.raw.count as usize
+    }
+
+    /// Returns an iterator over the arguments of the dag.
+    ///
+    /// The iterator yields tuples `(&str, SnapshotInit)`.
+    pub fn args(self) -> impl Iterator<Item = (&'a str, SnapshotInit<'a>)> + Clone + 'a {
+        let snapshot = self.snapshot;
+        let start = self.raw.first as usize;
+        snapshot.section::<u32>(snapshot.header().indices)[start..start + 3 * self.num_args()]
+            .chunks_exact(3)
+            .map(move |arg| {
+                (
+                    snapshot.string(TableGenSnapshotString {
+                        offset: arg[1],
+                        len: arg[2],
+                    }),
+                    SnapshotInit::new(snapshot, arg[0]),
+                )
+            })
+    }
+}
+
+/// Iterator over the classes or defs of a [`Snapshot`].
+#[derive(Debug, Clone)]
+pub struct SnapshotRecordIter<'a> {
+    snapshot: &'a Snapshot,
+    range: std::ops::Range<usize>,
+}
+
+impl<'a> Iterator for SnapshotRecordIter<'a> {
+    type Item = SnapshotRecord<'a>;
+
+    fn next(&mut self) -> Option<SnapshotRecord<'a>> {
+        self.range.next().map(|index| self.snapshot.record(index))
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.range.size_hint()
+    }
+}
+
+impl<'a> ExactSizeIterator for SnapshotRecordIter<'a> {}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::TableGenParser;
+
+    const SOURCE: &str = r#"
+        class A<int n> {
+            int i = n;
+            list<int> l = [1, 2];
+        }
+        def ins;
+        def D1: A<1>;
+        def D2: A<2> {
+            string s = "hello";
+            dag args = (ins D1:$src);
+            bits<2> b = { 1, 0 };
+        }
+    "#;
+
+    fn snapshot_path(name: &str) -> String {
+        std::env::temp_dir()
+            .join(format!("tblgen-{}-{}.snapshot", name, std::process::id()))
+            .to_str()
+            .unwrap()
+            .to_string()
+    }
+
+    #[test]
+    fn round_trip() {
+        let path = snapshot_path("round-trip");
+        let keeper = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .parse()
+            .unwrap();
+        keeper.save_snapshot(&path).unwrap();
+
+        let snapshot = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .load_snapshot(&path)
+            .expect("snapshot is up to date");
+        assert!(snapshot.classes().map(|c| c.name()).eq(["A"]));
+        assert!(snapshot.defs().map(|d| d.name()).eq(["D1", "D2", "ins"]));
+
+        let d2 = snapshot.def("D2").expect("D2 exists");
+        assert!(d2.subclass_of("A"));
+        assert!(!d2.is_class());
+        assert_eq!(d2.value("i").map(|v| v.init()), Some(SnapshotInit::Int(2)));
+        assert_eq!(d2.value("i").map(|v| v.type_name()), Some("int"));
+        assert_eq!(
+            d2.value("s").map(|v| v.init()),
+            Some(SnapshotInit::String("hello"))
+        );
+        match d2.value("l").unwrap().init() {
+            SnapshotInit::List(l) => {
+                assert!(l.iter().eq([SnapshotInit::Int(1), SnapshotInit::Int(2)]))
+            }
+            init => panic!("unexpected init {:?}", init),
+        }
+        match d2.value("b").unwrap().init() {
+            SnapshotInit::Bits(b) => assert!(b
+                .iter()
+                .eq([SnapshotInit::Bit(false), SnapshotInit::Bit(true)])),
+            init => panic!("unexpected init {:?}", init),
+        }
+        match d2.value("args").unwrap().init() {
+            SnapshotInit::Dag(dag) => {
+                assert_eq!(
+                    dag.operator(),
+                    SnapshotInit::Def(snapshot.def("ins").unwrap())
+                );
+                assert!(dag
+                    .args()
+                    .eq([("src", SnapshotInit::Def(snapshot.def("D1").unwrap()))]));
+            }
+            init => panic!("unexpected init {:?}", init),
+        }
+        assert_eq!(snapshot.all_derived_definitions("A").count(), 2);
+        std::fs::remove_file(path).unwrap();
+    }
+
+    #[test]
+    fn export() {
+        let keeper = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .parse()
+            .unwrap();
+        let bytes = keeper.export().unwrap();
+        assert_eq!(&bytes[..6], b"TGSNAP");
+
+        let snapshot = Snapshot::from_bytes(&bytes).expect("export is valid");
+        assert!(snapshot.defs().map(|d| d.name()).eq(["D1", "D2", "ins"]));
+        let d1 = snapshot.def("D1").expect("D1 exists");
+        assert_eq!(d1.value("i").map(|v| v.init()), Some(SnapshotInit::Int(1)));
+
+        assert!(Snapshot::from_bytes(&bytes[..bytes.len() - 1]).is_none());
+        assert!(Snapshot::from_bytes(b"TGSNAP").is_none());
+    }
+
+    #[test]
+    fn stale() {
+        let path = snapshot_path("stale");
+        let keeper = TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .parse()
+            .unwrap();
+        keeper.save_snapshot(&path).unwrap();
+
+        assert!(TableGenParser::new()
+            .add_source("def D1;")
+            .unwrap()
+            .load_snapshot(&path)
+            .is_none());
+        assert!(TableGenParser::new()
+            .add_source(SOURCE)
+            .unwrap()
+            .add_include_path("include")
+            .load_snapshot(&path)
+            .is_none());
+        std::fs::remove_file(path).unwrap();
+    }
+}
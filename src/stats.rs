@@ -0,0 +1,242 @@
+// Copyright 2023 Daan Vanoverloop
+// See the COPYRIGHT file at the top-level directory of this distribution.
+//
+// Licensed under the Apache License, Version 2.0 <LICENSE-APACHE or
+// http://www.apache.org/licenses/LICENSE-2.0> or the MIT license
+// <LICENSE-MIT or http://opensource.org/licenses/MIT>, at your
+// option. This file may not be copied, modified, or distributed
+// except according to those terms.
+
+//! This module contains opt-in instrumentation of the C API.
+//!
+//! Parse timings and record counts are always kept per
+//! [`TableGenParser`](crate::TableGenParser). Call counts, allocation counts
+//! and trace events are process-wide and only collected after enabling them
+//! with [`set_enabled`]. Trace events can be written with [`write_trace`] in
+//! the Chrome trace event format and inspected in `chrome://tracing` or
+//! Perfetto.
+
+use std::{
+    ffi::c_void,
+    io::{self, Write},
+    time::Duration,
+};
+
+use crate::{
+    raw::{
+        tableGenStatsGet, tableGenStatsGetCallCounts, tableGenStatsReset, tableGenStatsSetEnabled,
+        tableGenStatsWriteTrace, TableGenMemoryUsage, TableGenParserRef, TableGenStats,
+        TableGenStringRef,
+    },
+    string_ref::StringRef,
+    util::write_to,
+};
+
+/// Heap allocations made by the C API on behalf of the caller.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Allocations {
+    /// Record keeper iterators.
+    pub iterators: u64,
+    /// Record vectors, bit arrays and flattened inits.
+    pub vectors: u64,
+    /// Source locations.
+    pub locations: u64,
+    /// Copied strings.
+    pub strings: u64,
+    /// Parsers, record keepers, diffs, snapshots and diagnostics.
+    pub other: u64,
+}
+
+impl Allocations {
+    pub fn total(&self) -> u64 {
+        self.iterators + self.vectors + self.locations + self.strings + self.other
+    }
+}
+
+/// Statistics of a parser, see [`TableGenParser::stats`].
+///
+/// [`TableGenParser::stats`]: crate::TableGenParser::stats
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct Stats {
+    /// Time spent reading source files and copying source strings.
+    pub read_time: Duration,
+    /// Time spent parsing, which includes lexing and elaborating all records.
+    pub parse_time: Duration,
+    pub parses: u64,
+    /// Number of source buffers, including files pulled in through
+    /// `include`.
+    pub buffers: u64,
+    /// Total size of the source buffers in bytes.
+    pub source_bytes: u64,
+    /// Records and record values created by the last successful parse.
+    pub classes: u64,
+    pub defs: u64,
+    pub values: u64,
+    /// Process-wide allocations of the C API, see [`allocations`].
+    pub allocations: Allocations,
+}
+
+impl Stats {
+    pub(crate) fn get(parser: TableGenParserRef) -> Self {
+        let mut raw = TableGenStats {
+            read_ns: 0,
+            parse_ns: 0,
+            num_parses: 0,
+            num_buffers: 0,
+            num_source_bytes: 0,
+            num_classes: 0,
+            num_defs: 0,
+            num_values: 0,
+            num_iterator_allocations: 0,
+            num_vector_allocations: 0,
+            num_location_allocations: 0,
+            num_string_allocations: 0,
+            num_other_allocations: 0,
+        };
+        unsafe { tableGenStatsGet(parser, &mut raw) };
+        Self {
+            read_time: Duration::from_nanos(raw.read_ns),
+            parse_time: Duration::from_nanos(raw.parse_ns),
+            parses: raw.num_parses,
+            buffers: raw.num_buffers,
+            source_bytes: raw.num_source_bytes,
+            classes: raw.num_classes,
+            defs: raw.num_defs,
+            values: raw.num_values,
+            allocations: Allocations {
+                iterators: raw.num_iterator_allocations,
+                vectors: raw.num_vector_allocations,
+                locations: raw.num_location_allocations,
+                strings: raw.num_string_allocations,
+                other: raw.num_other_allocations,
+            },
+        }
+    }
+}
+
+/// Estimated bytes held by a record keeper and its parser, see
+/// [`RecordKeeper::memory_usage`].
+///
+/// [`RecordKeeper::memory_usage`]: crate::RecordKeeper::memory_usage
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct MemoryUsage {
+    /// Records, including their names, superclass lists and locations.
+    pub records: u64,
+    /// Record values of all records.
+    pub values: u64,
+    /// Inits reachable from the records, each counted once. Inits are
+    /// uniqued by LLVM and may also be used by other keepers.
+    pub inits: u64,
+    /// Source buffers on the heap.
+    pub sources: u64,
+    /// Source files mapped into memory.
+    pub mapped_sources: u64,
+    /// Indices and caches built by the C API for the keeper.
+    pub indices: u64,
+}
+
+impl MemoryUsage {
+    pub fn total(&self) -> u64 {
+        self.records + self.values + self.inits + self.sources + self.mapped_sources + self.indices
+    }
+}
+
+impl From<TableGenMemoryUsage> for MemoryUsage {
+    fn from(raw: TableGenMemoryUsage) -> Self {
+        Self {
+            records: raw.records,
+            values: raw.values,
+            inits: raw.inits,
+            sources: raw.sources,
+            mapped_sources: raw.mapped_sources,
+            indices: raw.indices,
+        }
+    }
+}
+
+/// Enables or disables the process-wide call and allocation counters and
+/// trace events. Both are disabled by default.
+pub fn set_enabled(counters: bool, trace: bool) {
+    unsafe { tableGenStatsSetEnabled(counters.into(), trace.into()) }
+}
+
+/// Returns the allocations made by the C API while counters were enabled.
+pub fn allocations() -> Allocations {
+    Stats::get(std::ptr::null_mut()).allocations
+}
+
+unsafe extern "C" fn call_count_callback(name: TableGenStringRef, count: u64, data: *mut c_void) {
+    let counts = &mut *(data as *mut Vec<(String, u64)>);
+    let name: &[u8] = StringRef::from_raw(name).into();
+    counts.push((String::from_utf8_lossy(name).into_owned(), count));
+}
+
+/// Returns the name and number of calls of every C API entry point that was
+/// called while counters were enabled, most called first.
+pub fn call_counts() -> Vec<(String, u64)> {
+    let mut counts = Vec::<(String, u64)>::new();
+    unsafe {
+        tableGenStatsGetCallCounts(
+            Some(call_count_callback),
+            &mut counts as *mut _ as *mut c_void,
+        )
+    };
+    counts.sort_by(|a, b| b.1.cmp(&a.1).then_with(|| a.0.cmp(&b.0)));
+    counts
+}
+
+/// Clears all call and allocation counts and trace events.
+pub fn reset() {
+    unsafe { tableGenStatsReset() }
+}
+
+/// Writes all trace events recorded while tracing was enabled in the Chrome
+/// trace event JSON format. At most about a million events are kept until the
+/// next [`reset`]; later events are only counted as `droppedEvents` in
+/// `otherData`.
+pub fn write_trace(writer: impl Write) -> io::Result<()> {
+    write_to(writer, |callback, data| unsafe {
+        tableGenStatsWriteTrace(callback, data)
+    })
+}
+
+#[cfg(test)]
+mod test {
+    use super::*;
+    use crate::TableGenParser;
+
+    #[test]
+    fn stats() {
+        set_enabled(true, true);
+        let keeper = TableGenParser::new()
+            .add_source("class A { int x = 1; } def B : A; def C : A;")
+            .unwrap()
+            .parse()
+            .expect("valid tablegen");
+        assert_eq!(keeper.defs().count(), 2);
+
+        let stats = keeper.stats();
+        assert_eq!(stats.parses, 1);
+        assert_eq!(stats.buffers, 1);
+        assert_eq!(stats.classes, 1);
+        assert_eq!(stats.defs, 2);
+        assert_eq!(stats.values, 3);
+        assert!(stats.source_bytes > 0);
+        assert!(allocations().other >= 2);
+
+        let counts = call_counts();
+        assert!(counts
+            .iter()
+            .any(|(name, count)| name == "tableGenParse" && *count > 0));
+
+        let mut trace = Vec::new();
+        write_trace(&mut trace).unwrap();
+        let trace = String::from_utf8(trace).unwrap();
+        assert!(trace.starts_with("{\"traceEvents\":["));
+        assert!(trace.contains("\"name\":\"parse\""));
+
+        // Counters and traces are global, so other tests run without them.
+        set_enabled(false, false);
+        reset();
+    }
+}
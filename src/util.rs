@@ -1,24 +1,63 @@
 use std::{
-    ffi::c_void,
+    ffi::{c_char, c_void},
     fmt::{self, Formatter},
+    io::{self, Write},
 };
 
-use crate::{error::TableGenError, raw::TableGenStringRef, string_ref::StringRef};
+use crate::{
+    error::TableGenError,
+    raw::{
+        TableGenBool, TableGenBuffer, TableGenBufferReserveCallback, TableGenStringCallback,
+        TableGenStringRef,
+    },
+    string_ref::StringRef,
+};
 
-pub(crate) unsafe extern "C" fn print_callback(string: TableGenStringRef, data: *mut c_void) {
-    let (formatter, result) = &mut *(data as *mut (&mut Formatter, fmt::Result));
+unsafe extern "C" fn reserve_callback(
+    buffer: *mut TableGenBuffer,
+    additional: usize,
+    data: *mut c_void,
+) -> TableGenBool {
+    let bytes = &mut *(data as *mut Vec<u8>);
+    let buffer = &mut *buffer;
 
-    if result.is_err() {
-        return;
-    }
+    bytes.set_len(buffer.len);
+    bytes.reserve(additional);
+    buffer.data = bytes.as_mut_ptr() as *mut c_char;
+    buffer.capacity = bytes.capacity();
+    1
+}
 
-    *result = (|| {
-        write!(
-            formatter,
-            "{}",
-            TryInto::<&str>::try_into(StringRef::from_raw(string)).map_err(|_| fmt::Error)?
-        )
-    })();
+/// Collects the output of one of the functions writing to a `TableGenBuffer`
+/// in a byte vector. Returns `None` if the function failed.
+pub(crate) fn print_to_vec(
+    print: impl FnOnce(*mut TableGenBuffer, TableGenBufferReserveCallback, *mut c_void) -> TableGenBool,
+) -> Option<Vec<u8>> {
+    let mut bytes = Vec::new();
+    let mut buffer = TableGenBuffer {
+        data: bytes.as_mut_ptr() as *mut c_char,
+        len: 0,
+        capacity: 0,
+    };
+
+    let printed = print(
+        &mut buffer,
+        Some(reserve_callback),
+        &mut bytes as *mut _ as *mut c_void,
+    ) > 0;
+    unsafe { bytes.set_len(buffer.len) };
+
+    printed.then_some(bytes)
+}
+
+/// Prints into a single buffer with one of the `PrintToBuffer` functions and
+/// writes the result to the formatter.
+pub(crate) fn print_to_formatter(
+    formatter: &mut Formatter,
+    print: impl FnOnce(*mut TableGenBuffer, TableGenBufferReserveCallback, *mut c_void) -> TableGenBool,
+) -> fmt::Result {
+    let bytes = print_to_vec(print).ok_or(fmt::Error)?;
+    formatter.write_str(std::str::from_utf8(&bytes).map_err(|_| fmt::Error)?)
 }
 
 pub(crate) unsafe extern "C" fn print_string_callback(
@@ -37,3 +76,22 @@ pub(crate) unsafe extern "C" fn print_string_callback(
         Ok(())
     })();
 }
+
+unsafe extern "C" fn write_callback(string: TableGenStringRef, data: *mut c_void) {
+    let (writer, result) = &mut *(data as *mut (&mut dyn Write, io::Result<()>));
+    if result.is_ok() {
+        *result = writer.write_all(StringRef::from_raw(string).into());
+    }
+}
+
+/// Streams the output of one of the functions calling a
+/// `TableGenStringCallback` to `writer`. Chunks after the first error are
+/// dropped.
+pub(crate) fn write_to(
+    mut writer: impl Write,
+    write: impl FnOnce(TableGenStringCallback, *mut c_void),
+) -> io::Result<()> {
+    let mut data: (&mut dyn Write, io::Result<()>) = (&mut writer, Ok(()));
+    write(Some(write_callback), &mut data as *mut _ as *mut c_void);
+    data.1
+}